@@ -1,3 +1,7 @@
+#include "kpm-benchmark.h"
+#include "kpm-flow-report.h"
+#include "kpm-results.h"
+
 #include "ns3/antenna-module.h"
 #include "ns3/applications-module.h"
 #include "ns3/buildings-module.h"
@@ -10,6 +14,8 @@
 #include "ns3/nr-module.h"
 #include "ns3/point-to-point-module.h"
 
+#include <ctime>
+
 using namespace ns3;
 
 NS_LOG_COMPONENT_DEFINE("kpm-simul");
@@ -24,6 +30,14 @@ main(int argc, char* argv[])
     uint32_t lambdaBrowsing = 10000;     // packets per sec
     uint32_t lambdaVideo = 10000;        // packets per sec
     double totalTxPower = 35.0;          // dBm
+    std::string resultsDb = "./kpm-out/results.kpmdb";
+    std::string resultsOutput = "both";
+    std::string benchmarkReport = "";
+    uint16_t numGnb = 2;
+    Time simTime = MilliSeconds(1000);
+    Time udpAppStartTime = MilliSeconds(10);
+
+    KpmBenchmarkReport benchmark;
 
     CommandLine cmd(__FILE__);
     cmd.AddValue("direction", "DL|UL", direction);
@@ -33,21 +47,30 @@ main(int argc, char* argv[])
     cmd.AddValue("lambdaBrowsing", "int packets/sec", lambdaBrowsing);
     cmd.AddValue("lambdaVideo", "int packets/sec", lambdaVideo);
     cmd.AddValue("power", "int dBm", totalTxPower);
+    cmd.AddValue("resultsDb",
+                 "results store every run appends its parameters and KPMs to (empty disables)",
+                 resultsDb);
+    cmd.AddValue("resultsOutput",
+                 "both|file|stdout: where the per-flow results of the run are written",
+                 resultsOutput);
+    cmd.AddValue("benchmarkReport",
+                 "file to write the wall time, event rate, peak RSS and mean KPMs to",
+                 benchmarkReport);
+    cmd.AddValue("numGnb", "int number of gNBs, at least 2", numGnb);
+    cmd.AddValue("simTime", "end of the run, e.g. 1000ms or 60s", simTime);
+    cmd.AddValue("udpAppStartTime", "start of the traffic, after attach", udpAppStartTime);
 
     // If --PrintHelp is provided, display the help message and exit
     cmd.Parse(argc, argv);
+    NS_ABORT_MSG_IF(udpAppStartTime >= simTime,
+                    "The traffic must start before the end of the run");
     // Scenario parameters (that we will use inside this script):
-    uint16_t numGnb = 2;
     uint16_t numUePerGnb = 3;
     uint32_t totalUesVid = 2;    // Total voice UEs
     uint32_t totalUesBrowse = 3; // Total browsing UEs
 
     int logging = 1;
 
-    // Simulation parameters.
-    Time simTime = MilliSeconds(1000);
-    Time udpAppStartTime = MilliSeconds(10);
-
     // Two separate BWPs
     // Video stream
     uint16_t numerologyBwp1 = 4;
@@ -233,20 +256,6 @@ main(int argc, char* argv[])
                                                 UintegerValue(bwpIdForBrowsing));
     nrHelper->SetUeBwpManagerAlgorithmAttribute("GBR_NON_CONV_VIDEO", UintegerValue(bwpIdForCall));
 
-    for (uint32_t i = 0; i < ueVideoContainer.GetN(); ++i)
-    {
-        Ptr<Node> ue = ueVideoContainer.Get(i);
-        nrHelper->SetUeBwpManagerAlgorithmAttribute("GBR_NON_CONV_VIDEO",
-                                                    UintegerValue(bwpIdForCall));
-    }
-
-    for (uint32_t i = 0; i < ueBrowsingWebContainer.GetN(); ++i)
-    {
-        Ptr<Node> ue = ueBrowsingWebContainer.Get(i);
-        nrHelper->SetUeBwpManagerAlgorithmAttribute("NGBR_LOW_LAT_EMBB",
-                                                    UintegerValue(bwpIdForBrowsing));
-    }
-
     /*
      * Case (ii): Attributes valid for a subset of the nodes
      */
@@ -563,7 +572,9 @@ main(int argc, char* argv[])
 
     Simulator::Stop(simTime);
     NS_LOG_INFO("Starting the simulation ...");
+    benchmark.StartRun();
     Simulator::Run();
+    benchmark.EndRun();
     NS_LOG_INFO("Simulation finished ...");
 
     monitor->CheckForLostPackets();
@@ -571,126 +582,62 @@ main(int argc, char* argv[])
         DynamicCast<Ipv4FlowClassifier>(flowmonHelper.GetClassifier());
     FlowMonitor::FlowStatsContainer stats = monitor->GetFlowStats();
 
-    double averageFlowThroughput = 0.0;
-    double averageFlowDelay = 0.0;
-
-    std::ofstream outFile;
+    double flowDuration = (simTime - udpAppStartTime).GetSeconds();
+    NS_ABORT_MSG_IF(resultsOutput != "both" && resultsOutput != "file" &&
+                        resultsOutput != "stdout",
+                    "Invalid results output: " << resultsOutput);
     std::string filename = outputDir + "/" + simTag;
-    outFile.open(filename.c_str(), std::ofstream::out | std::ofstream::trunc);
-    if (!outFile.is_open())
+    KpmFlowReport report;
+    report.Format(stats, classifier, flowDuration);
+    double meanFlowThroughput = report.GetMeanFlowThroughput();
+    double meanFlowDelay = report.GetMeanFlowDelay();
+    if (!report.Write(resultsOutput == "stdout" ? "" : filename, resultsOutput != "file"))
     {
-        std::cerr << "Can't open file " << filename << std::endl;
+        std::cerr << "Can't write file " << filename << std::endl;
         return 1;
     }
 
-    outFile.setf(std::ios_base::fixed);
-
-    double flowDuration = (simTime - udpAppStartTime).GetSeconds();
-    for (std::map<FlowId, FlowMonitor::FlowStats>::const_iterator i = stats.begin();
-         i != stats.end();
-         ++i)
+    if (!resultsDb.empty())
     {
-        Ipv4FlowClassifier::FiveTuple t = classifier->FindFlow(i->first);
-        std::stringstream protoStream;
-        protoStream << (uint16_t)t.protocol;
-        if (t.protocol == 6)
-        {
-            protoStream.str("TCP");
-        }
-        if (t.protocol == 17)
-        {
-            protoStream.str("UDP");
-        }
-        outFile << "Flow " << i->first << " (" << t.sourceAddress << ":" << t.sourcePort << " -> "
-                << t.destinationAddress << ":" << t.destinationPort << ") proto "
-                << protoStream.str() << "\n";
-        outFile << "  Tx Packets: " << i->second.txPackets << "\n";
-        outFile << "  Tx Bytes:   " << i->second.txBytes << "\n";
-        outFile << "  TxOffered:  " << i->second.txBytes * 8.0 / flowDuration / 1000.0 / 1000.0
-                << " Mbps\n";
-        outFile << "  Rx Bytes:   " << i->second.rxBytes << "\n";
-        outFile << "  Lost Packets: " << i->second.txPackets - i->second.rxPackets << "\n";
-        outFile << "  Packet loss: "
-                << (((i->second.txPackets - i->second.rxPackets) * 1.0) / i->second.txPackets) * 100
-                << "%" << "\n";
-
-        if (i->second.rxPackets > 0)
-        {
-            // Measure the duration of the flow from receiver's perspective
-            averageFlowThroughput += i->second.rxBytes * 8.0 / flowDuration / 1000 / 1000;
-            averageFlowDelay += 1000 * i->second.delaySum.GetSeconds() / i->second.rxPackets;
-
-            outFile << "  Throughput: " << i->second.rxBytes * 8.0 / flowDuration / 1000 / 1000
-                    << " Mbps\n";
-            outFile << "  Mean delay:  "
-                    << 1000 * i->second.delaySum.GetSeconds() / i->second.rxPackets << " ms\n";
-            // outFile << "  Mean upt:  " << i->second.uptSum / i->second.rxPackets / 1000/1000 << "
-            // Mbps \n";
-            outFile << "  Mean jitter:  "
-                    << 1000 * i->second.jitterSum.GetSeconds() / i->second.rxPackets << " ms\n";
-        }
-        else
+        uint64_t txPackets = 0;
+        uint64_t rxPackets = 0;
+        for (const auto& flow : stats)
         {
-            outFile << "  Throughput:  0 Mbps\n";
-            outFile << "  Mean delay:  0 ms\n";
-            outFile << "  Mean jitter: 0 ms\n";
+            txPackets += flow.second.txPackets;
+            rxPackets += flow.second.rxPackets;
         }
-        outFile << "  Rx Packets: " << i->second.rxPackets << "\n";
+        KpmResultRow row;
+        row.Set("scenario", std::string("haca-kpm-no-rem"));
+        row.Set("simTag", simTag);
+        row.Set("direction", direction);
+        row.Set("mode", mode);
+        row.Set("power", totalTxPower);
+        row.Set("lambdaBrowsing", lambdaBrowsing);
+        row.Set("lambdaVideo", lambdaVideo);
+        row.Set("udpPacketSizeBrowsing", udpPacketSizeBrowsing);
+        row.Set("udpPacketSizeVideo", udpPacketSizeVideo);
+        row.Set("numGnb", numGnb);
+        row.Set("numUePerGnb", numUePerGnb);
+        row.Set("simTime", simTime.GetMilliSeconds());
+        row.Set("rngRun", RngSeedManager::GetRun());
+        row.Set("flows", stats.size());
+        row.Set("flowDuration", flowDuration);
+        row.Set("txPackets", txPackets);
+        row.Set("rxPackets", rxPackets);
+        row.Set("meanFlowThroughput", meanFlowThroughput);
+        row.Set("meanFlowDelay", meanFlowDelay);
+        row.Set("wallClock", std::time(nullptr));
+        NS_ABORT_MSG_IF(!KpmResultsStore::Append(resultsDb, row),
+                        "Can't append to results store " << resultsDb);
     }
 
-    double meanFlowThroughput = averageFlowThroughput / stats.size();
-    double meanFlowDelay = averageFlowDelay / stats.size();
-
-    outFile << "\n\n  Mean flow throughput: " << meanFlowThroughput << "\n";
-    outFile << "  Mean flow delay: " << meanFlowDelay << "\n";
-
-    outFile.close();
-
-    std::ifstream f(filename.c_str());
-
-    if (f.is_open())
+    if (!benchmarkReport.empty())
     {
-        std::cout << f.rdbuf();
+        NS_ABORT_MSG_IF(!benchmark.Write(benchmarkReport, meanFlowThroughput, meanFlowDelay),
+                        "Can't write benchmark report " << benchmarkReport);
     }
 
     Simulator::Destroy();
-
-    if (argc == 0)
-    {
-        double toleranceMeanFlowThroughput = 0.0001 * 56.258560;
-        double toleranceMeanFlowDelay = 0.0001 * 0.553292;
-
-        if (meanFlowThroughput >= 56.258560 - toleranceMeanFlowThroughput &&
-            meanFlowThroughput <= 56.258560 + toleranceMeanFlowThroughput &&
-            meanFlowDelay >= 0.553292 - toleranceMeanFlowDelay &&
-            meanFlowDelay <= 0.553292 + toleranceMeanFlowDelay)
-        {
-            return EXIT_SUCCESS;
-        }
-        else
-        {
-            return EXIT_FAILURE;
-        }
-    }
-    else if (argc == 1 and numUePerGnb == 9) // called from examples-to-run.py with these parameters
-    {
-        double toleranceMeanFlowThroughput = 0.0001 * 47.858536;
-        double toleranceMeanFlowDelay = 0.0001 * 10.504189;
-
-        if (meanFlowThroughput >= 47.858536 - toleranceMeanFlowThroughput &&
-            meanFlowThroughput <= 47.858536 + toleranceMeanFlowThroughput &&
-            meanFlowDelay >= 10.504189 - toleranceMeanFlowDelay &&
-            meanFlowDelay <= 10.504189 + toleranceMeanFlowDelay)
-        {
-            return EXIT_SUCCESS;
-        }
-        else
-        {
-            return EXIT_FAILURE;
-        }
-    }
-    else
-    {
-        return EXIT_SUCCESS; // we dont check other parameters configurations at the moment
-    }
+    // The KPMs are checked against kpm-benchmarks.golden by run_benchmarks.sh.
+    return EXIT_SUCCESS;
 }
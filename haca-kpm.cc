@@ -1,3 +1,18 @@
+#include "kpm-beamforming.h"
+#include "kpm-benchmark.h"
+#include "kpm-bwp-manager.h"
+#include "kpm-capacity.h"
+#include "kpm-checkpoint.h"
+#include "kpm-flow-report.h"
+#include "kpm-handover.h"
+#include "kpm-memory.h"
+#include "kpm-mobility.h"
+#include "kpm-rem.h"
+#include "kpm-results.h"
+#include "kpm-scheduler.h"
+#include "kpm-stats.h"
+#include "kpm-trace-sink.h"
+
 #include "ns3/antenna-module.h"
 #include "ns3/applications-module.h"
 #include "ns3/buildings-module.h"
@@ -10,6 +25,12 @@
 #include "ns3/nr-module.h"
 #include "ns3/point-to-point-module.h"
 
+#include <algorithm>
+#include <cstdio>
+#include <ctime>
+#include <list>
+#include <map>
+
 using namespace ns3;
 
 NS_LOG_COMPONENT_DEFINE("kpm-simul");
@@ -18,35 +39,262 @@ int
 main(int argc, char* argv[])
 {
     std::string direction = "UL";
+    std::string traffic = "DL";
     std::string mode = "COVERAGE_AREA";
     uint32_t udpPacketSizeBrowsing = 25; // bytes
     uint32_t udpPacketSizeVideo = 50;    // bytes
     uint32_t lambdaBrowsing = 10000;     // packets per sec
     uint32_t lambdaVideo = 10000;        // packets per sec
     double totalTxPower = 35.0;          // dBm
+    bool kpmArrayGain = false;
+    std::string scheduler = "map";
+    bool memoryReport = false;
+    bool leanTracing = false;
+    std::string checkpointTimes = "";
+    std::string restoreFrom = "";
+    bool steadyState = false;
+    uint32_t sampleInterval = 10; // ms
+    Time simTime = MilliSeconds(1000);
+    Time udpAppStartTime = MilliSeconds(10);
+    double targetPrecision = 0.0;
+    std::string remBwps = "0";
+    std::string remPlot = "gnuplot";
+    std::string remBeams = "configured";
+    uint32_t codebookOversampling = 2;
+    double remZMax = 1.5;
+    uint16_t remZRes = 0;
+    std::string remLoad = "full";
+    std::string resultsDb = "./kpm-out/results.kpmdb";
+    std::string resultsOutput = "both";
+    std::string benchmarkReport = "";
+    uint16_t numGnb = 2;
+    std::string traceSinkFile = "";
+    uint32_t kpmInterval = 0;
+    std::string capacitySearch = "";
+    double slaDelay = 150.0; // ms, packet delay budget of GBR_CONV_VIDEO
+    double slaLoss = 1e-3;
+    double searchLambdaMin = 100.0;
+    double searchLambdaMax = 100000.0;
+    uint32_t searchProbe = 200;        // ms
+    uint32_t searchDrainTimeout = 5000; // ms
+    double searchTolerance = 0.05;
+    uint32_t searchMaxProbes = 16;
+    std::string mobility = "";
+    double ueSpeed = 3.0;             // m/s
+    uint32_t mobilityStep = 10;       // ms
+    double beamUpdateDistance = 1.0;  // m
+    uint32_t channelUpdatePeriod = 0; // ms
+    bool handover = false;
+    double a3Hysteresis = 3.0;       // dB
+    uint32_t a3TimeToTrigger = 256;  // ms
+    uint32_t measurementPeriod = 40; // ms
+    double neighbourRadius = 50.0;   // m
+    uint32_t maxNeighbours = 8;
+    std::string bwpManager = "static";
+    double bwpLowLoad = 0.5;
+    double bwpHighLoad = 0.8;
+    uint32_t bwpLoadPeriod = 50; // ms
+    uint32_t bwpLatencySlots = 20;
+    uint32_t numRemoteHosts = 1;
+    bool nodeLoad = false;
+
+    KpmBenchmarkReport benchmark;
 
     CommandLine cmd(__FILE__);
-    cmd.AddValue("direction", "DL|UL", direction);
-    cmd.AddValue("mode", "BEAM_SHAPE|COVERAGE_AREA|UE_COVERAGE", mode);
+    cmd.AddValue("direction", "DL|UL|ALL", direction);
+    cmd.AddValue("mode", "BEAM_SHAPE|COVERAGE_AREA|UE_COVERAGE|ALL", mode);
+    cmd.AddValue("traffic",
+                 "DL|UL|BIDIR: remote hosts send to the UEs, the UEs to the remote hosts, or both",
+                 traffic);
     cmd.AddValue("udpPacketSizeBrowsing", "int bytes", udpPacketSizeBrowsing);
     cmd.AddValue("udpPacketSizeVideo", "int bytes", udpPacketSizeVideo);
     cmd.AddValue("lambdaBrowsing", "int packets/sec", lambdaBrowsing);
     cmd.AddValue("lambdaVideo", "int packets/sec", lambdaVideo);
     cmd.AddValue("power", "int dBm", totalTxPower);
+    cmd.AddValue("kpmArrayGain",
+                 "use the batched array-gain engine for beamforming and the REM",
+                 kpmArrayGain);
+    cmd.AddValue("scheduler", "map|heap|list|calendar|wheel", scheduler);
+    cmd.AddValue("memoryReport", "write bytes per gNB, UE, bearer and flow", memoryReport);
+    cmd.AddValue("leanTracing",
+                 "drop per-packet metadata and text traces, probe only the flow endpoints",
+                 leanTracing);
+    cmd.AddValue("checkpointTimes",
+                 "comma separated simulated times (s) at which to write kpm-out/<simTag>.ckpt",
+                 checkpointTimes);
+    cmd.AddValue("restoreFrom", "checkpoint file to resume the run from", restoreFrom);
+    cmd.AddValue("steadyState",
+                 "exclude the warm-up detected by MSER-5 from the statistics",
+                 steadyState);
+    cmd.AddValue("simTime", "end of the run, e.g. 1000ms or 60s", simTime);
+    cmd.AddValue("udpAppStartTime", "start of the traffic, after attach", udpAppStartTime);
+    cmd.AddValue("sampleInterval", "int ms between steady-state samples", sampleInterval);
+    cmd.AddValue("targetPrecision",
+                 "stop once the relative 95% CI of the throughput and delay of every bearer is "
+                 "below this (0 runs to simTime, implies steadyState)",
+                 targetPrecision);
+    cmd.AddValue("remBwps",
+                 "comma separated BWP ids to map, or all; the array-gain REM maps them in one pass",
+                 remBwps);
+    cmd.AddValue("remPlot",
+                 "gnuplot|png: gnuplot scripts, or PNG maps rendered in parallel by the scenario",
+                 remPlot);
+    cmd.AddValue("remBeams",
+                 "configured|ues|codebook: also map DL_BEAM_SWEEP, the best of every attached UE's "
+                 "beam or of a DFT codebook per gNB (needs kpmArrayGain)",
+                 remBeams);
+    cmd.AddValue("codebookOversampling",
+                 "DFT codebook beams per panel row and column",
+                 codebookOversampling);
+    cmd.AddValue("remZMax", "top height (m) of a volumetric REM, from the UE height", remZMax);
+    cmd.AddValue("remZRes",
+                 "height steps of a volumetric REM written to nr-rem-<tag>.vol, 0 for a map at "
+                 "the UE height only (needs kpmArrayGain)",
+                 remZRes);
+    cmd.AddValue("remLoad",
+                 "full|measured: gNB interferers at full buffer, or at the PRB utilization each "
+                 "gNB measured in the traffic run, with the REMs computed after it (needs "
+                 "kpmArrayGain)",
+                 remLoad);
+    cmd.AddValue("resultsDb",
+                 "results store every run appends its parameters and KPMs to (empty disables), "
+                 "see kpm-results-query.cc",
+                 resultsDb);
+    cmd.AddValue("resultsOutput",
+                 "both|file|stdout: where the per-flow results of the run are written",
+                 resultsOutput);
+    cmd.AddValue("benchmarkReport",
+                 "file to write the wall time, event rate, peak RSS and mean KPMs to",
+                 benchmarkReport);
+    cmd.AddValue("numGnb", "int number of gNBs, at least 2", numGnb);
+    cmd.AddValue("traceSink",
+                 "binary trace stream shared by the runs of a sweep, instead of the NR text "
+                 "traces and the per-flow results file",
+                 traceSinkFile);
+    cmd.AddValue("kpmInterval",
+                 "int ms: aggregate per-UE PDCP and PHY KPMs online into <simTag>-kpms every "
+                 "interval, instead of writing the NR text traces (0 disables)",
+                 kpmInterval);
+    cmd.AddValue("capacitySearch",
+                 "video|browsing: instead of a fixed run, search the largest lambda of the "
+                 "bearer that meets slaDelay and slaLoss, with the other bearer at its lambda",
+                 capacitySearch);
+    cmd.AddValue("slaDelay", "largest mean packet delay (ms) of the capacity search", slaDelay);
+    cmd.AddValue("slaLoss", "largest packet loss ratio of the capacity search", slaLoss);
+    cmd.AddValue("searchLambdaMin", "lowest lambda of the capacity search", searchLambdaMin);
+    cmd.AddValue("searchLambdaMax", "highest lambda of the capacity search", searchLambdaMax);
+    cmd.AddValue("searchProbe", "int ms measured per capacity probe", searchProbe);
+    cmd.AddValue("searchDrainTimeout",
+                 "int ms a capacity probe waits for the previous probe's queues to empty",
+                 searchDrainTimeout);
+    cmd.AddValue("searchTolerance",
+                 "relative width of the lambda bracket at which the search stops",
+                 searchTolerance);
+    cmd.AddValue("searchMaxProbes", "largest number of capacity probes", searchMaxProbes);
+    cmd.AddValue("mobility",
+                 "linear|waypoint: move the UEs over the REM area from the traffic start "
+                 "(static if empty)",
+                 mobility);
+    cmd.AddValue("ueSpeed", "UE speed (m/s) of the mobility mode", ueSpeed);
+    cmd.AddValue("mobilityStep", "int ms between UE position updates", mobilityStep);
+    cmd.AddValue("beamUpdateDistance",
+                 "distance (m) a UE moves before its beams are recomputed",
+                 beamUpdateDistance);
+    cmd.AddValue("channelUpdatePeriod",
+                 "int ms between channel and LOS/NLOS updates of a link, 0 keeps them static "
+                 "(mobile runs use mobilityStep instead of 0)",
+                 channelUpdatePeriod);
+    cmd.AddValue("handover",
+                 "A3 handover between the gNBs, measured on a bounded neighbour set per UE",
+                 handover);
+    cmd.AddValue("a3Hysteresis",
+                 "A3 offset (dB) of a neighbour over the serving cell",
+                 a3Hysteresis);
+    cmd.AddValue("a3TimeToTrigger",
+                 "int ms the A3 condition holds before a handover",
+                 a3TimeToTrigger);
+    cmd.AddValue("measurementPeriod", "int ms between RSRP measurements", measurementPeriod);
+    cmd.AddValue("neighbourRadius", "radius (m) of the gNBs measured by a UE", neighbourRadius);
+    cmd.AddValue("maxNeighbours",
+                 "int largest number of gNBs measured besides the serving one",
+                 maxNeighbours);
+    cmd.AddValue("bwpManager",
+                 "static|load: fixed bearer to BWP mapping, or bearers moved off a loaded BWP",
+                 bwpManager);
+    cmd.AddValue("bwpLowLoad", "PRB utilization under which a BWP takes bearers", bwpLowLoad);
+    cmd.AddValue("bwpHighLoad", "PRB utilization over which a BWP sheds bearers", bwpHighLoad);
+    cmd.AddValue("bwpLoadPeriod", "int ms between BWP load measurements", bwpLoadPeriod);
+    cmd.AddValue("bwpLatencySlots",
+                 "int slots of a BWP that must fit in the delay budget of a bearer moved to it",
+                 bwpLatencySlots);
+    cmd.AddValue("remoteHosts",
+                 "int remote hosts, each on its own link to the PGW, the flows hashed over them",
+                 numRemoteHosts);
+    cmd.AddValue("nodeLoad",
+                 "count the events executed per node into <simTag>-node-load",
+                 nodeLoad);
 
     // If --PrintHelp is provided, display the help message and exit
     cmd.Parse(argc, argv);
+    NS_ABORT_MSG_IF(udpAppStartTime >= simTime,
+                    "The traffic must start before the end of the run");
+    NS_ABORT_MSG_IF(traffic != "DL" && traffic != "UL" && traffic != "BIDIR",
+                    "Invalid traffic direction: " << traffic);
+    bool dlTraffic = traffic != "UL";
+    bool ulTraffic = traffic != "DL";
     // Scenario parameters (that we will use inside this script):
-    uint16_t numGnb = 2;
     uint16_t numUePerGnb = 3;
     uint32_t totalUesVid = 2;    // Total voice UEs
     uint32_t totalUesBrowse = 3; // Total browsing UEs
 
     int logging = 1;
 
-    // Simulation parameters.
-    Time simTime = MilliSeconds(1000);
-    Time udpAppStartTime = MilliSeconds(10);
+    /*
+     * A restored run starts a new segment: same scenario, next RNG run,
+     * attach again and simulate only what the checkpoint does not cover.
+     * Simulated time of the segment maps to run time through checkpointOffset.
+     */
+    std::stringstream parameters;
+    parameters << "direction=" << direction << ";mode=" << mode
+               << ";udpPacketSizeBrowsing=" << udpPacketSizeBrowsing
+               << ";udpPacketSizeVideo=" << udpPacketSizeVideo
+               << ";lambdaBrowsing=" << lambdaBrowsing << ";lambdaVideo=" << lambdaVideo
+               << ";power=" << totalTxPower << ";numGnb=" << numGnb
+               << ";simTime=" << simTime.GetMilliSeconds()
+               << ";udpAppStartTime=" << udpAppStartTime.GetMilliSeconds()
+               << ";remoteHosts=" << numRemoteHosts << ";traffic=" << traffic
+               << ";bwpManager=" << bwpManager << ";mobility=" << mobility
+               << ";ueSpeed=" << ueSpeed << ";handover=" << handover;
+    KpmCheckpoint restored;
+    restored.parameters = parameters.str();
+    Time runTime = simTime;
+    Time checkpointOffset = Seconds(0);
+    steadyState = steadyState || targetPrecision > 0;
+    NS_ABORT_MSG_IF(steadyState && !restoreFrom.empty(),
+                    "Steady-state detection needs the whole run, it cannot resume a checkpoint");
+    // A static channel keeps the fading and the LOS/NLOS state of the setup
+    // positions, which moving UEs leave behind.
+    if (!mobility.empty() && channelUpdatePeriod == 0)
+    {
+        channelUpdatePeriod = mobilityStep;
+    }
+    NS_ABORT_MSG_IF((!mobility.empty() || handover) && !restoreFrom.empty(),
+                    "UE positions and serving cells are not checkpointed, a mobile run cannot "
+                    "resume");
+    if (!restoreFrom.empty())
+    {
+        NS_ABORT_MSG_IF(!restored.Load(restoreFrom), "Can't read checkpoint " << restoreFrom);
+        // Only statistics are checkpointed: a segment can only extend a run with
+        // the same parameters, not reuse its warm-up for another variant.
+        NS_ABORT_MSG_IF(restored.parameters != parameters.str(),
+                        "Checkpoint " << restoreFrom << " was written by a run with parameters "
+                                      << restored.parameters);
+        restored.segment++;
+        RngSeedManager::SetRun(RngSeedManager::GetRun() + restored.segment);
+        runTime = udpAppStartTime + simTime - TimeStep(restored.time);
+        checkpointOffset = TimeStep(restored.time) - udpAppStartTime;
+        NS_LOG_INFO("Resuming " << restoreFrom << " at " << TimeStep(restored.time).As(Time::MS));
+    }
 
     // Two separate BWPs
     // Video stream
@@ -57,6 +305,37 @@ main(int argc, char* argv[])
     uint16_t numerologyBwp2 = 2;
     double centralFrequencyBand2 = 2.82e9;
     double bandwidthBand2 = 50e6;
+    // One BWP per band
+    uint32_t numBwps = 2;
+    uint32_t gnbAntennaRows = 4;
+    uint32_t gnbAntennaColumns = 8;
+    uint32_t ueAntennaRows = 2;
+    uint32_t ueAntennaColumns = 4;
+
+    // The layers are measured on a fresh heap, before anything else is built.
+    KpmMemoryReport memory;
+    if (memoryReport)
+    {
+        memory.MeasureLayers(numBwps,
+                             gnbAntennaRows,
+                             gnbAntennaColumns,
+                             ueAntennaRows,
+                             ueAntennaColumns);
+    }
+
+    // The event pattern is periodic: NR slots of both numerologies and the
+    // UDP sends. The timing wheel is sized from these periods.
+    Time slotPeriodBwp1 = NanoSeconds(1000000 >> numerologyBwp1);
+    Time slotPeriodBwp2 = NanoSeconds(1000000 >> numerologyBwp2);
+    Time intervalBrowsing = Seconds(1.0 / lambdaBrowsing);
+    Time intervalVideo = Seconds(1.0 / lambdaVideo);
+    Time minEventPeriod =
+        std::min({slotPeriodBwp1, slotPeriodBwp2, intervalBrowsing, intervalVideo});
+    Time maxEventPeriod =
+        std::max({slotPeriodBwp1, slotPeriodBwp2, intervalBrowsing, intervalVideo});
+    ObjectFactory schedulerFactory = KpmSchedulerFactory(scheduler, minEventPeriod, maxEventPeriod);
+    Simulator::SetScheduler(nodeLoad ? KpmNodeLoadScheduler::Wrap(schedulerFactory)
+                                     : schedulerFactory);
 
     // Where we will store the output files.
     std::string simTag = "default_" + direction + "_" + mode + "_" + std::to_string(totalTxPower);
@@ -171,8 +450,10 @@ main(int argc, char* argv[])
      * Attributes of ThreeGppChannelModel still cannot be set in our way.
      * TODO: Coordinate with Tommaso
      */
-    Config::SetDefault("ns3::ThreeGppChannelModel::UpdatePeriod", TimeValue(MilliSeconds(0)));
-    nrHelper->SetChannelConditionModelAttribute("UpdatePeriod", TimeValue(MilliSeconds(0)));
+    Config::SetDefault("ns3::ThreeGppChannelModel::UpdatePeriod",
+                       TimeValue(MilliSeconds(channelUpdatePeriod)));
+    nrHelper->SetChannelConditionModelAttribute("UpdatePeriod",
+                                                TimeValue(MilliSeconds(channelUpdatePeriod)));
     nrHelper->SetPathlossAttribute("ShadowingEnabled", BooleanValue(false));
 
     nrHelper->InitializeOperationBand(&band1);
@@ -205,26 +486,54 @@ main(int argc, char* argv[])
      *
      */
 
-    Packet::EnableChecking();
-    Packet::EnablePrinting();
+    // Packet metadata is per packet in flight; lean tracing does without it.
+    if (!leanTracing)
+    {
+        Packet::EnableChecking();
+        Packet::EnablePrinting();
+    }
 
     /*
      *  Case (i): Attributes valid for all the nodes
      */
-    idealBeamformingHelper->SetAttribute("BeamformingMethod",
-                                         TypeIdValue(DirectPathBeamforming::GetTypeId()));
+    idealBeamformingHelper->SetAttribute(
+        "BeamformingMethod",
+        TypeIdValue(kpmArrayGain ? KpmDirectPathBeamforming::GetTypeId()
+                                 : DirectPathBeamforming::GetTypeId()));
+    // Mobile UEs get new beams when they move (KpmUeMobility), not all of
+    // them every beamforming period.
+    if (!mobility.empty())
+    {
+        idealBeamformingHelper->SetAttribute("BeamformingPeriodicity",
+                                             TimeValue(MilliSeconds(0)));
+    }
     nrEpcHelper->SetAttribute("S1uLinkDelay", TimeValue(MilliSeconds(0)));
-    nrHelper->SetUeAntennaAttribute("NumRows", UintegerValue(2));
-    nrHelper->SetUeAntennaAttribute("NumColumns", UintegerValue(4));
+    nrHelper->SetUeAntennaAttribute("NumRows", UintegerValue(ueAntennaRows));
+    nrHelper->SetUeAntennaAttribute("NumColumns", UintegerValue(ueAntennaColumns));
     nrHelper->SetUeAntennaAttribute("AntennaElement",
                                     PointerValue(CreateObject<IsotropicAntennaModel>()));
-    nrHelper->SetGnbAntennaAttribute("NumRows", UintegerValue(4));
-    nrHelper->SetGnbAntennaAttribute("NumColumns", UintegerValue(8));
+    nrHelper->SetGnbAntennaAttribute("NumRows", UintegerValue(gnbAntennaRows));
+    nrHelper->SetGnbAntennaAttribute("NumColumns", UintegerValue(gnbAntennaColumns));
     nrHelper->SetGnbAntennaAttribute("AntennaElement",
                                      PointerValue(CreateObject<IsotropicAntennaModel>()));
     uint32_t bwpIdForBrowsing = 0;
     uint32_t bwpIdForCall = 1;
 
+    // The load-aware manager keeps the static mapping as the home BWP of
+    // each QoS class; it must be the algorithm type before its attributes.
+    Ptr<KpmBwpLoad> bwpLoad;
+    if (bwpManager == "load")
+    {
+        bwpLoad = CreateObject<KpmBwpLoad>();
+        bwpLoad->SetThresholds(bwpLowLoad, bwpHighLoad, bwpLatencySlots);
+        nrHelper->SetGnbBwpManagerAlgorithmTypeId(KpmLoadBwpManagerAlgorithm::GetTypeId());
+        nrHelper->SetGnbBwpManagerAlgorithmAttribute("Load", PointerValue(bwpLoad));
+    }
+    else
+    {
+        NS_ABORT_MSG_IF(bwpManager != "static", "Invalid BWP manager: " << bwpManager);
+    }
+
     nrHelper->SetGnbBwpManagerAlgorithmAttribute("NGBR_LOW_LAT_EMBB",
                                                  UintegerValue(bwpIdForBrowsing));
     nrHelper->SetGnbBwpManagerAlgorithmAttribute("GBR_NON_CONV_VIDEO", UintegerValue(bwpIdForCall));
@@ -233,20 +542,6 @@ main(int argc, char* argv[])
                                                 UintegerValue(bwpIdForBrowsing));
     nrHelper->SetUeBwpManagerAlgorithmAttribute("GBR_NON_CONV_VIDEO", UintegerValue(bwpIdForCall));
 
-    for (uint32_t i = 0; i < ueVideoContainer.GetN(); ++i)
-    {
-        Ptr<Node> ue = ueVideoContainer.Get(i);
-        nrHelper->SetUeBwpManagerAlgorithmAttribute("GBR_NON_CONV_VIDEO",
-                                                    UintegerValue(bwpIdForCall));
-    }
-
-    for (uint32_t i = 0; i < ueBrowsingWebContainer.GetN(); ++i)
-    {
-        Ptr<Node> ue = ueBrowsingWebContainer.Get(i);
-        nrHelper->SetUeBwpManagerAlgorithmAttribute("NGBR_LOW_LAT_EMBB",
-                                                    UintegerValue(bwpIdForBrowsing));
-    }
-
     /*
      * Case (ii): Attributes valid for a subset of the nodes
      */
@@ -258,11 +553,29 @@ main(int argc, char* argv[])
      * to the NetDevices, which contains all the NR stack:
      */
 
-    NetDeviceContainer gnbNetDev =
-        nrHelper->InstallGnbDevice(gridScenario.GetBaseStations(), allBwps);
+    memory.Begin("gNB", gridScenario.GetBaseStations().GetN());
+    NetDeviceContainer gnbNetDev;
+    if (bwpLoad)
+    {
+        // One by one, to tell each gNB's BWP manager its index in bwpLoad.
+        for (uint32_t i = 0; i < gridScenario.GetBaseStations().GetN(); ++i)
+        {
+            nrHelper->SetGnbBwpManagerAlgorithmAttribute("Gnb", UintegerValue(i));
+            gnbNetDev.Add(
+                nrHelper->InstallGnbDevice(NodeContainer(gridScenario.GetBaseStations().Get(i)),
+                                           allBwps));
+        }
+    }
+    else
+    {
+        gnbNetDev = nrHelper->InstallGnbDevice(gridScenario.GetBaseStations(), allBwps);
+    }
+    memory.End();
+    memory.Begin("UE", gridScenario.GetUserTerminals().GetN());
     NetDeviceContainer ueBrowsingWebNetDev =
         nrHelper->InstallUeDevice(ueBrowsingWebContainer, allBwps);
     NetDeviceContainer ueVideoStreamNetDev = nrHelper->InstallUeDevice(ueVideoContainer, allBwps);
+    memory.End();
 
     randomStream += nrHelper->AssignStreams(gnbNetDev, randomStream);
     randomStream += nrHelper->AssignStreams(ueBrowsingWebNetDev, randomStream);
@@ -298,10 +611,13 @@ main(int argc, char* argv[])
     nrHelper->UpdateDeviceConfigs(ueVideoStreamNetDev);
 
     Ptr<Node> pgw = nrEpcHelper->GetPgwNode();
-    // Create a remote host to simulate an external network (internet)
+    // Create the remote hosts to simulate an external network (internet).
+    // The EPC helper has a single PGW; with several remote hosts each gets
+    // its own link to it, so the flows do not all queue on one host and link.
+    NS_ABORT_MSG_IF(numRemoteHosts == 0 || numRemoteHosts > 255,
+                    "Invalid number of remote hosts: " << numRemoteHosts);
     NodeContainer remoteHostContainer;
-    remoteHostContainer.Create(1);
-    Ptr<Node> remoteHost = remoteHostContainer.Get(0);
+    remoteHostContainer.Create(numRemoteHosts);
     InternetStackHelper internet;
     internet.Install(remoteHostContainer);
     PointToPointHelper p2ph;
@@ -310,20 +626,34 @@ main(int argc, char* argv[])
         DataRateValue(DataRate("100Gb/s"))); // High data rate between PGW and remote host
     p2ph.SetDeviceAttribute("Mtu", UintegerValue(2500)); // Maximum Transmission Unit (MTU) set
     p2ph.SetChannelAttribute("Delay", TimeValue(Seconds(0.000))); // Minimal delay
-    NetDeviceContainer internetDevices = p2ph.Install(pgw, remoteHost);
-
-    // Set up IPv4 address for the internet devices and configure routing
     Ipv4AddressHelper ipv4h;
     Ipv4StaticRoutingHelper ipv4RoutingHelper;
-    ipv4h.SetBase("8.0.0.0", "255.0.0.0"); // IP address range for the internet connection
-    Ipv4InterfaceContainer internetIpIfaces = ipv4h.Assign(internetDevices);
-
-    // Configure routing for the remote host, simulating a route to the mobile UE's network
-    Ptr<Ipv4StaticRouting> remoteHostStaticRouting =
-        ipv4RoutingHelper.GetStaticRouting(remoteHost->GetObject<Ipv4>());
-    remoteHostStaticRouting->AddNetworkRouteTo(Ipv4Address("7.0.0.0"),
-                                               Ipv4Mask("255.0.0.0"),
-                                               1);
+    std::vector<Ipv4Address> remoteHostAddresses;
+    for (uint32_t k = 0; k < numRemoteHosts; ++k)
+    {
+        Ptr<Node> remoteHost = remoteHostContainer.Get(k);
+        NetDeviceContainer internetDevices = p2ph.Install(pgw, remoteHost);
+
+        // Set up IPv4 address for the internet devices and configure routing.
+        // One 8.k.0.0/16 per link, disjoint from the others.
+        ipv4h.SetBase(Ipv4Address(0x08000000 | (k << 16)), "255.255.0.0");
+        remoteHostAddresses.push_back(ipv4h.Assign(internetDevices).GetAddress(1));
+
+        // Configure routing for the remote host, simulating a route to the mobile UE's network
+        Ptr<Ipv4StaticRouting> remoteHostStaticRouting =
+            ipv4RoutingHelper.GetStaticRouting(remoteHost->GetObject<Ipv4>());
+        remoteHostStaticRouting->AddNetworkRouteTo(Ipv4Address("7.0.0.0"),
+                                                   Ipv4Mask("255.0.0.0"),
+                                                   1);
+    }
+    // A flow (UE address and port) always goes through the same remote host.
+    auto remoteHostFor = [numRemoteHosts](Ipv4Address ue, uint16_t port) {
+        uint8_t key[6];
+        ue.Serialize(key);
+        key[4] = port >> 8;
+        key[5] = port & 0xff;
+        return Hash32(reinterpret_cast<const char*>(key), sizeof(key)) % numRemoteHosts;
+    };
     internet.Install(gridScenario.GetUserTerminals());
     Ipv4InterfaceContainer ueLowLatIpIface =
         nrEpcHelper->AssignUeIpv4Address(NetDeviceContainer(ueBrowsingWebNetDev));
@@ -349,8 +679,14 @@ main(int argc, char* argv[])
         ueStaticRouting->SetDefaultRoute(nrEpcHelper->GetUeDefaultGatewayAddress(), 1);
     }
 
+    if (handover)
+    {
+        nrHelper->AddX2Interface(gridScenario.GetBaseStations());
+    }
+
     uint32_t callIndex = 0;
     uint32_t browseIndex = 0;
+    std::vector<std::vector<Ptr<NetDevice>>> attachedUes(gnbNetDev.GetN());
 
     for (uint32_t i = 0; i < gnbNetDev.GetN(); i++)
     {
@@ -375,18 +711,31 @@ main(int argc, char* argv[])
             }
 
             nrHelper->AttachToGnb(ueDev, bs);
+            attachedUes[i].push_back(ueDev);
         }
     }
 
     uint16_t dlPortBrowsing = 1234;
     uint16_t dlPortViedoCall = 1235;
+    uint16_t ulPortBrowsing = 1236;
+    uint16_t ulPortVideoCall = 1237;
 
     ApplicationContainer serverApps;
 
-    UdpServerHelper dlPacketSinkBrowsing(dlPortBrowsing);
-    UdpServerHelper dlPacketSinkVoiceCall(dlPortViedoCall);
-    serverApps.Add(dlPacketSinkBrowsing.Install(ueBrowsingWebContainer));
-    serverApps.Add(dlPacketSinkVoiceCall.Install(ueVideoContainer));
+    if (dlTraffic)
+    {
+        UdpServerHelper dlPacketSinkBrowsing(dlPortBrowsing);
+        UdpServerHelper dlPacketSinkVoiceCall(dlPortViedoCall);
+        serverApps.Add(dlPacketSinkBrowsing.Install(ueBrowsingWebContainer));
+        serverApps.Add(dlPacketSinkVoiceCall.Install(ueVideoContainer));
+    }
+    if (ulTraffic)
+    {
+        UdpServerHelper ulPacketSinkBrowsing(ulPortBrowsing);
+        UdpServerHelper ulPacketSinkVoiceCall(ulPortVideoCall);
+        serverApps.Add(ulPacketSinkBrowsing.Install(remoteHostContainer));
+        serverApps.Add(ulPacketSinkVoiceCall.Install(remoteHostContainer));
+    }
     UdpClientHelper dlClientBrowsing;
     dlClientBrowsing.SetAttribute("RemotePort", UintegerValue(dlPortBrowsing));
     dlClientBrowsing.SetAttribute("MaxPackets", UintegerValue(0xFFFFFFFF));
@@ -398,6 +747,19 @@ main(int argc, char* argv[])
     dlpfLowLat.localPortStart = dlPortBrowsing;
     dlpfLowLat.localPortEnd = dlPortBrowsing;
     tftBrowsing->Add(dlpfLowLat);
+    UdpClientHelper ulClientBrowsing;
+    ulClientBrowsing.SetAttribute("RemotePort", UintegerValue(ulPortBrowsing));
+    ulClientBrowsing.SetAttribute("MaxPackets", UintegerValue(0xFFFFFFFF));
+    ulClientBrowsing.SetAttribute("PacketSize", UintegerValue(udpPacketSizeBrowsing));
+    ulClientBrowsing.SetAttribute("Interval", TimeValue(Seconds(1.0 / lambdaBrowsing)));
+    NrEpcTft::PacketFilter ulpfLowLat;
+    ulpfLowLat.remotePortStart = ulPortBrowsing;
+    ulpfLowLat.remotePortEnd = ulPortBrowsing;
+    ulpfLowLat.direction = NrEpcTft::UPLINK;
+    if (ulTraffic)
+    {
+        tftBrowsing->Add(ulpfLowLat);
+    }
     UdpClientHelper dlClientVoice;
     dlClientVoice.SetAttribute("RemotePort", UintegerValue(dlPortViedoCall));
     dlClientVoice.SetAttribute("MaxPackets", UintegerValue(0xFFFFFFFF));
@@ -411,6 +773,19 @@ main(int argc, char* argv[])
     dlpfViedo.localPortStart = dlPortViedoCall;
     dlpfViedo.localPortEnd = dlPortViedoCall;
     tftVideo->Add(dlpfViedo);
+    UdpClientHelper ulClientVoice;
+    ulClientVoice.SetAttribute("RemotePort", UintegerValue(ulPortVideoCall));
+    ulClientVoice.SetAttribute("MaxPackets", UintegerValue(0xFFFFFFFF));
+    ulClientVoice.SetAttribute("PacketSize", UintegerValue(udpPacketSizeVideo));
+    ulClientVoice.SetAttribute("Interval", TimeValue(Seconds(1.0 / lambdaVideo)));
+    NrEpcTft::PacketFilter ulpfVideo;
+    ulpfVideo.remotePortStart = ulPortVideoCall;
+    ulpfVideo.remotePortEnd = ulPortVideoCall;
+    ulpfVideo.direction = NrEpcTft::UPLINK;
+    if (ulTraffic)
+    {
+        tftVideo->Add(ulpfVideo);
+    }
 
     ApplicationContainer clientApps;
 
@@ -419,8 +794,19 @@ main(int argc, char* argv[])
         Ptr<Node> ue = ueBrowsingWebContainer.Get(i);
         Ptr<NetDevice> ueDevice = ueBrowsingWebNetDev.Get(i);
         Address ueAddress = ueLowLatIpIface.GetAddress(i);
-        dlClientBrowsing.SetAttribute("RemoteAddress", AddressValue(ueAddress));
-        clientApps.Add(dlClientBrowsing.Install(remoteHost));
+        if (dlTraffic)
+        {
+            dlClientBrowsing.SetAttribute("RemoteAddress", AddressValue(ueAddress));
+            clientApps.Add(dlClientBrowsing.Install(remoteHostContainer.Get(
+                remoteHostFor(ueLowLatIpIface.GetAddress(i), dlPortBrowsing))));
+        }
+        if (ulTraffic)
+        {
+            uint32_t host = remoteHostFor(ueLowLatIpIface.GetAddress(i), ulPortBrowsing);
+            ulClientBrowsing.SetAttribute("RemoteAddress",
+                                          AddressValue(remoteHostAddresses[host]));
+            clientApps.Add(ulClientBrowsing.Install(ue));
+        }
         nrHelper->ActivateDedicatedEpsBearer(ueDevice, bearerBrowsing, tftBrowsing);
     }
 
@@ -429,20 +815,143 @@ main(int argc, char* argv[])
         Ptr<Node> ue = ueVideoContainer.Get(i);
         Ptr<NetDevice> ueDevice = ueVideoStreamNetDev.Get(i);
         Address ueAddress = ueVideoIpIface.GetAddress(i);
-        dlClientVoice.SetAttribute("RemoteAddress", AddressValue(ueAddress));
-        clientApps.Add(dlClientVoice.Install(remoteHost));
+        if (dlTraffic)
+        {
+            dlClientVoice.SetAttribute("RemoteAddress", AddressValue(ueAddress));
+            clientApps.Add(dlClientVoice.Install(remoteHostContainer.Get(
+                remoteHostFor(ueVideoIpIface.GetAddress(i), dlPortViedoCall))));
+        }
+        if (ulTraffic)
+        {
+            uint32_t host = remoteHostFor(ueVideoIpIface.GetAddress(i), ulPortVideoCall);
+            ulClientVoice.SetAttribute("RemoteAddress", AddressValue(remoteHostAddresses[host]));
+            clientApps.Add(ulClientVoice.Install(ue));
+        }
         nrHelper->ActivateDedicatedEpsBearer(ueDevice, bearerViedo, tftVideo);
     }
 
     serverApps.Start(udpAppStartTime);
     clientApps.Start(udpAppStartTime);
-    serverApps.Stop(simTime);
-    clientApps.Stop(simTime);
 
-    nrHelper->EnableTraces();
+    // The beams of the UEs that move or change cell are recomputed outside
+    // the beamforming helper, with the same method.
+    Ptr<IdealBeamformingAlgorithm> beamformingMethod;
+    if (!mobility.empty() || handover)
+    {
+        ObjectFactory beamforming;
+        beamforming.SetTypeId(kpmArrayGain ? KpmDirectPathBeamforming::GetTypeId()
+                                           : DirectPathBeamforming::GetTypeId());
+        beamformingMethod = beamforming.Create<IdealBeamformingAlgorithm>();
+    }
 
+    if (bwpLoad)
+    {
+        bwpLoad->Install(gnbNetDev, udpAppStartTime, MilliSeconds(bwpLoadPeriod));
+    }
+
+    KpmUeMobility ueMobility;
+    KpmHandover a3Handover;
+    if (!mobility.empty())
+    {
+        KpmUeMobility::Model model;
+        NS_ABORT_MSG_IF(!KpmUeMobility::ParseModel(mobility, model),
+                        "Invalid UE mobility: " << mobility);
+        ueMobility.SetModel(model,
+                            ueSpeed,
+                            Rectangle(xMin, xMax, yMin, yMax),
+                            MilliSeconds(mobilityStep));
+        ueMobility.SetUpdateDistance(beamUpdateDistance);
+        ueMobility.SetBeamformingMethod(beamformingMethod);
+        randomStream += ueMobility.AssignStreams(randomStream);
+        ueMobility.Install(NetDeviceContainer(ueBrowsingWebNetDev, ueVideoStreamNetDev),
+                           udpAppStartTime);
+    }
+    if (handover)
+    {
+        a3Handover.SetA3(a3Hysteresis, MilliSeconds(a3TimeToTrigger));
+        a3Handover.SetNeighbours(neighbourRadius, maxNeighbours);
+        a3Handover.SetBeamformingMethod(beamformingMethod);
+        a3Handover.Install(nrHelper,
+                           gnbNetDev,
+                           NetDeviceContainer(ueBrowsingWebNetDev, ueVideoStreamNetDev),
+                           udpAppStartTime,
+                           MilliSeconds(measurementPeriod));
+        if (!mobility.empty())
+        {
+            ueMobility.SetMovedCallback(MakeCallback(&KpmHandover::Moved, &a3Handover));
+            a3Handover.SetHandoverCallback(
+                MakeCallback(&KpmUeMobility::SetServingGnb, &ueMobility));
+        }
+    }
+    // The capacity search runs its probes until it converges.
+    if (capacitySearch.empty())
+    {
+        serverApps.Stop(runTime);
+        clientApps.Stop(runTime);
+    }
+
+    // With a trace sink the PHY RX traces go to the shared, run-tagged stream
+    // instead of per-run text files. The per-layer text traces buffer per
+    // device; lean tracing skips them.
+    KpmTraceSink traceSink;
+    KpmTraceSink::Producer* simulationTrace = nullptr;
+    KpmRxPacketTrace rxPacketTrace;
+    if (!traceSinkFile.empty())
+    {
+        // simTag only holds direction, mode and power: the hash of the full
+        // parameter set tells apart the runs of a sweep over anything else.
+        std::string parameterSet = parameters.str();
+        char parameterHash[9];
+        std::snprintf(parameterHash,
+                      sizeof(parameterHash),
+                      "%08x",
+                      Hash32(parameterSet.data(), parameterSet.size()));
+        std::string runTag = simTag + "/" + parameterHash + "/run" +
+                             std::to_string(RngSeedManager::GetRun());
+        NS_ABORT_MSG_IF(!traceSink.Open(traceSinkFile, runTag, parameterSet),
+                        "Can't open trace sink " << traceSinkFile);
+        simulationTrace = traceSink.AddProducer();
+        rxPacketTrace.Install(simulationTrace,
+                              gnbNetDev,
+                              NetDeviceContainer(ueBrowsingWebNetDev, ueVideoStreamNetDev));
+    }
+    else if (!leanTracing && kpmInterval == 0)
+    {
+        nrHelper->EnableTraces();
+    }
+
+    // Uplink KPMs per UE, for the runs with uplink traffic.
+    KpmUplinkKpms uplinkKpms;
+    if (ulTraffic)
+    {
+        uplinkKpms.Install(gnbNetDev,
+                           NetDeviceContainer(ueBrowsingWebNetDev, ueVideoStreamNetDev),
+                           udpAppStartTime);
+    }
+
+    KpmOnlineKpms onlineKpms;
+    std::ofstream kpmFile;
+    if (kpmInterval > 0)
+    {
+        std::string kpmFilename = outputDir + "/" + simTag + "-kpms";
+        kpmFile.open(kpmFilename.c_str(), std::ofstream::out | std::ofstream::trunc);
+        NS_ABORT_MSG_IF(!kpmFile.is_open(), "Can't open file " << kpmFilename);
+        onlineKpms.Install(NetDeviceContainer(ueBrowsingWebNetDev, ueVideoStreamNetDev),
+                           udpAppStartTime,
+                           MilliSeconds(kpmInterval),
+                           kpmFile);
+    }
+
+    // Compact mode only probes the flow endpoints instead of every node.
     FlowMonitorHelper flowmonHelper;
-    flowmonHelper.InstallAll();
+    if (leanTracing)
+    {
+        flowmonHelper.Install(remoteHostContainer);
+    }
+    else
+    {
+        flowmonHelper.InstallAll();
+    }
     NodeContainer endpointNodes;
     endpointNodes.Add(gridScenario.GetUserTerminals());
 
@@ -451,246 +960,565 @@ main(int argc, char* argv[])
     monitor->SetAttribute("JitterBinWidth", DoubleValue(0.001));
     monitor->SetAttribute("PacketSizeBinWidth", DoubleValue(20));
 
-    Ptr<NrRadioEnvironmentMapHelper> remHelper = CreateObject<NrRadioEnvironmentMapHelper>();
-    remHelper->SetMinX(xMin);
-    remHelper->SetMaxX(xMax);
-    remHelper->SetResX(xRes);
-    remHelper->SetMinY(yMin);
-    remHelper->SetMaxY(yMax);
-    remHelper->SetResY(yRes);
-    remHelper->SetZ(z);
-    std::string remSimTag = direction + "_" + mode;
-    remHelper->SetSimTag(remSimTag);
+    KpmRemHelper kpmRemHelper;
+    kpmRemHelper.SetMinX(xMin);
+    kpmRemHelper.SetMaxX(xMax);
+    kpmRemHelper.SetResX(xRes);
+    kpmRemHelper.SetMinY(yMin);
+    kpmRemHelper.SetMaxY(yMax);
+    kpmRemHelper.SetResY(yRes);
+    kpmRemHelper.SetZ(z);
+    kpmRemHelper.SetMaxZ(remZMax);
+    kpmRemHelper.SetResZ(remZRes);
+    kpmRemHelper.SetPng(remPlot == "png");
+
+    std::vector<uint16_t> remBwpIds;
+    if (remBwps == "all")
+    {
+        for (uint32_t bwpId = 0; bwpId < numBwps; ++bwpId)
+        {
+            remBwpIds.push_back(bwpId);
+        }
+    }
+    else
+    {
+        std::stringstream bwpList(remBwps);
+        std::string bwpId;
+        while (std::getline(bwpList, bwpId, ','))
+        {
+            remBwpIds.push_back(std::stoul(bwpId));
+        }
+    }
 
-    uint16_t remBwpId = 0;
+    // With measured load the REMs wait for the traffic run, which gives the
+    // PRB utilization that scales each gNB's interference.
+    auto createRems = [&]() {
+        for (uint32_t i = 0; i < gnbNetDev.GetN(); i++)
+        {
+            Ptr<NetDevice> bs = gnbNetDev.Get(i); // Get the base station device
 
-    for (uint32_t i = 0; i < gnbNetDev.GetN(); i++)
-    {
-        Ptr<NetDevice> bs = gnbNetDev.Get(i); // Get the base station device
+            // Identify the first UE attached to the base station
+            Ptr<NetDevice> firstUeNetNode;
+            bool ueAssigned = false;
 
-        // Identify the first UE attached to the base station
-        Ptr<NetDevice> firstUeNetNode;
-        bool ueAssigned = false;
+            // Loop through the UEs attached to the base station
+            for (uint32_t j = 0; j < numUePerGnb; j++)
+            {
+                Ptr<NetDevice> ueDev;
+                if (j % 2 == 0 && callIndex > 0)
+                { // Check if voice UE is available
+                    ueDev = ueVideoStreamNetDev.Get(callIndex - 1); // First voice UE
+                    firstUeNetNode = ueDev;
+                    ueAssigned = true;
+                    break; // We found the first UE, break the loop
+                }
+                else if (browseIndex > 0)
+                { // Check if browsing UE is available
+                    ueDev = ueBrowsingWebNetDev.Get(browseIndex - 1); // First browsing UE
+                    firstUeNetNode = ueDev;
+                    ueAssigned = true;
+                    break; // We found the first UE, break the loop
+                }
+            }
 
-        // Loop through the UEs attached to the base station
-        for (uint32_t j = 0; j < numUePerGnb; j++)
-        {
-            Ptr<NetDevice> ueDev;
-            if (j % 2 == 0 && callIndex > 0)
-            {                                                   // Check if voice UE is available
-                ueDev = ueVideoStreamNetDev.Get(callIndex - 1); // First voice UE
-                firstUeNetNode = ueDev;
-                ueAssigned = true;
-                break; // We found the first UE, break the loop
+            // If a UE was assigned, set beamforming vector for that UE
+            if (ueAssigned)
+            {
+                for (uint16_t remBwpId : remBwpIds)
+                {
+                    gnbNetDev.Get(i)
+                        ->GetObject<NrGnbNetDevice>()
+                        ->GetPhy(remBwpId)
+                        ->GetSpectrumPhy()
+                        ->GetBeamManager()
+                        ->ChangeBeamformingVector(firstUeNetNode);
+                }
+                NS_LOG_INFO("Setting beamforming for UE with ID "
+                            << firstUeNetNode->GetNode()->GetId() << " attached to BS with ID "
+                            << bs->GetNode()->GetId());
             }
-            else if (browseIndex > 0)
-            { // Check if browsing UE is available
-                ueDev = ueBrowsingWebNetDev.Get(browseIndex - 1); // First browsing UE
-                firstUeNetNode = ueDev;
-                ueAssigned = true;
-                break; // We found the first UE, break the loop
+            else
+            {
+                NS_LOG_INFO("Beamforming for UE with ID " << firstUeNetNode->GetNode()->GetId()
+                                                          << " not set (not attached to a bs)");
             }
         }
 
-        // If a UE was assigned, set beamforming vector for that UE
-        if (ueAssigned)
+        /*
+         * The REMs to compute: direction, mode, transmitting devices and a device
+         * configured like the receiver placed at each grid point. ALL selects
+         * every direction or mode.
+         */
+        struct RemJob
         {
-            gnbNetDev.Get(i)
-                ->GetObject<NrGnbNetDevice>()
-                ->GetPhy(remBwpId)
-                ->GetSpectrumPhy()
-                ->GetBeamManager()
-                ->ChangeBeamformingVector(firstUeNetNode);
-            NS_LOG_INFO("Setting beamforming for UE with ID " << firstUeNetNode->GetNode()->GetId()
-                                                              << " attached to BS with ID "
-                                                              << bs->GetNode()->GetId());
-        }
-        else
+            std::string direction;
+            NrRadioEnvironmentMapHelper::RemMode remMode;
+            const NetDeviceContainer* rtdNetDev;
+            Ptr<NetDevice> rrdDevice;
+        };
+
+        const RemJob remJobs[] = {
+            {"DL", NrRadioEnvironmentMapHelper::BEAM_SHAPE, &gnbNetDev, ueVideoStreamNetDev.Get(0)},
+            {"DL",
+             NrRadioEnvironmentMapHelper::COVERAGE_AREA,
+             &gnbNetDev,
+             ueVideoStreamNetDev.Get(0)},
+            {"DL",
+             NrRadioEnvironmentMapHelper::UE_COVERAGE,
+             &gnbNetDev,
+             ueBrowsingWebNetDev.Get(0)},
+            {"UL", NrRadioEnvironmentMapHelper::BEAM_SHAPE, &ueVideoStreamNetDev, gnbNetDev.Get(0)},
+            {"UL",
+             NrRadioEnvironmentMapHelper::COVERAGE_AREA,
+             &ueVideoStreamNetDev,
+             gnbNetDev.Get(0)},
+            {"UL",
+             NrRadioEnvironmentMapHelper::UE_COVERAGE,
+             &ueBrowsingWebNetDev,
+             gnbNetDev.Get(0)},
+        };
+
+        std::vector<RemJob> selectedRemJobs;
+        for (const auto& job : remJobs)
         {
-            NS_LOG_INFO("Beamforming for UE with ID " << firstUeNetNode->GetNode()->GetId()
-                                                      << " not set (not attached to a bs)");
+            if ((direction == "ALL" || direction == job.direction) &&
+                (mode == "ALL" || mode == KpmRemHelper::GetModeName(job.remMode)))
+            {
+                selectedRemJobs.push_back(job);
+            }
         }
-    }
-
-    if (direction == "DL")
-    {
-        if (mode == "BEAM_SHAPE")
+        if (selectedRemJobs.empty())
         {
-            remHelper->SetRemMode(NrRadioEnvironmentMapHelper::BEAM_SHAPE);
-            remHelper->CreateRem(gnbNetDev, ueVideoStreamNetDev.Get(0), remBwpId); // DlRem
+            NS_LOG_ERROR("Invalid direction or mode for REM: " << direction << " " << mode);
         }
-        else if (mode == "COVERAGE_AREA")
+
+        if (kpmArrayGain)
         {
-            remHelper->SetRemMode(NrRadioEnvironmentMapHelper::COVERAGE_AREA);
-            remHelper->CreateRem(gnbNetDev, ueVideoStreamNetDev.Get(0), remBwpId); // DlRem
+            // The modes of a direction that share the transmitters are computed
+            // from one sweep. The receiver only contributes its antenna and noise
+            // figure, which all UEs share, so the first job's is used.
+            for (std::size_t i = 0; i < selectedRemJobs.size();)
+            {
+                const RemJob& first = selectedRemJobs[i];
+                std::vector<NrRadioEnvironmentMapHelper::RemMode> remModes;
+                for (; i < selectedRemJobs.size() &&
+                       selectedRemJobs[i].direction == first.direction &&
+                       selectedRemJobs[i].rtdNetDev == first.rtdNetDev;
+                     ++i)
+                {
+                    remModes.push_back(selectedRemJobs[i].remMode);
+                }
+                kpmRemHelper.SetSimTag(first.direction);
+                kpmRemHelper.CreateRems(*first.rtdNetDev, first.rrdDevice, remBwpIds, remModes);
+                NS_LOG_INFO("REM " << first.direction << ": " << remModes.size() << " modes, "
+                                   << kpmRemHelper.GetLastNumPoints() << " points in "
+                                   << kpmRemHelper.GetLastElapsed() << " s");
+            }
         }
-        else if (mode == "UE_COVERAGE")
+        else
         {
-            remHelper->SetRemMode(NrRadioEnvironmentMapHelper::UE_COVERAGE);
-            remHelper->CreateRem(gnbNetDev, ueBrowsingWebNetDev.Get(0), remBwpId); // DlRem
+            // The nr helper maps one mode and one BWP per call, at one height.
+            NS_ABORT_MSG_IF(remZRes > 0, "The volumetric REM needs --kpmArrayGain");
+            std::list<std::vector<std::vector<double>>> remColumns;
+            std::vector<KpmRemPlot> remPlots;
+            for (const auto& job : selectedRemJobs)
+            {
+                std::string remSimTag =
+                    job.direction + "_" + KpmRemHelper::GetModeName(job.remMode);
+                for (uint16_t remBwpId : remBwpIds)
+                {
+                    Ptr<NrRadioEnvironmentMapHelper> remHelper =
+                        CreateObject<NrRadioEnvironmentMapHelper>();
+                    remHelper->SetMinX(xMin);
+                    remHelper->SetMaxX(xMax);
+                    remHelper->SetResX(xRes);
+                    remHelper->SetMinY(yMin);
+                    remHelper->SetMaxY(yMax);
+                    remHelper->SetResY(yRes);
+                    remHelper->SetZ(z);
+                    std::string remBwpSimTag =
+                        remBwpIds.size() > 1 ? remSimTag + "_bwp" + std::to_string(remBwpId)
+                                             : remSimTag;
+                    remHelper->SetSimTag(remBwpSimTag);
+                    remHelper->SetRemMode(job.remMode);
+                    remHelper->CreateRem(*job.rtdNetDev, job.rrdDevice, remBwpId);
+                    if (remPlot == "png")
+                    {
+                        std::string remFile = "nr-rem-" + remBwpSimTag + ".out";
+                        remColumns.emplace_back();
+                        NS_ABORT_MSG_IF(!KpmAddRemFilePlots(remFile, remColumns.back(), remPlots),
+                                        "Can't read REM " << remFile);
+                    }
+                }
+            }
+            NS_ABORT_MSG_IF(!KpmRemRenderer::Render(remPlots), "Can't write the REM plots");
         }
-        else
+
+        if (remBeams != "configured")
         {
-            NS_LOG_ERROR("Invalid mode for DL REM: " << mode);
+            NS_ABORT_MSG_IF(!kpmArrayGain, "The beam-sweep REM needs --kpmArrayGain");
+            std::vector<std::vector<KpmArrayGainEngine::Beam>> candidates;
+            for (uint32_t i = 0; i < gnbNetDev.GetN(); ++i)
+            {
+                if (remBeams == "ues")
+                {
+                    candidates.push_back(KpmRemHelper::GetDirectPathBeams(gnbNetDev.Get(i),
+                                                                          remBwpIds.front(),
+                                                                          attachedUes[i]));
+                }
+                else if (remBeams == "codebook")
+                {
+                    candidates.push_back(KpmRemHelper::GetCodebook(gnbNetDev.Get(i),
+                                                                   remBwpIds.front(),
+                                                                   codebookOversampling));
+                }
+                else
+                {
+                    NS_ABORT_MSG("Invalid beams for REM: " << remBeams);
+                }
+            }
+            kpmRemHelper.SetSimTag("DL_BEAM_SWEEP");
+            kpmRemHelper.CreateBeamSweepRem(gnbNetDev,
+                                            ueVideoStreamNetDev.Get(0),
+                                            remBwpIds,
+                                            candidates);
+            NS_LOG_INFO("REM DL_BEAM_SWEEP: " << kpmRemHelper.GetLastNumPoints() << " points in "
+                                              << kpmRemHelper.GetLastElapsed() << " s");
         }
+    };
+
+    KpmPrbUtilization prbUtilization;
+    if (remLoad == "measured")
+    {
+        NS_ABORT_MSG_IF(!kpmArrayGain, "The load-scaled REM needs --kpmArrayGain");
+        prbUtilization.Install(gnbNetDev);
+        prbUtilization.Start(udpAppStartTime);
     }
-    else if (direction == "UL")
+    else
     {
-        if (mode == "BEAM_SHAPE")
-        {
-            remHelper->SetRemMode(NrRadioEnvironmentMapHelper::BEAM_SHAPE);
-            remHelper->CreateRem(ueVideoStreamNetDev, gnbNetDev.Get(0), remBwpId); // UlRem
-        }
-        else if (mode == "COVERAGE_AREA")
-        {
-            remHelper->SetRemMode(NrRadioEnvironmentMapHelper::COVERAGE_AREA);
-            remHelper->CreateRem(ueVideoStreamNetDev, gnbNetDev.Get(0), remBwpId); // UlRem
-        }
-        else if (mode == "UE_COVERAGE")
-        {
-            remHelper->SetRemMode(NrRadioEnvironmentMapHelper::UE_COVERAGE);
-            remHelper->CreateRem(ueBrowsingWebNetDev, gnbNetDev.Get(0), remBwpId); // UlRem
-        }
-        else
+        NS_ABORT_MSG_IF(remLoad != "full", "Invalid REM load: " << remLoad);
+        createRems();
+    }
+
+    // Attach and dedicated bearer setup happen before the applications start.
+    uint32_t numBearers = ueBrowsingWebNetDev.GetN() + ueVideoStreamNetDev.GetN();
+    memory.Begin("bearer", numBearers);
+    Simulator::Schedule(udpAppStartTime, &KpmMemoryReport::End, &memory);
+
+    std::stringstream checkpointList(checkpointTimes);
+    std::string checkpointTime;
+    while (std::getline(checkpointList, checkpointTime, ','))
+    {
+        Time at = Seconds(std::stod(checkpointTime)) - checkpointOffset;
+        if (at > udpAppStartTime && at < runTime)
         {
-            NS_LOG_ERROR("Invalid mode for UL REM: " << mode);
+            Simulator::Schedule(at,
+                                &KpmSaveCheckpoint,
+                                &restored,
+                                monitor,
+                                DynamicCast<Ipv4FlowClassifier>(flowmonHelper.GetClassifier()),
+                                checkpointOffset,
+                                outputDir + "/" + simTag + ".ckpt");
         }
     }
-    else
+
+    KpmBearerStatsSampler sampler(monitor,
+                                  DynamicCast<Ipv4FlowClassifier>(flowmonHelper.GetClassifier()),
+                                  MilliSeconds(sampleInterval));
+    if (steadyState)
+    {
+        sampler.SetTargetPrecision(targetPrecision);
+        sampler.Start(udpAppStartTime);
+    }
+
+    if (!capacitySearch.empty())
     {
-        NS_LOG_ERROR("Invalid direction for REM: " << direction);
+        NS_ABORT_MSG_IF(steadyState || !restoreFrom.empty() || !checkpointTimes.empty() ||
+                            remLoad == "measured",
+                        "The capacity search measures its own probes, without steady-state "
+                        "detection, checkpoints or a measured REM load");
+        NS_ABORT_MSG_IF(capacitySearch != "video" && capacitySearch != "browsing",
+                        "Invalid bearer for the capacity search: " << capacitySearch);
+        NS_ABORT_MSG_IF(!dlTraffic, "The capacity search probes the downlink traffic");
+        KpmCapacitySearch search(monitor,
+                                 DynamicCast<Ipv4FlowClassifier>(flowmonHelper.GetClassifier()),
+                                 clientApps,
+                                 capacitySearch == "video" ? dlPortViedoCall : dlPortBrowsing);
+        search.SetSla(slaDelay, slaLoss);
+        search.SetBounds(searchLambdaMin, searchLambdaMax);
+        search.SetProbeTimes(MilliSeconds(searchDrainTimeout),
+                             MilliSeconds(50),
+                             MilliSeconds(searchProbe));
+        search.SetStopCriteria(searchTolerance, searchMaxProbes);
+
+        // Attach and bearer setup once, then every probe continues from there.
+        Simulator::Stop(udpAppStartTime);
+        Simulator::Run();
+        double capacity = search.Run();
+
+        std::string filename = outputDir + "/" + simTag + "-capacity-" + capacitySearch;
+        std::ofstream capacityFile(filename.c_str(), std::ofstream::out | std::ofstream::trunc);
+        NS_ABORT_MSG_IF(!capacityFile.is_open(), "Can't open file " << filename);
+        search.Write(capacityFile);
+        capacityFile.close();
+        std::cout << "Capacity of the " << capacitySearch << " bearer: " << capacity
+                  << " packets/s per UE (" << search.GetProbes().size() << " probes, "
+                  << Simulator::Now().As(Time::MS) << " simulated), curve in " << filename
+                  << std::endl;
+        Simulator::Destroy();
+        return EXIT_SUCCESS;
     }
 
-    Simulator::Stop(simTime);
+    Simulator::Stop(runTime);
     NS_LOG_INFO("Starting the simulation ...");
+    benchmark.StartRun();
     Simulator::Run();
+    benchmark.EndRun();
     NS_LOG_INFO("Simulation finished ...");
+    if (bwpLoad)
+    {
+        NS_LOG_INFO("BWP routes moved: " << bwpLoad->GetMoves());
+    }
+    if (handover)
+    {
+        NS_LOG_INFO("Handovers: " << a3Handover.GetRequested() << " requested, "
+                                  << a3Handover.GetCompleted() << " completed, "
+                                  << a3Handover.GetMeasurements() << " RSRP measurements");
+    }
+    if (kpmInterval > 0)
+    {
+        onlineKpms.Finish();
+    }
+
+    if (remLoad == "measured")
+    {
+        for (uint32_t i = 0; i < gnbNetDev.GetN(); ++i)
+        {
+            Ptr<NrGnbNetDevice> gnbDev = gnbNetDev.Get(i)->GetObject<NrGnbNetDevice>();
+            for (uint16_t remBwpId : remBwpIds)
+            {
+                // Each BWP PHY has its own cell ID, the one its trace reports.
+                uint16_t cellId = gnbDev->GetPhy(remBwpId)->GetCellId();
+                double load = prbUtilization.Get(cellId, remBwpId);
+                kpmRemHelper.SetLoad(gnbNetDev.Get(i), remBwpId, load);
+                NS_LOG_INFO("Cell " << cellId << " BWP " << remBwpId << ": PRB utilization "
+                                    << load);
+            }
+        }
+        createRems();
+    }
 
     monitor->CheckForLostPackets();
     Ptr<Ipv4FlowClassifier> classifier =
         DynamicCast<Ipv4FlowClassifier>(flowmonHelper.GetClassifier());
     FlowMonitor::FlowStatsContainer stats = monitor->GetFlowStats();
+    uint32_t unmatchedFlows = KpmCheckpoint::Merge(stats, classifier, restored.flows);
+    if (unmatchedFlows > 0)
+    {
+        NS_LOG_WARN(unmatchedFlows << " checkpointed flows have no flow in this segment, "
+                                   << "their statistics are left out");
+    }
+    double flowDuration = (simTime - udpAppStartTime).GetSeconds();
+    if (steadyState)
+    {
+        stats = sampler.GetSteadyStateStats();
+        flowDuration = (sampler.GetEnd() - sampler.GetWarmupEnd()).GetSeconds();
+        NS_LOG_INFO("Warm-up until " << sampler.GetWarmupEnd().As(Time::MS) << ", statistics until "
+                                     << sampler.GetEnd().As(Time::MS)
+                                     << (sampler.StoppedEarly() ? " (converged)" : ""));
+        for (const auto& bearer : sampler.GetHalfWidths())
+        {
+            NS_LOG_INFO("Port " << bearer.first << ": relative 95% CI half-width of throughput "
+                                << bearer.second.first << ", of delay " << bearer.second.second);
+        }
+    }
 
-    double averageFlowThroughput = 0.0;
-    double averageFlowDelay = 0.0;
-
-    std::ofstream outFile;
+    NS_ABORT_MSG_IF(resultsOutput != "both" && resultsOutput != "file" &&
+                        resultsOutput != "stdout",
+                    "Invalid results output: " << resultsOutput);
     std::string filename = outputDir + "/" + simTag;
-    outFile.open(filename.c_str(), std::ofstream::out | std::ofstream::trunc);
-    if (!outFile.is_open())
+    // The mean flow KPMs are those of the downlink flows, as in a downlink
+    // run; the uplink flows have their own, below.
+    KpmFlowReport report;
+    if (ulTraffic)
     {
-        std::cerr << "Can't open file " << filename << std::endl;
+        report.SetMeanPorts({dlPortBrowsing, dlPortViedoCall});
+    }
+    report.Format(stats, classifier, flowDuration);
+    double meanFlowThroughput = report.GetMeanFlowThroughput();
+    double meanFlowDelay = report.GetMeanFlowDelay();
+    double meanUlThroughput = 0.0;
+    double meanUlDelay = 0.0;
+    if (ulTraffic)
+    {
+        std::ofstream ulKpmFile(filename + "-ul-kpms", std::ofstream::out | std::ofstream::trunc);
+        NS_ABORT_MSG_IF(!ulKpmFile.is_open(), "Can't open file " << filename << "-ul-kpms");
+        uplinkKpms.Write(ulKpmFile,
+                         stats,
+                         classifier,
+                         {ulPortBrowsing, ulPortVideoCall},
+                         flowDuration,
+                         meanUlThroughput,
+                         meanUlDelay);
+        NS_LOG_INFO("Uplink: mean flow throughput " << meanUlThroughput << " Mbps, mean delay "
+                                                    << meanUlDelay << " ms");
+    }
+    if (simulationTrace)
+    {
+        for (std::size_t offset = 0; offset < report.GetSize(); offset += 1 << 16)
+        {
+            simulationTrace->Write(KpmTraceSink::FLOW_REPORT,
+                                   Simulator::Now(),
+                                   report.GetData() + offset,
+                                   std::min<std::size_t>(1 << 16, report.GetSize() - offset));
+        }
+        NS_LOG_INFO("Trace sink: " << simulationTrace->GetStalls() << " stalls on a full ring");
+        NS_ABORT_MSG_IF(!traceSink.Close(), "Can't write trace sink " << traceSinkFile);
+        NS_LOG_INFO("Trace sink: " << traceSink.GetRawBytes() << " bytes of records stored in "
+                                   << traceSink.GetStoredBytes() << " bytes");
+    }
+    std::string reportFile = simulationTrace || resultsOutput == "stdout" ? "" : filename;
+    if (!report.Write(reportFile, resultsOutput != "file"))
+    {
+        std::cerr << "Can't write file " << filename << std::endl;
         return 1;
     }
 
-    outFile.setf(std::ios_base::fixed);
-
-    double flowDuration = (simTime - udpAppStartTime).GetSeconds();
-    for (std::map<FlowId, FlowMonitor::FlowStats>::const_iterator i = stats.begin();
-         i != stats.end();
-         ++i)
-    {
-        Ipv4FlowClassifier::FiveTuple t = classifier->FindFlow(i->first);
-        std::stringstream protoStream;
-        protoStream << (uint16_t)t.protocol;
-        if (t.protocol == 6)
-        {
-            protoStream.str("TCP");
-        }
-        if (t.protocol == 17)
-        {
-            protoStream.str("UDP");
-        }
-        outFile << "Flow " << i->first << " (" << t.sourceAddress << ":" << t.sourcePort << " -> "
-                << t.destinationAddress << ":" << t.destinationPort << ") proto "
-                << protoStream.str() << "\n";
-        outFile << "  Tx Packets: " << i->second.txPackets << "\n";
-        outFile << "  Tx Bytes:   " << i->second.txBytes << "\n";
-        outFile << "  TxOffered:  " << i->second.txBytes * 8.0 / flowDuration / 1000.0 / 1000.0
-                << " Mbps\n";
-        outFile << "  Rx Bytes:   " << i->second.rxBytes << "\n";
-        outFile << "  Lost Packets: " << i->second.txPackets - i->second.rxPackets << "\n";
-        outFile << "  Packet loss: "
-                << (((i->second.txPackets - i->second.rxPackets) * 1.0) / i->second.txPackets) * 100
-                << "%" << "\n";
-
-        if (i->second.rxPackets > 0)
-        {
-            // Measure the duration of the flow from receiver's perspective
-            averageFlowThroughput += i->second.rxBytes * 8.0 / flowDuration / 1000 / 1000;
-            averageFlowDelay += 1000 * i->second.delaySum.GetSeconds() / i->second.rxPackets;
-
-            outFile << "  Throughput: " << i->second.rxBytes * 8.0 / flowDuration / 1000 / 1000
-                    << " Mbps\n";
-            outFile << "  Mean delay:  "
-                    << 1000 * i->second.delaySum.GetSeconds() / i->second.rxPackets << " ms\n";
-            // outFile << "  Mean upt:  " << i->second.uptSum / i->second.rxPackets / 1000/1000 << "
-            // Mbps \n";
-            outFile << "  Mean jitter:  "
-                    << 1000 * i->second.jitterSum.GetSeconds() / i->second.rxPackets << " ms\n";
+    if (!resultsDb.empty())
+    {
+        uint64_t txPackets = 0;
+        uint64_t rxPackets = 0;
+        for (const auto& flow : stats)
+        {
+            txPackets += flow.second.txPackets;
+            rxPackets += flow.second.rxPackets;
         }
-        else
+        KpmResultRow row;
+        row.Set("scenario", std::string("haca-kpm"));
+        row.Set("simTag", simTag);
+        row.Set("direction", direction);
+        row.Set("traffic", traffic);
+        row.Set("mode", mode);
+        row.Set("scheduler", scheduler);
+        row.Set("remLoad", remLoad);
+        row.Set("power", totalTxPower);
+        row.Set("lambdaBrowsing", lambdaBrowsing);
+        row.Set("lambdaVideo", lambdaVideo);
+        row.Set("udpPacketSizeBrowsing", udpPacketSizeBrowsing);
+        row.Set("udpPacketSizeVideo", udpPacketSizeVideo);
+        row.Set("numGnb", numGnb);
+        row.Set("bwpManager", bwpManager);
+        row.Set("mobility", mobility.empty() ? std::string("static") : mobility);
+        row.Set("ueSpeed", mobility.empty() ? 0.0 : ueSpeed);
+        row.Set("numUePerGnb", numUePerGnb);
+        row.Set("simTime", simTime.GetMilliSeconds());
+        row.Set("kpmArrayGain", kpmArrayGain);
+        row.Set("leanTracing", leanTracing);
+        row.Set("steadyState", steadyState);
+        row.Set("segment", restored.segment);
+        row.Set("rngRun", RngSeedManager::GetRun());
+        row.Set("flows", stats.size());
+        row.Set("flowDuration", flowDuration);
+        row.Set("txPackets", txPackets);
+        row.Set("rxPackets", rxPackets);
+        row.Set("meanFlowThroughput", meanFlowThroughput);
+        row.Set("meanFlowDelay", meanFlowDelay);
+        if (ulTraffic)
         {
-            outFile << "  Throughput:  0 Mbps\n";
-            outFile << "  Mean delay:  0 ms\n";
-            outFile << "  Mean jitter: 0 ms\n";
+            row.Set("meanUlThroughput", meanUlThroughput);
+            row.Set("meanUlDelay", meanUlDelay);
         }
-        outFile << "  Rx Packets: " << i->second.rxPackets << "\n";
+        row.Set("wallClock", std::time(nullptr));
+        NS_ABORT_MSG_IF(!KpmResultsStore::Append(resultsDb, row),
+                        "Can't append to results store " << resultsDb);
     }
 
-    double meanFlowThroughput = averageFlowThroughput / stats.size();
-    double meanFlowDelay = averageFlowDelay / stats.size();
-
-    outFile << "\n\n  Mean flow throughput: " << meanFlowThroughput << "\n";
-    outFile << "  Mean flow delay: " << meanFlowDelay << "\n";
-
-    outFile.close();
-
-    std::ifstream f(filename.c_str());
-
-    if (f.is_open())
+    if (memoryReport)
     {
-        std::cout << f.rdbuf();
+        memory.MeasureFlows(monitor);
+        std::ofstream memoryFile(filename + "-memory", std::ofstream::out | std::ofstream::trunc);
+        memory.Write(memoryFile);
+        std::stringstream memoryLog;
+        memory.Write(memoryLog);
+        NS_LOG_INFO(memoryLog.str());
     }
 
-    Simulator::Destroy();
-
-    if (argc == 0)
+    // Events per node, busiest first, with the role of the node.
+    uint64_t pgwEvents = 0;
+    uint64_t remoteHostEvents = 0;
+    if (nodeLoad)
     {
-        double toleranceMeanFlowThroughput = 0.0001 * 56.258560;
-        double toleranceMeanFlowDelay = 0.0001 * 0.553292;
-
-        if (meanFlowThroughput >= 56.258560 - toleranceMeanFlowThroughput &&
-            meanFlowThroughput <= 56.258560 + toleranceMeanFlowThroughput &&
-            meanFlowDelay >= 0.553292 - toleranceMeanFlowDelay &&
-            meanFlowDelay <= 0.553292 + toleranceMeanFlowDelay)
+        std::map<uint32_t, std::string> roles;
+        roles[pgw->GetId()] = "pgw";
+        for (uint32_t k = 0; k < remoteHostContainer.GetN(); ++k)
         {
-            return EXIT_SUCCESS;
+            roles[remoteHostContainer.Get(k)->GetId()] = "remoteHost";
         }
-        else
+        for (uint32_t i = 0; i < gridScenario.GetBaseStations().GetN(); ++i)
         {
-            return EXIT_FAILURE;
+            roles[gridScenario.GetBaseStations().Get(i)->GetId()] = "gnb";
         }
-    }
-    else if (argc == 1 and numUePerGnb == 9) // called from examples-to-run.py with these parameters
-    {
-        double toleranceMeanFlowThroughput = 0.0001 * 47.858536;
-        double toleranceMeanFlowDelay = 0.0001 * 10.504189;
-
-        if (meanFlowThroughput >= 47.858536 - toleranceMeanFlowThroughput &&
-            meanFlowThroughput <= 47.858536 + toleranceMeanFlowThroughput &&
-            meanFlowDelay >= 10.504189 - toleranceMeanFlowDelay &&
-            meanFlowDelay <= 10.504189 + toleranceMeanFlowDelay)
+        for (uint32_t j = 0; j < gridScenario.GetUserTerminals().GetN(); ++j)
         {
-            return EXIT_SUCCESS;
+            roles[gridScenario.GetUserTerminals().Get(j)->GetId()] = "ue";
         }
-        else
+        const std::vector<uint64_t>& nodeEvents = KpmNodeLoadScheduler::GetNodeEvents();
+        std::vector<std::pair<uint64_t, uint32_t>> busiest;
+        uint64_t total = KpmNodeLoadScheduler::GetOtherEvents();
+        for (uint32_t id = 0; id < nodeEvents.size(); ++id)
+        {
+            busiest.emplace_back(nodeEvents[id], id);
+            total += nodeEvents[id];
+            if (roles.count(id) && roles[id] == "remoteHost")
+            {
+                remoteHostEvents = std::max(remoteHostEvents, nodeEvents[id]);
+            }
+        }
+        pgwEvents = pgw->GetId() < nodeEvents.size() ? nodeEvents[pgw->GetId()] : 0;
+        std::sort(busiest.rbegin(), busiest.rend());
+
+        std::ofstream loadFile(filename + "-node-load", std::ofstream::out | std::ofstream::trunc);
+        NS_ABORT_MSG_IF(!loadFile.is_open(), "Can't open file " << filename << "-node-load");
+        loadFile << "node\trole\tevents\tshare\n";
+        for (const auto& node : busiest)
         {
-            return EXIT_FAILURE;
+            loadFile << node.second << "\t"
+                     << (roles.count(node.second) ? roles[node.second] : "other") << "\t"
+                     << node.first << "\t" << static_cast<double>(node.first) / total << "\n";
         }
+        loadFile << "-\tnone\t" << KpmNodeLoadScheduler::GetOtherEvents() << "\t"
+                 << static_cast<double>(KpmNodeLoadScheduler::GetOtherEvents()) / total << "\n";
+        NS_LOG_INFO("Events: PGW " << pgwEvents << ", busiest remote host " << remoteHostEvents
+                                   << " of " << total);
     }
-    else
+
+    if (!benchmarkReport.empty())
     {
-        return EXIT_SUCCESS; // we dont check other parameters configurations at the moment
+        if (nodeLoad)
+        {
+            benchmark.AddMetric("pgwEvents", pgwEvents);
+            benchmark.AddMetric("remoteHostEvents", remoteHostEvents);
+        }
+        if (!mobility.empty())
+        {
+            benchmark.AddMetric("ueSpeed", ueSpeed);
+            benchmark.AddMetric("beamUpdates", ueMobility.GetUpdates());
+        }
+        if (ulTraffic)
+        {
+            benchmark.AddMetric("meanUlThroughput", meanUlThroughput);
+            benchmark.AddMetric("meanUlDelay", meanUlDelay);
+        }
+        if (handover)
+        {
+            benchmark.AddMetric("rsrpMeasurements", a3Handover.GetMeasurements());
+            benchmark.AddMetric("handovers", a3Handover.GetCompleted());
+        }
+        NS_ABORT_MSG_IF(!benchmark.Write(benchmarkReport, meanFlowThroughput, meanFlowDelay),
+                        "Can't write benchmark report " << benchmarkReport);
     }
+
+    Simulator::Destroy();
+    // The KPMs are checked against kpm-benchmarks.golden by run_benchmarks.sh.
+    return EXIT_SUCCESS;
 }
@@ -0,0 +1,621 @@
+#ifndef KPM_ARRAY_GAIN_H
+#define KPM_ARRAY_GAIN_H
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <vector>
+
+namespace ns3
+{
+
+/**
+ * Batched array response of a uniform planar array (UPA) made of isotropic
+ * elements, laid out as ns-3's UniformPlanarArray with zero bearing and
+ * downtilt: element k sits at (0, c * dH, r * dV) wavelengths with
+ * r = k / numColumns and c = k % numColumns.
+ *
+ * The steering vector of such an array is the outer product of a row and a
+ * column phase progression, so evaluating a direction needs two sin/cos
+ * pairs instead of one complex exponential per element. Directions are
+ * processed in fixed-size blocks laid out lane by lane (structure of arrays)
+ * so that the inner loops carry no dependency across lanes and are
+ * vectorized by the compiler.
+ */
+class KpmArrayGainEngine
+{
+  public:
+    using Complex = std::complex<double>;
+    using Weights = std::vector<Complex>;
+
+    /// Number of directions evaluated together in one SIMD block.
+    static constexpr std::size_t BLOCK = 64;
+
+    /**
+     * Beam weights prepared for batched evaluation. Direct-path beams are
+     * rank one (w[r][c] = u[r] * v[c]), which reduces the per-direction cost
+     * from numRows * numColumns to numRows + numColumns multiply-adds.
+     */
+    struct Beam
+    {
+        std::vector<double> re; //!< weights, row-major, real part
+        std::vector<double> im; //!< weights, row-major, imaginary part
+        bool separable{false};
+        std::vector<double> rowRe;
+        std::vector<double> rowIm;
+        std::vector<double> colRe;
+        std::vector<double> colIm;
+    };
+
+    KpmArrayGainEngine(uint32_t numRows,
+                       uint32_t numColumns,
+                       double horizontalSpacing = 0.5,
+                       double verticalSpacing = 0.5)
+        : m_numRows(numRows),
+          m_numColumns(numColumns),
+          m_kH(2 * M_PI * horizontalSpacing),
+          m_kV(2 * M_PI * verticalSpacing)
+    {
+    }
+
+    /**
+     * Shared engine for a given panel geometry. All devices with the same
+     * NumRows/NumColumns/spacing reuse one instance and its phase tables.
+     */
+    static std::shared_ptr<const KpmArrayGainEngine> Get(uint32_t numRows,
+                                                         uint32_t numColumns,
+                                                         double horizontalSpacing = 0.5,
+                                                         double verticalSpacing = 0.5)
+    {
+        static std::mutex mutex;
+        static std::map<std::tuple<uint32_t, uint32_t, double, double>,
+                        std::shared_ptr<const KpmArrayGainEngine>>
+            cache;
+        std::lock_guard<std::mutex> lock(mutex);
+        auto key = std::make_tuple(numRows, numColumns, horizontalSpacing, verticalSpacing);
+        auto it = cache.find(key);
+        if (it == cache.end())
+        {
+            it = cache
+                     .emplace(key,
+                              std::make_shared<const KpmArrayGainEngine>(numRows,
+                                                                         numColumns,
+                                                                         horizontalSpacing,
+                                                                         verticalSpacing))
+                     .first;
+        }
+        return it->second;
+    }
+
+    uint32_t GetNumRows() const
+    {
+        return m_numRows;
+    }
+
+    uint32_t GetNumColumns() const
+    {
+        return m_numColumns;
+    }
+
+    uint32_t GetNumElements() const
+    {
+        return m_numRows * m_numColumns;
+    }
+
+    /**
+     * Steering vector towards (zenith, azimuth), same sign convention as
+     * PhasedArrayModel::GetSteeringVector.
+     */
+    Weights SteeringVector(double zenith, double azimuth) const
+    {
+        double psiH = -m_kH * std::sin(zenith) * std::sin(azimuth);
+        double psiV = -m_kV * std::cos(zenith);
+        Weights s(GetNumElements());
+        for (uint32_t r = 0; r < m_numRows; ++r)
+        {
+            for (uint32_t c = 0; c < m_numColumns; ++c)
+            {
+                s[r * m_numColumns + c] = std::polar(1.0, r * psiV + c * psiH);
+            }
+        }
+        return s;
+    }
+
+    /**
+     * Unit-norm direct-path beam towards (zenith, azimuth), i.e. the
+     * normalized conjugate steering vector, already in separable form.
+     */
+    Beam DirectPathBeam(double zenith, double azimuth) const
+    {
+        return SpatialBeam(-m_kV * std::cos(zenith), -m_kH * std::sin(zenith) * std::sin(azimuth));
+    }
+
+    /**
+     * Unit-norm separable beam matched to the row step phase psiV and the
+     * column step phase psiH.
+     */
+    Beam SpatialBeam(double psiV, double psiH) const
+    {
+        Beam beam;
+        beam.separable = true;
+        beam.rowRe.resize(m_numRows);
+        beam.rowIm.resize(m_numRows);
+        beam.colRe.resize(m_numColumns);
+        beam.colIm.resize(m_numColumns);
+        double rowNorm = 1.0 / std::sqrt(static_cast<double>(m_numRows));
+        double colNorm = 1.0 / std::sqrt(static_cast<double>(m_numColumns));
+        for (uint32_t r = 0; r < m_numRows; ++r)
+        {
+            beam.rowRe[r] = rowNorm * std::cos(r * psiV);
+            beam.rowIm[r] = -rowNorm * std::sin(r * psiV);
+        }
+        for (uint32_t c = 0; c < m_numColumns; ++c)
+        {
+            beam.colRe[c] = colNorm * std::cos(c * psiH);
+            beam.colIm[c] = -colNorm * std::sin(c * psiH);
+        }
+        beam.re.resize(GetNumElements());
+        beam.im.resize(GetNumElements());
+        for (uint32_t r = 0; r < m_numRows; ++r)
+        {
+            for (uint32_t c = 0; c < m_numColumns; ++c)
+            {
+                Complex w = Complex(beam.rowRe[r], beam.rowIm[r]) *
+                            Complex(beam.colRe[c], beam.colIm[c]);
+                beam.re[r * m_numColumns + c] = w.real();
+                beam.im[r * m_numColumns + c] = w.imag();
+            }
+        }
+        return beam;
+    }
+
+    /**
+     * Oversampled DFT codebook: rowBeams x columnBeams separable beams with
+     * step phases evenly spread over [-pi, pi), index row * columnBeams +
+     * column.
+     */
+    std::vector<Beam> DftCodebook(uint32_t rowBeams, uint32_t columnBeams) const
+    {
+        std::vector<Beam> beams;
+        beams.reserve(rowBeams * columnBeams);
+        for (uint32_t r = 0; r < rowBeams; ++r)
+        {
+            for (uint32_t c = 0; c < columnBeams; ++c)
+            {
+                beams.push_back(SpatialBeam(-M_PI + 2 * M_PI * (r + 0.5) / rowBeams,
+                                            -M_PI + 2 * M_PI * (c + 0.5) / columnBeams));
+            }
+        }
+        return beams;
+    }
+
+    /// Prepare arbitrary weights (e.g. read back from a BeamManager).
+    Beam MakeBeam(const Weights& w) const
+    {
+        Beam beam;
+        beam.re.resize(GetNumElements());
+        beam.im.resize(GetNumElements());
+        for (uint32_t k = 0; k < GetNumElements() && k < w.size(); ++k)
+        {
+            beam.re[k] = w[k].real();
+            beam.im[k] = w[k].imag();
+        }
+        return beam;
+    }
+
+    /// Weights of a prepared beam, row-major.
+    Weights GetWeights(const Beam& beam) const
+    {
+        Weights w(GetNumElements());
+        for (uint32_t k = 0; k < GetNumElements(); ++k)
+        {
+            w[k] = Complex(beam.re[k], beam.im[k]);
+        }
+        return w;
+    }
+
+    /**
+     * Phase table of a set of directions: the row and column step phasors of
+     * every direction, computed once and reusable for any number of beams of
+     * the same panel geometry.
+     */
+    struct Directions
+    {
+        std::vector<double> stepHRe;
+        std::vector<double> stepHIm;
+        std::vector<double> stepVRe;
+        std::vector<double> stepVIm;
+
+        std::size_t GetN() const
+        {
+            return stepHRe.size();
+        }
+    };
+
+    Directions PrepareDirections(const double* zenith, const double* azimuth, std::size_t n) const
+    {
+        Directions dirs;
+        dirs.stepHRe.resize(n);
+        dirs.stepHIm.resize(n);
+        dirs.stepVRe.resize(n);
+        dirs.stepVIm.resize(n);
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            double psiH = -m_kH * std::sin(zenith[i]) * std::sin(azimuth[i]);
+            double psiV = -m_kV * std::cos(zenith[i]);
+            dirs.stepHRe[i] = std::cos(psiH);
+            dirs.stepHIm[i] = std::sin(psiH);
+            dirs.stepVRe[i] = std::cos(psiV);
+            dirs.stepVIm[i] = std::sin(psiV);
+        }
+        return dirs;
+    }
+
+    /**
+     * Same as PrepareDirections, from the direction cosines of the panel
+     * frame: u = sin(zenith) sin(azimuth) and v = cos(zenith). Callers that
+     * know the geometry of the links avoid the inverse trigonometry.
+     */
+    Directions PrepareDirectionCosines(const double* u, const double* v, std::size_t n) const
+    {
+        Directions dirs;
+        dirs.stepHRe.resize(n);
+        dirs.stepHIm.resize(n);
+        dirs.stepVRe.resize(n);
+        dirs.stepVIm.resize(n);
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            double psiH = -m_kH * u[i];
+            double psiV = -m_kV * v[i];
+            dirs.stepHRe[i] = std::cos(psiH);
+            dirs.stepHIm[i] = std::sin(psiH);
+            dirs.stepVRe[i] = std::cos(psiV);
+            dirs.stepVIm[i] = std::sin(psiV);
+        }
+        return dirs;
+    }
+
+    /**
+     * Linear power gain |sum_k w_k s_k(zenith, azimuth)|^2 of a beam for n
+     * directions. An isotropic element has gain 1, so a direct-path beam
+     * peaks at GetNumElements().
+     */
+    void ComputeGain(const Beam& beam,
+                     const double* zenith,
+                     const double* azimuth,
+                     std::size_t n,
+                     double* gain) const
+    {
+        ComputeGain(beam, PrepareDirections(zenith, azimuth, n), gain);
+    }
+
+    /// Same as above, on a precomputed phase table.
+    void ComputeGain(const Beam& beam, const Directions& dirs, double* gain) const
+    {
+        std::size_t n = dirs.GetN();
+        for (std::size_t start = 0; start < n; start += BLOCK)
+        {
+            std::size_t len = std::min(BLOCK, n - start);
+            ComputeGainBlock(beam,
+                             dirs.stepHRe.data() + start,
+                             dirs.stepHIm.data() + start,
+                             dirs.stepVRe.data() + start,
+                             dirs.stepVIm.data() + start,
+                             len,
+                             gain + start);
+        }
+    }
+
+    /// Gain of the quasi-omni beam (all weight on the first element).
+    static double QuasiOmniGain()
+    {
+        return 1.0;
+    }
+
+    /**
+     * Largest gain over a set of beams in every direction, and the index of
+     * the beam that gives it. The gain of a separable beam is the product of
+     * its row and column responses, so the responses are computed once per
+     * distinct row and column factor and every beam only costs a multiply.
+     * When the beams are all the combinations of their factors (a DFT
+     * codebook) the best beam is the best row times the best column, and the
+     * cost no longer depends on the number of beams. Beams that are not
+     * separable are evaluated in full.
+     */
+    void ComputeBestGain(const std::vector<Beam>& beams,
+                         const Directions& dirs,
+                         double* gain,
+                         uint32_t* index) const
+    {
+        std::size_t n = dirs.GetN();
+        std::fill(gain, gain + n, 0.0);
+        std::fill(index, index + n, 0);
+
+        // Distinct row and column factors of the separable beams.
+        std::vector<const Beam*> rows;
+        std::vector<const Beam*> cols;
+        std::vector<std::size_t> beamRow(beams.size());
+        std::vector<std::size_t> beamCol(beams.size());
+        std::vector<double> full(n);
+        for (std::size_t b = 0; b < beams.size(); ++b)
+        {
+            const Beam& beam = beams[b];
+            if (!beam.separable)
+            {
+                ComputeGain(beam, dirs, full.data());
+                for (std::size_t i = 0; i < n; ++i)
+                {
+                    if (full[i] > gain[i])
+                    {
+                        gain[i] = full[i];
+                        index[i] = b;
+                    }
+                }
+                continue;
+            }
+            beamRow[b] = FindFactor(rows, beam, true);
+            beamCol[b] = FindFactor(cols, beam, false);
+        }
+
+        // Beam of every (row, column) pair, if all pairs are in the set.
+        std::vector<std::size_t> pairs(rows.size() * cols.size(), beams.size());
+        std::size_t numPairs = 0;
+        for (std::size_t b = 0; b < beams.size(); ++b)
+        {
+            // beamRow and beamCol are only set for separable beams.
+            if (!beams[b].separable)
+            {
+                continue;
+            }
+            std::size_t& pair = pairs[beamRow[b] * cols.size() + beamCol[b]];
+            if (pair == beams.size())
+            {
+                pair = b;
+                numPairs++;
+            }
+        }
+        bool product = numPairs == pairs.size() && !pairs.empty();
+
+        std::vector<double> rowGain(rows.size() * BLOCK);
+        std::vector<double> colGain(cols.size() * BLOCK);
+        for (std::size_t start = 0; start < n; start += BLOCK)
+        {
+            std::size_t len = std::min(BLOCK, n - start);
+            for (std::size_t r = 0; r < rows.size(); ++r)
+            {
+                Response(rows[r]->rowRe.data(),
+                         rows[r]->rowIm.data(),
+                         m_numRows,
+                         dirs.stepVRe.data() + start,
+                         dirs.stepVIm.data() + start,
+                         len,
+                         rowGain.data() + r * BLOCK);
+            }
+            for (std::size_t c = 0; c < cols.size(); ++c)
+            {
+                Response(cols[c]->colRe.data(),
+                         cols[c]->colIm.data(),
+                         m_numColumns,
+                         dirs.stepHRe.data() + start,
+                         dirs.stepHIm.data() + start,
+                         len,
+                         colGain.data() + c * BLOCK);
+            }
+            for (std::size_t l = 0; l < len; ++l)
+            {
+                double best = gain[start + l];
+                uint32_t bestIndex = index[start + l];
+                if (product)
+                {
+                    std::size_t bestRow = 0;
+                    std::size_t bestCol = 0;
+                    for (std::size_t r = 1; r < rows.size(); ++r)
+                    {
+                        if (rowGain[r * BLOCK + l] > rowGain[bestRow * BLOCK + l])
+                        {
+                            bestRow = r;
+                        }
+                    }
+                    for (std::size_t c = 1; c < cols.size(); ++c)
+                    {
+                        if (colGain[c * BLOCK + l] > colGain[bestCol * BLOCK + l])
+                        {
+                            bestCol = c;
+                        }
+                    }
+                    double g = rowGain[bestRow * BLOCK + l] * colGain[bestCol * BLOCK + l];
+                    if (g > best)
+                    {
+                        best = g;
+                        bestIndex = pairs[bestRow * cols.size() + bestCol];
+                    }
+                }
+                else
+                {
+                    for (std::size_t b = 0; b < beams.size(); ++b)
+                    {
+                        if (!beams[b].separable)
+                        {
+                            continue;
+                        }
+                        double g =
+                            rowGain[beamRow[b] * BLOCK + l] * colGain[beamCol[b] * BLOCK + l];
+                        if (g > best)
+                        {
+                            best = g;
+                            bestIndex = b;
+                        }
+                    }
+                }
+                gain[start + l] = best;
+                index[start + l] = bestIndex;
+            }
+        }
+    }
+
+    /// Gain in the direction a direct-path beam points to.
+    double MaxGain() const
+    {
+        return GetNumElements();
+    }
+
+  private:
+    void ComputeGainBlock(const Beam& beam,
+                          const double* stepHRe,
+                          const double* stepHIm,
+                          const double* stepVRe,
+                          const double* stepVIm,
+                          std::size_t len,
+                          double* gain) const
+    {
+        if (beam.separable)
+        {
+            double hRe[BLOCK];
+            double hIm[BLOCK];
+            double vRe[BLOCK];
+            double vIm[BLOCK];
+            Project(beam.colRe.data(),
+                    beam.colIm.data(),
+                    m_numColumns,
+                    stepHRe,
+                    stepHIm,
+                    len,
+                    hRe,
+                    hIm);
+            Project(beam.rowRe.data(),
+                    beam.rowIm.data(),
+                    m_numRows,
+                    stepVRe,
+                    stepVIm,
+                    len,
+                    vRe,
+                    vIm);
+            for (std::size_t l = 0; l < len; ++l)
+            {
+                gain[l] = (hRe[l] * hRe[l] + hIm[l] * hIm[l]) * (vRe[l] * vRe[l] + vIm[l] * vIm[l]);
+            }
+            return;
+        }
+
+        // General weights: S_r = sum_c w[r][c] b_c, then G = sum_r a_r S_r,
+        // with a_r and b_c generated by recurrence from the step phasors.
+        double accRe[BLOCK] = {};
+        double accIm[BLOCK] = {};
+        double aRe[BLOCK];
+        double aIm[BLOCK];
+        for (std::size_t l = 0; l < len; ++l)
+        {
+            aRe[l] = 1.0;
+            aIm[l] = 0.0;
+        }
+        for (uint32_t r = 0; r < m_numRows; ++r)
+        {
+            double sRe[BLOCK];
+            double sIm[BLOCK];
+            Project(beam.re.data() + r * m_numColumns,
+                    beam.im.data() + r * m_numColumns,
+                    m_numColumns,
+                    stepHRe,
+                    stepHIm,
+                    len,
+                    sRe,
+                    sIm);
+            for (std::size_t l = 0; l < len; ++l)
+            {
+                accRe[l] += aRe[l] * sRe[l] - aIm[l] * sIm[l];
+                accIm[l] += aRe[l] * sIm[l] + aIm[l] * sRe[l];
+                double nRe = aRe[l] * stepVRe[l] - aIm[l] * stepVIm[l];
+                double nIm = aRe[l] * stepVIm[l] + aIm[l] * stepVRe[l];
+                aRe[l] = nRe;
+                aIm[l] = nIm;
+            }
+        }
+        for (std::size_t l = 0; l < len; ++l)
+        {
+            gain[l] = accRe[l] * accRe[l] + accIm[l] * accIm[l];
+        }
+    }
+
+    /// Index of the beam's row (or column) factor in factors, added if new.
+    static std::size_t FindFactor(std::vector<const Beam*>& factors, const Beam& beam, bool row)
+    {
+        for (std::size_t f = 0; f < factors.size(); ++f)
+        {
+            if (row ? factors[f]->rowRe == beam.rowRe && factors[f]->rowIm == beam.rowIm
+                    : factors[f]->colRe == beam.colRe && factors[f]->colIm == beam.colIm)
+            {
+                return f;
+            }
+        }
+        factors.push_back(&beam);
+        return factors.size() - 1;
+    }
+
+    /// power[l] = |sum_{i < count} w[i] * step[l]^i|^2.
+    static void Response(const double* wRe,
+                         const double* wIm,
+                         std::size_t count,
+                         const double* stepRe,
+                         const double* stepIm,
+                         std::size_t len,
+                         double* power)
+    {
+        double re[BLOCK];
+        double im[BLOCK];
+        Project(wRe, wIm, count, stepRe, stepIm, len, re, im);
+        for (std::size_t l = 0; l < len; ++l)
+        {
+            power[l] = re[l] * re[l] + im[l] * im[l];
+        }
+    }
+
+    /// out[l] = sum_{i < count} w[i] * step[l]^i, one lane per direction.
+    static void Project(const double* wRe,
+                        const double* wIm,
+                        std::size_t count,
+                        const double* stepRe,
+                        const double* stepIm,
+                        std::size_t len,
+                        double* outRe,
+                        double* outIm)
+    {
+        double pRe[BLOCK];
+        double pIm[BLOCK];
+        for (std::size_t l = 0; l < len; ++l)
+        {
+            pRe[l] = 1.0;
+            pIm[l] = 0.0;
+            outRe[l] = 0.0;
+            outIm[l] = 0.0;
+        }
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            double wr = wRe[i];
+            double wi = wIm[i];
+            for (std::size_t l = 0; l < len; ++l)
+            {
+                outRe[l] += wr * pRe[l] - wi * pIm[l];
+                outIm[l] += wr * pIm[l] + wi * pRe[l];
+                double nRe = pRe[l] * stepRe[l] - pIm[l] * stepIm[l];
+                double nIm = pRe[l] * stepIm[l] + pIm[l] * stepRe[l];
+                pRe[l] = nRe;
+                pIm[l] = nIm;
+            }
+        }
+    }
+
+    uint32_t m_numRows;
+    uint32_t m_numColumns;
+    double m_kH;
+    double m_kV;
+};
+
+} // namespace ns3
+
+#endif // KPM_ARRAY_GAIN_H
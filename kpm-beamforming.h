@@ -0,0 +1,144 @@
+#ifndef KPM_BEAMFORMING_H
+#define KPM_BEAMFORMING_H
+
+#include "kpm-array-gain.h"
+
+#include "ns3/antenna-module.h"
+#include "ns3/core-module.h"
+#include "ns3/mobility-module.h"
+#include "ns3/nr-module.h"
+
+#include <cmath>
+
+namespace ns3
+{
+
+/**
+ * Batched array-gain engine shared by all panels with the geometry of the
+ * given UniformPlanarArray. Only bearing rotations are supported; the
+ * scenario never sets a downtilt.
+ */
+inline std::shared_ptr<const KpmArrayGainEngine>
+KpmGetArrayGainEngine(const Ptr<const UniformPlanarArray>& antenna)
+{
+    DoubleValue downtilt;
+    antenna->GetAttribute("DowntiltAngle", downtilt);
+    NS_ABORT_MSG_IF(downtilt.Get() != 0.0, "KpmArrayGainEngine does not support downtilted panels");
+
+    DoubleValue horizontalSpacing;
+    DoubleValue verticalSpacing;
+    antenna->GetAttribute("AntennaHorizontalSpacing", horizontalSpacing);
+    antenna->GetAttribute("AntennaVerticalSpacing", verticalSpacing);
+    return KpmArrayGainEngine::Get(antenna->GetNumRows(),
+                                   antenna->GetNumColumns(),
+                                   horizontalSpacing.Get(),
+                                   verticalSpacing.Get());
+}
+
+/// Bearing of a panel, in radians.
+inline double
+KpmGetBearing(const Ptr<const UniformPlanarArray>& antenna)
+{
+    DoubleValue bearing;
+    antenna->GetAttribute("BearingAngle", bearing);
+    return bearing.Get();
+}
+
+/**
+ * Zenith and azimuth of target as seen from origin, in the local frame of a
+ * panel rotated by bearing.
+ */
+inline void
+KpmLocalAngles(const Vector& origin,
+               const Vector& target,
+               double bearing,
+               double& zenith,
+               double& azimuth)
+{
+    double dx = target.x - origin.x;
+    double dy = target.y - origin.y;
+    double dz = target.z - origin.z;
+    double d = std::sqrt(dx * dx + dy * dy + dz * dz);
+    zenith = d > 0 ? std::acos(dz / d) : M_PI / 2;
+    azimuth = std::atan2(dy, dx) - bearing;
+}
+
+/// Convert prepared weights to the ns-3 representation.
+inline PhasedArrayModel::ComplexVector
+KpmToComplexVector(const KpmArrayGainEngine& engine, const KpmArrayGainEngine::Beam& beam)
+{
+    KpmArrayGainEngine::Weights w = engine.GetWeights(beam);
+    PhasedArrayModel::ComplexVector v(w.size());
+    for (std::size_t k = 0; k < w.size(); ++k)
+    {
+        v[k] = w[k];
+    }
+    return v;
+}
+
+/// Convert ns-3 weights (e.g. from a BeamManager) to engine weights.
+inline KpmArrayGainEngine::Weights
+KpmFromComplexVector(const PhasedArrayModel::ComplexVector& v)
+{
+    KpmArrayGainEngine::Weights w(v.GetSize());
+    for (std::size_t k = 0; k < w.size(); ++k)
+    {
+        w[k] = v[k];
+    }
+    return w;
+}
+
+/**
+ * DirectPathBeamforming computed with the batched array-gain engine: the
+ * beams are built from the cached row/column phase progressions of the
+ * panel instead of one complex exponential per element.
+ */
+class KpmDirectPathBeamforming : public DirectPathBeamforming
+{
+  public:
+    static TypeId GetTypeId()
+    {
+        static TypeId tid = TypeId("ns3::KpmDirectPathBeamforming")
+                                .SetParent<DirectPathBeamforming>()
+                                .AddConstructor<KpmDirectPathBeamforming>();
+        return tid;
+    }
+
+    BeamformingVectorPair GetBeamformingVectors(
+        const Ptr<NrSpectrumPhy>& gnbSpectrumPhy,
+        const Ptr<NrSpectrumPhy>& ueSpectrumPhy) const override
+    {
+        Ptr<const UniformPlanarArray> gnbAntenna =
+            DynamicCast<const UniformPlanarArray>(gnbSpectrumPhy->GetAntenna());
+        Ptr<const UniformPlanarArray> ueAntenna =
+            DynamicCast<const UniformPlanarArray>(ueSpectrumPhy->GetAntenna());
+        if (!gnbAntenna || !ueAntenna)
+        {
+            return DirectPathBeamforming::GetBeamformingVectors(gnbSpectrumPhy, ueSpectrumPhy);
+        }
+
+        Vector gnbPos = gnbSpectrumPhy->GetMobility()->GetPosition();
+        Vector uePos = ueSpectrumPhy->GetMobility()->GetPosition();
+
+        return std::make_pair(BeamformingVector(Beam(gnbAntenna, gnbPos, uePos), OMNI_BEAM_ID),
+                              BeamformingVector(Beam(ueAntenna, uePos, gnbPos), OMNI_BEAM_ID));
+    }
+
+  private:
+    static PhasedArrayModel::ComplexVector Beam(const Ptr<const UniformPlanarArray>& antenna,
+                                                const Vector& origin,
+                                                const Vector& target)
+    {
+        auto engine = KpmGetArrayGainEngine(antenna);
+        double zenith;
+        double azimuth;
+        KpmLocalAngles(origin, target, KpmGetBearing(antenna), zenith, azimuth);
+        return KpmToComplexVector(*engine, engine->DirectPathBeam(zenith, azimuth));
+    }
+};
+
+NS_OBJECT_ENSURE_REGISTERED(KpmDirectPathBeamforming);
+
+} // namespace ns3
+
+#endif // KPM_BEAMFORMING_H
@@ -0,0 +1,238 @@
+#include "kpm-array-gain.h"
+
+#include "ns3/antenna-module.h"
+#include "ns3/core-module.h"
+
+#include <algorithm>
+#include <chrono>
+#include <complex>
+#include <iostream>
+#include <random>
+#include <vector>
+
+using namespace ns3;
+
+/*
+ * Benchmark of the batched array-gain engine against the per-element
+ * evaluation (one complex exponential per element and direction, as
+ * PhasedArrayModel::GetSteeringVector does) for the scenario's panels:
+ * 4x8 at the gNB and 2x4 at the UE. The beam sweep part times the best
+ * beam search over DFT codebooks of growing size on the gNB panel, beam by
+ * beam and with ComputeBestGain.
+ *
+ * The accuracy check is against ns-3 itself: for a few panel sizes and
+ * bearings, the gain of a direct-path beam from the engine is compared with
+ * the same weights applied to UniformPlanarArray::GetSteeringVector, times
+ * the power of GetElementFieldPattern, over random directions.
+ *
+ * ./ns3 run "scratch/kpm-bench-array-gain.cc --points=1000000"
+ */
+
+static double
+Elapsed(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void
+RunPanel(uint32_t numRows, uint32_t numColumns, uint32_t numPoints, uint32_t seed)
+{
+    auto engine = KpmArrayGainEngine::Get(numRows, numColumns);
+
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> zenithDist(0.0, M_PI);
+    std::uniform_real_distribution<double> azimuthDist(-M_PI, M_PI);
+    std::vector<double> zenith(numPoints);
+    std::vector<double> azimuth(numPoints);
+    for (uint32_t i = 0; i < numPoints; ++i)
+    {
+        zenith[i] = zenithDist(rng);
+        azimuth[i] = azimuthDist(rng);
+    }
+
+    KpmArrayGainEngine::Beam directPath = engine->DirectPathBeam(M_PI / 2 + 0.1, 0.3);
+    KpmArrayGainEngine::Beam general = engine->MakeBeam(engine->GetWeights(directPath));
+    KpmArrayGainEngine::Weights weights = engine->GetWeights(directPath);
+
+    std::vector<double> reference(numPoints);
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < numPoints; ++i)
+    {
+        KpmArrayGainEngine::Weights steering = engine->SteeringVector(zenith[i], azimuth[i]);
+        std::complex<double> sum = 0.0;
+        for (std::size_t k = 0; k < steering.size(); ++k)
+        {
+            sum += weights[k] * steering[k];
+        }
+        reference[i] = std::norm(sum);
+    }
+    double perElementTime = Elapsed(start);
+
+    std::vector<double> generalGain(numPoints);
+    start = std::chrono::steady_clock::now();
+    engine->ComputeGain(general, zenith.data(), azimuth.data(), numPoints, generalGain.data());
+    double generalTime = Elapsed(start);
+
+    std::vector<double> separableGain(numPoints);
+    start = std::chrono::steady_clock::now();
+    engine->ComputeGain(directPath, zenith.data(), azimuth.data(), numPoints, separableGain.data());
+    double separableTime = Elapsed(start);
+
+    double maxError = 0.0;
+    for (uint32_t i = 0; i < numPoints; ++i)
+    {
+        maxError = std::max(maxError, std::abs(generalGain[i] - reference[i]));
+        maxError = std::max(maxError, std::abs(separableGain[i] - reference[i]));
+    }
+
+    std::cout << numRows << "x" << numColumns << " panel, " << numPoints << " points\n";
+    std::cout << "  per-element:     " << numPoints / perElementTime << " points/s\n";
+    std::cout << "  batched general: " << numPoints / generalTime << " points/s\n";
+    std::cout << "  batched direct:  " << numPoints / separableTime << " points/s\n";
+    std::cout << "  max abs error:   " << maxError << "\n";
+}
+
+/// Largest difference between the engine gain and the ns-3 UniformPlanarArray one.
+static double
+RunReference(uint32_t numRows,
+             uint32_t numColumns,
+             double bearing,
+             uint32_t numPoints,
+             uint32_t seed)
+{
+    auto engine = KpmArrayGainEngine::Get(numRows, numColumns);
+    Ptr<UniformPlanarArray> antenna = CreateObject<UniformPlanarArray>();
+    antenna->SetAttribute("NumRows", UintegerValue(numRows));
+    antenna->SetAttribute("NumColumns", UintegerValue(numColumns));
+    antenna->SetAttribute("BearingAngle", DoubleValue(bearing));
+    antenna->SetAttribute("AntennaElement", PointerValue(CreateObject<IsotropicAntennaModel>()));
+
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> zenithDist(0.0, M_PI);
+    std::uniform_real_distribution<double> azimuthDist(-M_PI, M_PI);
+    std::vector<double> zenith(numPoints);
+    std::vector<double> azimuth(numPoints);
+    std::vector<double> localAzimuth(numPoints);
+    for (uint32_t i = 0; i < numPoints; ++i)
+    {
+        zenith[i] = zenithDist(rng);
+        azimuth[i] = azimuthDist(rng);
+        // The engine works in the frame of the panel, as KpmLocalAngles gives it.
+        localAzimuth[i] = azimuth[i] - bearing;
+    }
+
+    KpmArrayGainEngine::Beam beam = engine->DirectPathBeam(M_PI / 2 + 0.1, 0.3);
+    KpmArrayGainEngine::Weights weights = engine->GetWeights(beam);
+    std::vector<double> gain(numPoints);
+    engine->ComputeGain(beam, zenith.data(), localAzimuth.data(), numPoints, gain.data());
+
+    double maxError = 0.0;
+    for (uint32_t i = 0; i < numPoints; ++i)
+    {
+        Angles angles(azimuth[i], zenith[i]);
+        PhasedArrayModel::ComplexVector steering = antenna->GetSteeringVector(angles);
+        std::complex<double> sum = 0.0;
+        for (std::size_t k = 0; k < weights.size(); ++k)
+        {
+            sum += weights[k] * steering[k];
+        }
+        std::pair<double, double> field = antenna->GetElementFieldPattern(angles);
+        double reference =
+            std::norm(sum) * (field.first * field.first + field.second * field.second);
+        maxError = std::max(maxError, std::abs(gain[i] - reference));
+    }
+    return maxError;
+}
+
+static void
+RunBeamSweep(uint32_t numPoints, uint32_t seed)
+{
+    auto engine = KpmArrayGainEngine::Get(4, 8);
+
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> zenithDist(0.0, M_PI);
+    std::uniform_real_distribution<double> azimuthDist(-M_PI, M_PI);
+    std::vector<double> zenith(numPoints);
+    std::vector<double> azimuth(numPoints);
+    for (uint32_t i = 0; i < numPoints; ++i)
+    {
+        zenith[i] = zenithDist(rng);
+        azimuth[i] = azimuthDist(rng);
+    }
+    KpmArrayGainEngine::Directions dirs =
+        engine->PrepareDirections(zenith.data(), azimuth.data(), numPoints);
+
+    std::cout << "beam sweep, 4x8 panel, " << numPoints << " points\n";
+    for (uint32_t oversampling = 1; oversampling <= 8; oversampling *= 2)
+    {
+        std::vector<KpmArrayGainEngine::Beam> beams =
+            engine->DftCodebook(4 * oversampling, 8 * oversampling);
+
+        std::vector<double> gain(numPoints);
+        std::vector<double> best(numPoints, 0.0);
+        auto start = std::chrono::steady_clock::now();
+        for (const auto& beam : beams)
+        {
+            engine->ComputeGain(beam, dirs, gain.data());
+            for (uint32_t i = 0; i < numPoints; ++i)
+            {
+                best[i] = std::max(best[i], gain[i]);
+            }
+        }
+        double perBeamTime = Elapsed(start);
+
+        std::vector<double> sweepGain(numPoints);
+        std::vector<uint32_t> sweepIndex(numPoints);
+        start = std::chrono::steady_clock::now();
+        engine->ComputeBestGain(beams, dirs, sweepGain.data(), sweepIndex.data());
+        double sweepTime = Elapsed(start);
+
+        double maxError = 0.0;
+        for (uint32_t i = 0; i < numPoints; ++i)
+        {
+            maxError = std::max(maxError, std::abs(sweepGain[i] - best[i]));
+        }
+        std::cout << "  " << beams.size() << " beams: per beam " << numPoints / perBeamTime
+                  << " points/s, best gain " << numPoints / sweepTime
+                  << " points/s, max abs error " << maxError << "\n";
+    }
+}
+
+int
+main(int argc, char* argv[])
+{
+    uint32_t numPoints = 1000000;
+    uint32_t seed = 1;
+
+    CommandLine cmd(__FILE__);
+    cmd.AddValue("points", "number of directions evaluated per panel", numPoints);
+    cmd.AddValue("seed", "seed of the random directions", seed);
+    cmd.Parse(argc, argv);
+
+    RunPanel(4, 8, numPoints, seed);
+    RunPanel(2, 4, numPoints, seed);
+
+    uint32_t referencePoints = std::min<uint32_t>(numPoints, 10000);
+    std::cout << "against UniformPlanarArray, " << referencePoints << " points\n";
+    double worst = 0.0;
+    for (auto panel : {std::make_pair(4u, 8u), std::make_pair(2u, 4u), std::make_pair(1u, 1u)})
+    {
+        for (double bearing : {0.0, M_PI / 6, -M_PI / 3})
+        {
+            double error =
+                RunReference(panel.first, panel.second, bearing, referencePoints, seed);
+            worst = std::max(worst, error);
+            std::cout << "  " << panel.first << "x" << panel.second << " panel, bearing "
+                      << bearing * 180 / M_PI << " deg: max abs error " << error << "\n";
+        }
+    }
+    RunBeamSweep(numPoints / 10, seed);
+
+    // Gains are at most the number of elements: anything above rounding is a model mismatch.
+    if (worst > 1e-6)
+    {
+        std::cerr << "FAIL: the engine does not match UniformPlanarArray" << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,174 @@
+#include "kpm-flow-report.h"
+
+#include "ns3/core-module.h"
+#include "ns3/flow-monitor-module.h"
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <vector>
+
+using namespace ns3;
+
+/*
+ * Benchmark of the per-flow results export: the scenarios' former path (an
+ * ofstream line by line with a stringstream per flow for the protocol, then
+ * the file read back and streamed to stdout) against KpmFlowReport (one
+ * snprintf pass into a reserved buffer, written once to the file and once to
+ * stdout). Both write to the results file and to /dev/null in place of
+ * stdout, and the two files must be identical.
+ *
+ * ./ns3 run "scratch/kpm-bench-flow-report.cc --flows=10000"
+ */
+
+static double
+Elapsed(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void
+WriteLegacy(const FlowMonitor::FlowStatsContainer& stats,
+            const std::vector<Ipv4FlowClassifier::FiveTuple>& tuples,
+            double flowDuration,
+            const std::string& filename,
+            std::ostream& out)
+{
+    double averageFlowThroughput = 0.0;
+    double averageFlowDelay = 0.0;
+    std::ofstream outFile(filename.c_str(), std::ofstream::out | std::ofstream::trunc);
+    outFile.setf(std::ios_base::fixed);
+    for (auto i = stats.begin(); i != stats.end(); ++i)
+    {
+        const Ipv4FlowClassifier::FiveTuple& t = tuples[i->first - 1];
+        std::stringstream protoStream;
+        protoStream << (uint16_t)t.protocol;
+        if (t.protocol == 6)
+        {
+            protoStream.str("TCP");
+        }
+        if (t.protocol == 17)
+        {
+            protoStream.str("UDP");
+        }
+        outFile << "Flow " << i->first << " (" << t.sourceAddress << ":" << t.sourcePort << " -> "
+                << t.destinationAddress << ":" << t.destinationPort << ") proto "
+                << protoStream.str() << "\n";
+        outFile << "  Tx Packets: " << i->second.txPackets << "\n";
+        outFile << "  Tx Bytes:   " << i->second.txBytes << "\n";
+        outFile << "  TxOffered:  " << i->second.txBytes * 8.0 / flowDuration / 1000.0 / 1000.0
+                << " Mbps\n";
+        outFile << "  Rx Bytes:   " << i->second.rxBytes << "\n";
+        outFile << "  Lost Packets: " << i->second.txPackets - i->second.rxPackets << "\n";
+        outFile << "  Packet loss: "
+                << (((i->second.txPackets - i->second.rxPackets) * 1.0) / i->second.txPackets) * 100
+                << "%" << "\n";
+        if (i->second.rxPackets > 0)
+        {
+            averageFlowThroughput += i->second.rxBytes * 8.0 / flowDuration / 1000 / 1000;
+            averageFlowDelay += 1000 * i->second.delaySum.GetSeconds() / i->second.rxPackets;
+            outFile << "  Throughput: " << i->second.rxBytes * 8.0 / flowDuration / 1000 / 1000
+                    << " Mbps\n";
+            outFile << "  Mean delay:  "
+                    << 1000 * i->second.delaySum.GetSeconds() / i->second.rxPackets << " ms\n";
+            outFile << "  Mean jitter:  "
+                    << 1000 * i->second.jitterSum.GetSeconds() / i->second.rxPackets << " ms\n";
+        }
+        else
+        {
+            outFile << "  Throughput:  0 Mbps\n";
+            outFile << "  Mean delay:  0 ms\n";
+            outFile << "  Mean jitter: 0 ms\n";
+        }
+        outFile << "  Rx Packets: " << i->second.rxPackets << "\n";
+    }
+    outFile << "\n\n  Mean flow throughput: " << averageFlowThroughput / stats.size() << "\n";
+    outFile << "  Mean flow delay: " << averageFlowDelay / stats.size() << "\n";
+    outFile.close();
+
+    std::ifstream f(filename.c_str());
+    out << f.rdbuf();
+    out.flush();
+}
+
+int
+main(int argc, char* argv[])
+{
+    uint32_t numFlows = 10000;
+    uint32_t repetitions = 5;
+    std::string outputDir = "./kpm-out/";
+
+    CommandLine cmd(__FILE__);
+    cmd.AddValue("flows", "number of flows", numFlows);
+    cmd.AddValue("repetitions", "exports timed per path, the best is reported", repetitions);
+    cmd.AddValue("outputDir", "directory of the two results files", outputDir);
+    cmd.Parse(argc, argv);
+
+    // Flows shaped like the scenario's: UDP from the remote host to the UEs,
+    // a few without any received packet.
+    std::mt19937 rng(1);
+    std::uniform_int_distribution<uint32_t> packets(0, 200000);
+    FlowMonitor::FlowStatsContainer stats;
+    std::vector<Ipv4FlowClassifier::FiveTuple> tuples(numFlows);
+    for (uint32_t i = 0; i < numFlows; ++i)
+    {
+        Ipv4FlowClassifier::FiveTuple& t = tuples[i];
+        t.sourceAddress = Ipv4Address("1.0.0.2");
+        t.destinationAddress = Ipv4Address(0x07000002 + i);
+        t.protocol = i % 97 == 0 ? 6 : 17;
+        t.sourcePort = 49153 + i % 1000;
+        t.destinationPort = i % 2 ? 1235 : 1234;
+        FlowMonitor::FlowStats& s = stats[i + 1];
+        s.txPackets = packets(rng);
+        s.rxPackets = i % 101 == 0 ? 0 : s.txPackets - s.txPackets / 50;
+        s.txBytes = static_cast<uint64_t>(s.txPackets) * 1252;
+        s.rxBytes = static_cast<uint64_t>(s.rxPackets) * 1252;
+        s.delaySum = MicroSeconds(static_cast<uint64_t>(s.rxPackets) * (500 + i % 7000));
+        s.jitterSum = MicroSeconds(static_cast<uint64_t>(s.rxPackets) * (20 + i % 300));
+    }
+    double flowDuration = 0.99;
+
+    std::string legacyFile = outputDir + "/bench-flow-report-legacy";
+    std::string reportFile = outputDir + "/bench-flow-report";
+    std::ofstream devNull("/dev/null");
+    std::FILE* devNullFile = std::fopen("/dev/null", "wb");
+    double legacy = 1e300;
+    double report = 1e300;
+    double formatOnly = 1e300;
+    KpmFlowReport flowReport;
+    for (uint32_t r = 0; r < repetitions; ++r)
+    {
+        auto start = std::chrono::steady_clock::now();
+        WriteLegacy(stats, tuples, flowDuration, legacyFile, devNull);
+        legacy = std::min(legacy, Elapsed(start));
+
+        start = std::chrono::steady_clock::now();
+        flowReport.Begin(stats.size());
+        for (const auto& flow : stats)
+        {
+            flowReport.AddFlow(flow.first, tuples[flow.first - 1], flow.second, flowDuration);
+        }
+        flowReport.End();
+        formatOnly = std::min(formatOnly, Elapsed(start));
+        flowReport.Write(reportFile, false);
+        std::fwrite(flowReport.GetData(), 1, flowReport.GetSize(), devNullFile);
+        report = std::min(report, Elapsed(start));
+    }
+    std::fclose(devNullFile);
+
+    std::ifstream a(legacyFile.c_str());
+    std::ifstream b(reportFile.c_str());
+    std::stringstream legacyText;
+    std::stringstream reportText;
+    legacyText << a.rdbuf();
+    reportText << b.rdbuf();
+    bool identical = legacyText.str() == reportText.str();
+
+    std::cout << "flows\tbytes\tlegacy_ms\treport_ms\tformat_ms\tspeedup\tidentical\n"
+              << numFlows << "\t" << reportText.str().size() << "\t" << legacy * 1000 << "\t"
+              << report * 1000 << "\t" << formatOnly * 1000 << "\t" << legacy / report << "\t"
+              << identical << std::endl;
+    return identical ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,328 @@
+#include "ns3/core-module.h"
+#include "ns3/nr-module.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+using namespace ns3;
+
+/*
+ * Cost of the gNB MAC scheduler of one BWP per slot, in isolation: the
+ * scheduler (NrMacSchedulerTdmaRR, as the scenario uses, or any other
+ * NrMacSchedulerNs3) is driven through its SAPs by a MAC stand-in, with no
+ * PHY, RLC or channel. Every slot each UE reports bufferBytes of DL data
+ * (or only once, without --saturated), every DL assignment of the previous
+ * slot is acknowledged, and the DL trigger of the slot is timed.
+ *
+ * Prints per UE count and numerology the DL data assignments per second of
+ * wall time and the per-slot scheduling latency (mean, p50, p99, max).
+ *
+ * ./ns3 run "scratch/kpm-bench-mac-scheduler.cc --ues=10,100,1000 --numerologies=4,2"
+ */
+
+/// The gNB MAC side of the scheduler SAPs: configuration and the assignments of each slot.
+class KpmBenchMac : public NrMacSchedSapUser, public NrMacCschedSapUser
+{
+  public:
+    KpmBenchMac(Ptr<const SpectrumModel> spectrumModel, uint16_t numerology, uint32_t rbgSize)
+        : m_spectrumModel(spectrumModel),
+          m_numerology(numerology),
+          m_rbgSize(rbgSize)
+    {
+    }
+
+    void SchedConfigInd(const SchedConfigIndParameters& params) override
+    {
+        for (const auto& varTti : params.m_slotAllocInfo.m_varTtiAllocInfo)
+        {
+            const auto& dci = varTti.m_dci;
+            if (dci->m_type == DciInfoElementTdma::DATA && dci->m_format == DciInfoElementTdma::DL)
+            {
+                DlHarqInfo ack;
+                ack.m_rnti = dci->m_rnti;
+                ack.m_harqProcessId = dci->m_harqProcess;
+                ack.m_harqStatus = DlHarqInfo::ACK;
+                ack.m_numRetx = 0;
+                ack.m_bwpIndex = 0;
+                m_acks.push_back(ack);
+                m_assignments++;
+            }
+        }
+    }
+
+    Ptr<const SpectrumModel> GetSpectrumModel() const override
+    {
+        return m_spectrumModel;
+    }
+
+    uint32_t GetNumRbPerRbg() const override
+    {
+        return m_rbgSize;
+    }
+
+    uint8_t GetNumHarqProcess() const override
+    {
+        return 16;
+    }
+
+    uint16_t GetBwpId() const override
+    {
+        return 0;
+    }
+
+    uint16_t GetCellId() const override
+    {
+        return 1;
+    }
+
+    uint32_t GetSymbolsPerSlot() const override
+    {
+        return 14;
+    }
+
+    Time GetSlotPeriod() const override
+    {
+        return NanoSeconds(1000000 >> m_numerology);
+    }
+
+    void BuildRarList(SlotAllocInfo& /* slotAllocInfo */) override
+    {
+    }
+
+    void CschedCellConfigCnf(const CschedCellConfigCnfParameters& /* params */) override
+    {
+    }
+
+    void CschedUeConfigCnf(const CschedUeConfigCnfParameters& /* params */) override
+    {
+    }
+
+    void CschedLcConfigCnf(const CschedLcConfigCnfParameters& /* params */) override
+    {
+    }
+
+    void CschedLcReleaseCnf(const CschedLcReleaseCnfParameters& /* params */) override
+    {
+    }
+
+    void CschedUeReleaseCnf(const CschedUeReleaseCnfParameters& /* params */) override
+    {
+    }
+
+    void CschedUeConfigUpdateInd(const CschedUeConfigUpdateIndParameters& /* params */) override
+    {
+    }
+
+    void CschedCellConfigUpdateInd(const CschedCellConfigUpdateIndParameters& /* params */) override
+    {
+    }
+
+    /// The acknowledgements of the last slot's assignments, cleared.
+    std::vector<DlHarqInfo> TakeAcks()
+    {
+        std::vector<DlHarqInfo> acks;
+        acks.swap(m_acks);
+        return acks;
+    }
+
+    uint64_t GetAssignments() const
+    {
+        return m_assignments;
+    }
+
+  private:
+    Ptr<const SpectrumModel> m_spectrumModel;
+    uint16_t m_numerology;
+    uint32_t m_rbgSize;
+    std::vector<DlHarqInfo> m_acks;
+    uint64_t m_assignments{0};
+};
+
+struct KpmBenchResult
+{
+    uint64_t assignments{0};
+    double wall{0.0};              //!< s, over all the DL triggers
+    std::vector<double> slotTimes; //!< s, per slot
+};
+
+static KpmBenchResult
+RunScheduler(const std::string& schedulerType,
+             uint32_t numUes,
+             uint16_t numerology,
+             double bandwidth,
+             uint32_t rbgSize,
+             uint32_t numBeams,
+             uint8_t cqi,
+             uint32_t bufferBytes,
+             bool saturated,
+             uint32_t numSlots)
+{
+    double subcarrierSpacing = 15e3 * (1 << numerology);
+    uint32_t numRbs = static_cast<uint32_t>(bandwidth / (12 * subcarrierSpacing));
+    Ptr<const SpectrumModel> spectrumModel =
+        NrSpectrumValueHelper::GetSpectrumModel(numRbs, 2.8e9, subcarrierSpacing);
+
+    ObjectFactory factory;
+    factory.SetTypeId(schedulerType);
+    Ptr<NrMacSchedulerNs3> scheduler = DynamicCast<NrMacSchedulerNs3>(factory.Create());
+    NS_ABORT_MSG_IF(!scheduler, schedulerType << " is not an NrMacSchedulerNs3");
+    KpmBenchMac mac(spectrumModel, numerology, rbgSize);
+    scheduler->SetMacSchedSapUser(&mac);
+    scheduler->SetMacCschedSapUser(&mac);
+    scheduler->InstallDlAmc(CreateObject<NrAmc>());
+    scheduler->InstallUlAmc(CreateObject<NrAmc>());
+    NrMacSchedSapProvider* sched = scheduler->GetMacSchedSapProvider();
+    NrMacCschedSapProvider* csched = scheduler->GetMacCschedSapProvider();
+
+    NrMacCschedSapProvider::CschedCellConfigReqParameters cell;
+    cell.m_dlBandwidth = numRbs;
+    cell.m_ulBandwidth = numRbs;
+    csched->CschedCellConfigReq(cell);
+
+    NrMacSchedSapProvider::SchedDlCqiInfoReqParameters cqis;
+    for (uint16_t rnti = 1; rnti <= numUes; ++rnti)
+    {
+        NrMacCschedSapProvider::CschedUeConfigReqParameters ue;
+        ue.m_rnti = rnti;
+        ue.m_beamId = BeamId(rnti % numBeams, 0.0);
+        csched->CschedUeConfigReq(ue);
+
+        LogicalChannelConfigListElement_s lc;
+        lc.m_logicalChannelIdentity = 4;
+        lc.m_logicalChannelGroup = 2;
+        lc.m_direction = LogicalChannelConfigListElement_s::DIR_BOTH;
+        lc.m_qosBearerType = LogicalChannelConfigListElement_s::QBT_NON_GBR;
+        lc.m_qci = NrEpsBearer::NGBR_LOW_LAT_EMBB;
+        NrMacCschedSapProvider::CschedLcConfigReqParameters lcConfig;
+        lcConfig.m_rnti = rnti;
+        lcConfig.m_reconfigureFlag = false;
+        lcConfig.m_logicalChannelConfigList.push_back(lc);
+        csched->CschedLcConfigReq(lcConfig);
+
+        DlCqiInfo info;
+        info.m_rnti = rnti;
+        info.m_cqiType = DlCqiInfo::WB;
+        info.m_wbCqi = cqi;
+        cqis.m_cqiList.push_back(info);
+    }
+    SfnSf slot(0, 0, 0, numerology);
+    cqis.m_sfnsf = slot;
+    sched->SchedDlCqiInfoReq(cqis);
+
+    KpmBenchResult result;
+    result.slotTimes.reserve(numSlots);
+    for (uint32_t i = 0; i < numSlots; ++i)
+    {
+        if (saturated || i == 0)
+        {
+            for (uint16_t rnti = 1; rnti <= numUes; ++rnti)
+            {
+                NrMacSchedSapProvider::SchedDlRlcBufferReqParameters buffer;
+                buffer.m_rnti = rnti;
+                buffer.m_logicalChannelIdentity = 4;
+                buffer.m_rlcTransmissionQueueSize = bufferBytes;
+                buffer.m_rlcTransmissionQueueHolDelay = 0;
+                buffer.m_rlcRetransmissionQueueSize = 0;
+                buffer.m_rlcRetransmissionHolDelay = 0;
+                buffer.m_rlcStatusPduSize = 0;
+                sched->SchedDlRlcBufferReq(buffer);
+            }
+        }
+        NrMacSchedSapProvider::SchedDlFeedbackInfoReqParameters feedback;
+        feedback.m_dlHarqInfoList = mac.TakeAcks();
+        if (!feedback.m_dlHarqInfoList.empty())
+        {
+            sched->SchedDlFeedbackInfoReq(feedback);
+        }
+
+        NrMacSchedSapProvider::SchedDlTriggerReqParameters trigger;
+        trigger.m_snfSf = slot;
+        trigger.m_slotType = LteNrTddSlotType::DL;
+        auto start = std::chrono::steady_clock::now();
+        sched->SchedDlTriggerReq(trigger);
+        double elapsed =
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        result.slotTimes.push_back(elapsed);
+        result.wall += elapsed;
+        slot.Add(1);
+    }
+    result.assignments = mac.GetAssignments();
+    return result;
+}
+
+static double
+Percentile(std::vector<double> values, double p)
+{
+    std::size_t k = std::min(values.size() - 1, static_cast<std::size_t>(p * values.size()));
+    std::nth_element(values.begin(), values.begin() + k, values.end());
+    return values[k];
+}
+
+int
+main(int argc, char* argv[])
+{
+    std::string schedulerType = "ns3::NrMacSchedulerTdmaRR";
+    std::string ues = "10,100,1000";
+    std::string numerologies = "4,2";
+    double bandwidth = 50e6;
+    uint32_t rbgSize = 1;
+    uint32_t numBeams = 1;
+    uint32_t cqi = 15;
+    uint32_t bufferBytes = 10000;
+    bool saturated = true;
+    uint32_t numSlots = 10000;
+
+    CommandLine cmd(__FILE__);
+    cmd.AddValue("schedulerType", "TypeId of the NrMacSchedulerNs3 measured", schedulerType);
+    cmd.AddValue("ues", "comma separated list of UE counts", ues);
+    cmd.AddValue("numerologies", "comma separated list of BWP numerologies", numerologies);
+    cmd.AddValue("bandwidth", "BWP bandwidth (Hz)", bandwidth);
+    cmd.AddValue("rbgSize", "int RBs per RBG", rbgSize);
+    cmd.AddValue("beams", "int beams the UEs are spread over", numBeams);
+    cmd.AddValue("cqi", "int wideband CQI of every UE", cqi);
+    cmd.AddValue("bufferBytes", "int DL RLC buffer reported per UE", bufferBytes);
+    cmd.AddValue("saturated", "report the buffer every slot, not only in the first", saturated);
+    cmd.AddValue("slots", "int slots scheduled per run", numSlots);
+    cmd.Parse(argc, argv);
+    NS_ABORT_MSG_IF(numBeams == 0 || numSlots == 0, "Need at least one beam and one slot");
+
+    std::cout << "numerology\tues\tassignments\tassignments/s\tslot_mean_us\tslot_p50_us"
+                 "\tslot_p99_us\tslot_max_us\n";
+
+    std::stringstream numerologyList(numerologies);
+    std::string numerologyItem;
+    while (std::getline(numerologyList, numerologyItem, ','))
+    {
+        uint16_t numerology = std::stoul(numerologyItem);
+        std::stringstream ueList(ues);
+        std::string ueItem;
+        while (std::getline(ueList, ueItem, ','))
+        {
+            uint32_t numUes = std::stoul(ueItem);
+            NS_ABORT_MSG_IF(numUes == 0 || numUes > 65000, "Invalid UE count " << numUes);
+            KpmBenchResult result = RunScheduler(schedulerType,
+                                                 numUes,
+                                                 numerology,
+                                                 bandwidth,
+                                                 rbgSize,
+                                                 numBeams,
+                                                 cqi,
+                                                 bufferBytes,
+                                                 saturated,
+                                                 numSlots);
+            std::cout << numerology << "\t" << numUes << "\t" << result.assignments << "\t"
+                      << result.assignments / result.wall << "\t"
+                      << result.wall / numSlots * 1e6 << "\t"
+                      << Percentile(result.slotTimes, 0.5) * 1e6 << "\t"
+                      << Percentile(result.slotTimes, 0.99) * 1e6 << "\t"
+                      << *std::max_element(result.slotTimes.begin(), result.slotTimes.end()) *
+                             1e6
+                      << std::endl;
+        }
+    }
+    return EXIT_SUCCESS;
+}
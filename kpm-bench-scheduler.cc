@@ -0,0 +1,118 @@
+#include "kpm-scheduler.h"
+
+#include "ns3/core-module.h"
+
+#include <chrono>
+#include <iostream>
+#include <sstream>
+
+using namespace ns3;
+
+/*
+ * Events/s of the ns-3 schedulers under the scenario's periodic event
+ * pattern: every gNB and UE runs NR slots on two BWPs (numerology 4 and 2)
+ * with a few symbol-level events per slot, and every UE receives UDP
+ * packets every 1/lambda.
+ *
+ * ./ns3 run "scratch/kpm-bench-scheduler.cc --gnbs=2,20,200"
+ */
+
+static void
+Noop()
+{
+}
+
+/// A periodic source: one event per period plus followUps events inside it.
+static void
+Fire(Time period, uint32_t followUps, Time spacing)
+{
+    for (uint32_t i = 1; i <= followUps; ++i)
+    {
+        Simulator::Schedule(spacing * i, &Noop);
+    }
+    Simulator::Schedule(period, &Fire, period, followUps, spacing);
+}
+
+static void
+StartSource(Ptr<UniformRandomVariable> phase, Time period, uint32_t followUps, Time spacing)
+{
+    Simulator::Schedule(TimeStep(phase->GetInteger(0, period.GetTimeStep() - 1)),
+                        &Fire,
+                        period,
+                        followUps,
+                        spacing);
+}
+
+int
+main(int argc, char* argv[])
+{
+    std::string schedulers = "map,heap,calendar,wheel";
+    std::string gnbs = "2,20,200";
+    uint32_t uesPerGnb = 5;
+    uint32_t lambda = 10000;
+    double duration = 0.05; // s
+
+    CommandLine cmd(__FILE__);
+    cmd.AddValue("schedulers", "comma separated list of map|heap|list|calendar|wheel", schedulers);
+    cmd.AddValue("gnbs", "comma separated list of gNB counts", gnbs);
+    cmd.AddValue("uesPerGnb", "UEs per gNB", uesPerGnb);
+    cmd.AddValue("lambda", "int packets/sec per UE", lambda);
+    cmd.AddValue("duration", "simulated seconds per run", duration);
+    cmd.Parse(argc, argv);
+
+    const uint16_t numerologies[] = {4, 2};
+    Time minPeriod = Seconds(1.0 / lambda);
+    Time maxPeriod = Seconds(1.0 / lambda);
+    for (uint16_t numerology : numerologies)
+    {
+        Time slot = NanoSeconds(1000000 >> numerology);
+        minPeriod = std::min(minPeriod, slot);
+        maxPeriod = std::max(maxPeriod, slot);
+    }
+
+    std::cout << "scheduler\tgnbs\tevents\twall (s)\tevents/s\n";
+
+    std::stringstream gnbList(gnbs);
+    std::string gnbItem;
+    while (std::getline(gnbList, gnbItem, ','))
+    {
+        uint32_t numGnb = std::stoul(gnbItem);
+        std::stringstream schedulerList(schedulers);
+        std::string scheduler;
+        while (std::getline(schedulerList, scheduler, ','))
+        {
+            RngSeedManager::SetRun(1);
+            Simulator::SetScheduler(KpmSchedulerFactory(scheduler, minPeriod, maxPeriod));
+            Ptr<UniformRandomVariable> phase = CreateObject<UniformRandomVariable>();
+
+            for (uint32_t i = 0; i < numGnb * (1 + uesPerGnb); ++i)
+            {
+                for (uint16_t numerology : numerologies)
+                {
+                    Time slot = NanoSeconds(1000000 >> numerology);
+                    // Slot start plus control, data and HARQ feedback symbols.
+                    StartSource(phase, slot, 3, slot / 14);
+                }
+            }
+            for (uint32_t i = 0; i < numGnb * uesPerGnb; ++i)
+            {
+                // One send and one delivery per packet, for each of the two flows.
+                StartSource(phase, Seconds(1.0 / lambda), 1, MicroSeconds(1));
+                StartSource(phase, Seconds(1.0 / lambda), 1, MicroSeconds(1));
+            }
+
+            Simulator::Stop(Seconds(duration));
+            auto start = std::chrono::steady_clock::now();
+            Simulator::Run();
+            double wall =
+                std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            uint64_t events = Simulator::GetEventCount();
+            Simulator::Destroy();
+
+            std::cout << scheduler << "\t" << numGnb << "\t" << events << "\t" << wall << "\t"
+                      << events / wall << "\n";
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
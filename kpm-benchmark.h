@@ -0,0 +1,91 @@
+#ifndef KPM_BENCHMARK_H
+#define KPM_BENCHMARK_H
+
+#include "kpm-memory.h"
+
+#include "ns3/core-module.h"
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace ns3
+{
+
+/**
+ * Performance and KPM record of one run, for run_benchmarks.sh.
+ *
+ * The wall time counts from construction (so scenario setup is included),
+ * the event rate only over the main Simulator::Run. The report is a
+ * "name value" line per metric, which the suite compares against
+ * kpm-benchmarks.golden.
+ */
+class KpmBenchmarkReport
+{
+  public:
+    KpmBenchmarkReport()
+        : m_start(std::chrono::steady_clock::now())
+    {
+    }
+
+    /// Call right before the main Simulator::Run.
+    void StartRun()
+    {
+        m_runStart = std::chrono::steady_clock::now();
+        m_runEvents = Simulator::GetEventCount();
+    }
+
+    /// Call right after the main Simulator::Run.
+    void EndRun()
+    {
+        m_runTime = Elapsed(m_runStart);
+        m_runEvents = Simulator::GetEventCount() - m_runEvents;
+    }
+
+    /// A scenario specific metric, written after the common ones.
+    void AddMetric(const std::string& name, double value)
+    {
+        m_metrics.emplace_back(name, value);
+    }
+
+    bool Write(const std::string& filename, double meanFlowThroughput, double meanFlowDelay) const
+    {
+        std::FILE* file = std::fopen(filename.c_str(), "w");
+        if (!file)
+        {
+            return false;
+        }
+        std::fprintf(file, "wallTime %.6f\n", Elapsed(m_start));
+        std::fprintf(file, "runTime %.6f\n", m_runTime);
+        std::fprintf(file, "events %llu\n", static_cast<unsigned long long>(m_runEvents));
+        std::fprintf(file, "eventsPerSecond %.1f\n", m_runEvents / m_runTime);
+        std::fprintf(file,
+                     "peakRss %llu\n",
+                     static_cast<unsigned long long>(KpmMemoryReport::GetPeakRss()));
+        std::fprintf(file, "meanFlowThroughput %.6f\n", meanFlowThroughput);
+        std::fprintf(file, "meanFlowDelay %.6f\n", meanFlowDelay);
+        for (const auto& metric : m_metrics)
+        {
+            std::fprintf(file, "%s %.6f\n", metric.first.c_str(), metric.second);
+        }
+        return std::fclose(file) == 0;
+    }
+
+  private:
+    static double Elapsed(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    std::chrono::steady_clock::time_point m_start;
+    std::chrono::steady_clock::time_point m_runStart;
+    double m_runTime{0.0};
+    uint64_t m_runEvents{0};
+    std::vector<std::pair<std::string, double>> m_metrics;
+};
+
+} // namespace ns3
+
+#endif // KPM_BENCHMARK_H
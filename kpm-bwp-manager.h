@@ -0,0 +1,236 @@
+#ifndef KPM_BWP_MANAGER_H
+#define KPM_BWP_MANAGER_H
+
+#include "ns3/core-module.h"
+#include "ns3/nr-module.h"
+
+#include <map>
+#include <utility>
+#include <vector>
+
+namespace ns3
+{
+
+/**
+ * Measured PRB load of every gNB and BWP, and the BWP each QoS class of a
+ * gNB is currently routed to.
+ *
+ * Every period the utilization of each BWP over the period (resource
+ * elements used for data over those available, from the SlotDataStats
+ * trace) is taken. A QoS class on its home BWP (the static mapping) moves
+ * to the least loaded other BWP when home is above the high watermark and
+ * that BWP below the low one, provided the class latency target allows it:
+ * latencySlots slots of the BWP must fit in the packet delay budget of the
+ * QCI. It goes back home once home falls below the low watermark or its
+ * new BWP climbs above the high one. Between the watermarks nothing moves,
+ * so a route does not flap.
+ */
+class KpmBwpLoad : public Object
+{
+  public:
+    static TypeId GetTypeId()
+    {
+        static TypeId tid =
+            TypeId("ns3::KpmBwpLoad").SetParent<Object>().AddConstructor<KpmBwpLoad>();
+        return tid;
+    }
+
+    /// Load watermarks (utilization, 0 to 1) and the latency target in slots.
+    void SetThresholds(double low, double high, uint32_t latencySlots)
+    {
+        NS_ABORT_MSG_IF(low < 0 || low > high || high > 1, "Invalid BWP load watermarks");
+        m_low = low;
+        m_high = high;
+        m_latencySlots = latencySlots;
+    }
+
+    /**
+     * Measure the BWPs of the gNBs, whose index in gnbs is the "Gnb"
+     * attribute of their KpmLoadBwpManagerAlgorithm, and update the routes
+     * every period from start.
+     */
+    void Install(const NetDeviceContainer& gnbs, Time start, Time period)
+    {
+        m_period = period;
+        m_gnbs.resize(gnbs.GetN());
+        for (uint32_t i = 0; i < gnbs.GetN(); ++i)
+        {
+            Ptr<NrGnbNetDevice> gnb = DynamicCast<NrGnbNetDevice>(gnbs.Get(i));
+            for (uint32_t bwpId = 0; bwpId < gnb->GetCcMapSize(); ++bwpId)
+            {
+                // Every BWP PHY has its own cell ID, the one SlotDataStats reports.
+                m_cells[gnb->GetPhy(bwpId)->GetCellId()] = i;
+                Bwp bwp;
+                bwp.slotPeriod = gnb->GetPhy(bwpId)->GetSlotPeriod();
+                m_gnbs[i].bwps.push_back(bwp);
+                gnb->GetPhy(bwpId)->TraceConnectWithoutContext(
+                    "SlotDataStats",
+                    MakeCallback(&KpmBwpLoad::SlotDataStats, this));
+            }
+        }
+        Simulator::Schedule(start, &KpmBwpLoad::Update, this);
+    }
+
+    /// The BWP of qci on gnb, whose home BWP is home.
+    uint8_t Route(uint32_t gnb, NrEpsBearer::Qci qci, uint8_t home)
+    {
+        if (gnb >= m_gnbs.size())
+        {
+            return home;
+        }
+        auto route = m_gnbs[gnb].routes.emplace(qci, std::make_pair(home, home)).first;
+        return route->second.second;
+    }
+
+    /// Utilization of bwpId of gnb over the last period.
+    double GetLoad(uint32_t gnb, uint8_t bwpId) const
+    {
+        return m_gnbs.at(gnb).bwps.at(bwpId).load;
+    }
+
+    /// Routes moved off or back to their home BWP so far.
+    uint64_t GetMoves() const
+    {
+        return m_moves;
+    }
+
+  private:
+    struct Bwp
+    {
+        Time slotPeriod;
+        uint64_t used{0};      //!< resource elements used by data in the period
+        uint64_t available{0}; //!< resource elements available in the period
+        double load{0.0};      //!< utilization over the last period
+    };
+
+    struct Gnb
+    {
+        std::vector<Bwp> bwps;
+        std::map<NrEpsBearer::Qci, std::pair<uint8_t, uint8_t>> routes; //!< QCI -> home, current
+    };
+
+    void SlotDataStats(const SfnSf& /* sfnSf */,
+                       uint32_t /* scheduledUe */,
+                       uint32_t usedReg,
+                       uint32_t /* usedSym */,
+                       uint32_t availableRb,
+                       uint32_t availableSym,
+                       uint16_t bwpId,
+                       uint16_t cellId)
+    {
+        auto cell = m_cells.find(cellId);
+        if (cell == m_cells.end() || bwpId >= m_gnbs[cell->second].bwps.size())
+        {
+            return;
+        }
+        Bwp& bwp = m_gnbs[cell->second].bwps[bwpId];
+        bwp.used += usedReg;
+        bwp.available += static_cast<uint64_t>(availableRb) * availableSym;
+    }
+
+    bool MeetsLatency(NrEpsBearer::Qci qci, const Bwp& bwp) const
+    {
+        double budget = NrEpsBearer(qci).GetPacketDelayBudgetMs();
+        return bwp.slotPeriod.GetSeconds() * 1000 * m_latencySlots <= budget;
+    }
+
+    void Update()
+    {
+        for (auto& gnb : m_gnbs)
+        {
+            for (auto& bwp : gnb.bwps)
+            {
+                bwp.load = bwp.available == 0 ? 0.0 : static_cast<double>(bwp.used) / bwp.available;
+                bwp.used = 0;
+                bwp.available = 0;
+            }
+            for (auto& route : gnb.routes)
+            {
+                uint8_t home = route.second.first;
+                uint8_t& current = route.second.second;
+                if (current != home)
+                {
+                    if (gnb.bwps[home].load < m_low || gnb.bwps[current].load > m_high)
+                    {
+                        current = home;
+                        m_moves++;
+                    }
+                    continue;
+                }
+                if (gnb.bwps[home].load <= m_high)
+                {
+                    continue;
+                }
+                for (uint8_t b = 0; b < gnb.bwps.size(); ++b)
+                {
+                    if (b != home && gnb.bwps[b].load < m_low &&
+                        gnb.bwps[b].load < gnb.bwps[current].load &&
+                        MeetsLatency(route.first, gnb.bwps[b]))
+                    {
+                        current = b;
+                    }
+                }
+                if (current != home)
+                {
+                    m_moves++;
+                }
+            }
+        }
+        Simulator::Schedule(m_period, &KpmBwpLoad::Update, this);
+    }
+
+    double m_low{0.5};
+    double m_high{0.8};
+    uint32_t m_latencySlots{20};
+    Time m_period{MilliSeconds(50)};
+    std::vector<Gnb> m_gnbs;
+    std::map<uint16_t, uint32_t> m_cells; //!< cell ID of a BWP -> gNB index
+    uint64_t m_moves{0};
+};
+
+/**
+ * gNB BWP manager algorithm that routes each QoS class to its static BWP
+ * (the attributes of BwpManagerAlgorithmStatic) unless the shared
+ * KpmBwpLoad moved it to a less loaded BWP of this gNB. The BWP manager asks
+ * on every buffer status report, so a move applies from the next report of
+ * the bearer on; the BWP it left schedules at most what it was last told.
+ */
+class KpmLoadBwpManagerAlgorithm : public BwpManagerAlgorithmStatic
+{
+  public:
+    static TypeId GetTypeId()
+    {
+        static TypeId tid =
+            TypeId("ns3::KpmLoadBwpManagerAlgorithm")
+                .SetParent<BwpManagerAlgorithmStatic>()
+                .AddConstructor<KpmLoadBwpManagerAlgorithm>()
+                .AddAttribute("Load",
+                              "Measured load and routes shared by the gNBs",
+                              PointerValue(),
+                              MakePointerAccessor(&KpmLoadBwpManagerAlgorithm::m_load),
+                              MakePointerChecker<KpmBwpLoad>())
+                .AddAttribute("Gnb",
+                              "Index of the gNB in the KpmBwpLoad",
+                              UintegerValue(0),
+                              MakeUintegerAccessor(&KpmLoadBwpManagerAlgorithm::m_gnb),
+                              MakeUintegerChecker<uint32_t>());
+        return tid;
+    }
+
+    uint8_t GetBwpForEpsBearer(const NrEpsBearer::Qci& v) const override
+    {
+        uint8_t home = BwpManagerAlgorithmStatic::GetBwpForEpsBearer(v);
+        return m_load ? m_load->Route(m_gnb, v, home) : home;
+    }
+
+  private:
+    Ptr<KpmBwpLoad> m_load;
+    uint32_t m_gnb{0};
+};
+
+NS_OBJECT_ENSURE_REGISTERED(KpmBwpLoad);
+NS_OBJECT_ENSURE_REGISTERED(KpmLoadBwpManagerAlgorithm);
+
+} // namespace ns3
+
+#endif // KPM_BWP_MANAGER_H
@@ -0,0 +1,271 @@
+#ifndef KPM_CAPACITY_H
+#define KPM_CAPACITY_H
+
+#include "ns3/applications-module.h"
+#include "ns3/core-module.h"
+#include "ns3/flow-monitor-module.h"
+
+#include <algorithm>
+#include <cmath>
+#include <ostream>
+#include <vector>
+
+namespace ns3
+{
+
+/// Result of one probe of a capacity search.
+struct KpmCapacityProbe
+{
+    double lambda{0.0};     //!< packets/s per client of the searched bearer
+    double throughput{0.0}; //!< mean flow throughput of the bearer, Mbps
+    double delay{0.0};      //!< mean packet delay of the bearer, ms
+    double loss{0.0};       //!< packet loss ratio of the bearer
+    bool drained{false};    //!< the queues of the previous probe emptied before it
+    bool feasible{false};   //!< drained, and delay and loss within the SLA
+};
+
+/**
+ * Search for the largest packet rate of one bearer that meets a delay and
+ * loss SLA, on the already built and attached scenario.
+ *
+ * Every probe continues the same simulation: the bearer's clients are set
+ * to the lowest rate of the search until none of the bearer's packets is in
+ * flight (tx == rx + lost), so the queues left by an overloaded probe are
+ * empty, then to the probed rate for a settle period, and the bearer's flows
+ * are measured over the next window from FlowMonitor snapshots. A probe
+ * whose drain times out measures an inherited backlog: it is infeasible.
+ * The other bearers keep their traffic. The bounds are probed first;
+ * between them the search bisects in the log domain, since the rates span
+ * orders of magnitude, until the bracket is within the relative tolerance
+ * or the probes run out.
+ */
+class KpmCapacitySearch
+{
+  public:
+    /**
+     * clients are all the client applications; those whose RemotePort is
+     * port (the bearer's) are driven, and the flows to port are measured.
+     */
+    KpmCapacitySearch(Ptr<FlowMonitor> monitor,
+                      Ptr<Ipv4FlowClassifier> classifier,
+                      const ApplicationContainer& clients,
+                      uint16_t port)
+        : m_monitor(monitor),
+          m_classifier(classifier),
+          m_port(port)
+    {
+        for (uint32_t i = 0; i < clients.GetN(); ++i)
+        {
+            UintegerValue remotePort;
+            clients.Get(i)->GetAttribute("RemotePort", remotePort);
+            if (remotePort.Get() == port)
+            {
+                m_clients.Add(clients.Get(i));
+            }
+        }
+    }
+
+    /// Largest mean delay (ms) and loss ratio that meet the SLA.
+    void SetSla(double maxDelay, double maxLoss)
+    {
+        m_maxDelay = maxDelay;
+        m_maxLoss = maxLoss;
+    }
+
+    void SetBounds(double lambdaMin, double lambdaMax)
+    {
+        m_lambdaMin = lambdaMin;
+        m_lambdaMax = lambdaMax;
+    }
+
+    /// drainTimeout bounds the drain before each probe, checked every 10 ms.
+    void SetProbeTimes(Time drainTimeout, Time settle, Time measure)
+    {
+        m_drainTimeout = drainTimeout;
+        m_settle = settle;
+        m_measure = measure;
+    }
+
+    /// Stop once hi / lo - 1 is below tolerance, or after maxProbes probes.
+    void SetStopCriteria(double tolerance, uint32_t maxProbes)
+    {
+        m_tolerance = tolerance;
+        m_maxProbes = maxProbes;
+    }
+
+    /**
+     * Run the search; the simulation must be past attach and bearer setup.
+     * Returns the largest feasible rate found, 0 if even the lower bound
+     * violates the SLA.
+     */
+    double Run()
+    {
+        NS_ABORT_MSG_IF(m_clients.GetN() == 0, "No client sends to port " << m_port);
+        NS_ABORT_MSG_IF(m_lambdaMin <= 0 || m_lambdaMax < m_lambdaMin, "Invalid search bounds");
+        m_probes.clear();
+        if (!Probe(m_lambdaMin).feasible)
+        {
+            return 0.0;
+        }
+        if (Probe(m_lambdaMax).feasible)
+        {
+            return m_lambdaMax;
+        }
+        double lo = m_lambdaMin;
+        double hi = m_lambdaMax;
+        while (hi / lo - 1 > m_tolerance && m_probes.size() < m_maxProbes)
+        {
+            double mid = std::sqrt(lo * hi);
+            if (Probe(mid).feasible)
+            {
+                lo = mid;
+            }
+            else
+            {
+                hi = mid;
+            }
+        }
+        return lo;
+    }
+
+    /// Probes in the order they were run.
+    const std::vector<KpmCapacityProbe>& GetProbes() const
+    {
+        return m_probes;
+    }
+
+    /// The capacity curve: one line per probe, by increasing rate.
+    void Write(std::ostream& os) const
+    {
+        std::vector<KpmCapacityProbe> probes = m_probes;
+        std::sort(probes.begin(), probes.end(), [](const auto& a, const auto& b) {
+            return a.lambda < b.lambda;
+        });
+        os << "# lambda\tthroughput\tdelay\tloss\tdrained\tfeasible\n";
+        for (const auto& probe : probes)
+        {
+            os << probe.lambda << "\t" << probe.throughput << "\t" << probe.delay << "\t"
+               << probe.loss << "\t" << probe.drained << "\t" << probe.feasible << "\n";
+        }
+    }
+
+  private:
+    void SetLambda(double lambda)
+    {
+        for (uint32_t i = 0; i < m_clients.GetN(); ++i)
+        {
+            m_clients.Get(i)->SetAttribute("Interval", TimeValue(Seconds(1.0 / lambda)));
+        }
+    }
+
+    /// Simulate for duration from now.
+    static void Advance(Time duration)
+    {
+        Simulator::Stop(duration);
+        Simulator::Run();
+    }
+
+    FlowMonitor::FlowStatsContainer Snapshot() const
+    {
+        m_monitor->CheckForLostPackets();
+        return m_monitor->GetFlowStats();
+    }
+
+    /// Whether none of the bearer's packets is in flight.
+    bool Drained() const
+    {
+        for (const auto& flow : Snapshot())
+        {
+            const FlowMonitor::FlowStats& s = flow.second;
+            if (m_classifier->FindFlow(flow.first).destinationPort == m_port &&
+                s.txPackets > s.rxPackets + s.lostPackets)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /// Run at the lowest rate until the bearer drained, at most m_drainTimeout.
+    bool Drain()
+    {
+        SetLambda(m_lambdaMin);
+        for (Time elapsed; elapsed < m_drainTimeout; elapsed += m_drainStep)
+        {
+            Advance(m_drainStep);
+            if (Drained())
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    KpmCapacityProbe Probe(double lambda)
+    {
+        bool drained = Drain();
+        SetLambda(lambda);
+        Advance(m_settle);
+        FlowMonitor::FlowStatsContainer before = Snapshot();
+        Advance(m_measure);
+        FlowMonitor::FlowStatsContainer after = Snapshot();
+
+        KpmCapacityProbe probe;
+        probe.lambda = lambda;
+        probe.drained = drained;
+        uint64_t txPackets = 0;
+        uint64_t rxPackets = 0;
+        uint32_t flows = 0;
+        Time delaySum;
+        for (const auto& flow : after)
+        {
+            if (m_classifier->FindFlow(flow.first).destinationPort != m_port)
+            {
+                continue;
+            }
+            FlowMonitor::FlowStats window = flow.second;
+            auto it = before.find(flow.first);
+            if (it != before.end())
+            {
+                window.txPackets -= it->second.txPackets;
+                window.rxPackets -= it->second.rxPackets;
+                window.rxBytes -= it->second.rxBytes;
+                window.delaySum -= it->second.delaySum;
+            }
+            flows++;
+            txPackets += window.txPackets;
+            rxPackets += window.rxPackets;
+            delaySum += window.delaySum;
+            probe.throughput += window.rxBytes * 8.0 / m_measure.GetSeconds() / 1000 / 1000;
+        }
+        probe.throughput = flows > 0 ? probe.throughput / flows : 0.0;
+        probe.delay = rxPackets > 0 ? 1000 * delaySum.GetSeconds() / rxPackets : INFINITY;
+        // Packets in flight at the window edges can make rx exceed tx slightly.
+        probe.loss = txPackets > 0 ? std::max(0.0, 1.0 - static_cast<double>(rxPackets) / txPackets)
+                                   : 1.0;
+        probe.feasible =
+            drained && rxPackets > 0 && probe.delay <= m_maxDelay && probe.loss <= m_maxLoss;
+        m_probes.push_back(probe);
+        return probe;
+    }
+
+    Ptr<FlowMonitor> m_monitor;
+    Ptr<Ipv4FlowClassifier> m_classifier;
+    ApplicationContainer m_clients;
+    uint16_t m_port;
+    double m_maxDelay{150.0};
+    double m_maxLoss{1e-3};
+    double m_lambdaMin{100.0};
+    double m_lambdaMax{100000.0};
+    Time m_drainStep{MilliSeconds(10)};
+    Time m_drainTimeout{Seconds(5)};
+    Time m_settle{MilliSeconds(50)};
+    Time m_measure{MilliSeconds(200)};
+    double m_tolerance{0.05};
+    uint32_t m_maxProbes{16};
+    std::vector<KpmCapacityProbe> m_probes;
+};
+
+} // namespace ns3
+
+#endif // KPM_CAPACITY_H
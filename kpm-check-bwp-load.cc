@@ -0,0 +1,134 @@
+#include "kpm-bwp-manager.h"
+
+#include "ns3/applications-module.h"
+#include "ns3/core-module.h"
+#include "ns3/internet-module.h"
+#include "ns3/mobility-module.h"
+#include "ns3/nr-module.h"
+#include "ns3/point-to-point-module.h"
+
+#include <cstdlib>
+#include <iostream>
+
+using namespace ns3;
+
+/*
+ * Check of the BWP load KpmBwpLoad measures on a gNB with two BWPs, each
+ * PHY with its own cell ID: the default bearer of one UE is mapped to BWP 1
+ * and loaded with downlink UDP traffic, BWP 0 carries none. Fails unless
+ * the load of BWP 1 is above 0 and above the load of BWP 0 at the end.
+ *
+ * ./ns3 run scratch/kpm-check-bwp-load.cc
+ */
+int
+main(int argc, char* argv[])
+{
+    Time simTime = MilliSeconds(400);
+    Time appStartTime = MilliSeconds(50);
+
+    CommandLine cmd(__FILE__);
+    cmd.AddValue("simTime", "end of the run", simTime);
+    cmd.Parse(argc, argv);
+
+    Config::SetDefault("ns3::NrRlcUm::MaxTxBufferSize", UintegerValue(999999999));
+
+    NodeContainer gnbNodes;
+    gnbNodes.Create(1);
+    NodeContainer ueNodes;
+    ueNodes.Create(1);
+    MobilityHelper mobility;
+    mobility.SetMobilityModel("ns3::ConstantPositionMobilityModel");
+    Ptr<ListPositionAllocator> positions = CreateObject<ListPositionAllocator>();
+    positions->Add(Vector(0.0, 0.0, 10.0));
+    positions->Add(Vector(10.0, 0.0, 1.5));
+    mobility.SetPositionAllocator(positions);
+    mobility.Install(gnbNodes);
+    mobility.Install(ueNodes);
+
+    Ptr<NrPointToPointEpcHelper> nrEpcHelper = CreateObject<NrPointToPointEpcHelper>();
+    Ptr<IdealBeamformingHelper> idealBeamformingHelper = CreateObject<IdealBeamformingHelper>();
+    Ptr<NrHelper> nrHelper = CreateObject<NrHelper>();
+    nrHelper->SetBeamformingHelper(idealBeamformingHelper);
+    nrHelper->SetEpcHelper(nrEpcHelper);
+    idealBeamformingHelper->SetAttribute("BeamformingMethod",
+                                         TypeIdValue(DirectPathBeamforming::GetTypeId()));
+
+    // Two bands of one CC and one BWP each, as in the scenario.
+    CcBwpCreator ccBwpCreator;
+    CcBwpCreator::SimpleOperationBandConf bandConf1(2.8e9,
+                                                    50e6,
+                                                    1,
+                                                    BandwidthPartInfo::UMi_StreetCanyon);
+    CcBwpCreator::SimpleOperationBandConf bandConf2(2.82e9,
+                                                    50e6,
+                                                    1,
+                                                    BandwidthPartInfo::UMi_StreetCanyon);
+    OperationBandInfo band1 = ccBwpCreator.CreateOperationBandContiguousCc(bandConf1);
+    OperationBandInfo band2 = ccBwpCreator.CreateOperationBandContiguousCc(bandConf2);
+    nrHelper->InitializeOperationBand(&band1);
+    nrHelper->InitializeOperationBand(&band2);
+    BandwidthPartInfoPtrVector allBwps = CcBwpCreator::GetAllBwps({band1, band2});
+
+    nrHelper->SetGnbBwpManagerAlgorithmAttribute("NGBR_VIDEO_TCP_DEFAULT", UintegerValue(1));
+    nrHelper->SetUeBwpManagerAlgorithmAttribute("NGBR_VIDEO_TCP_DEFAULT", UintegerValue(1));
+
+    NetDeviceContainer gnbNetDev = nrHelper->InstallGnbDevice(gnbNodes, allBwps);
+    NetDeviceContainer ueNetDev = nrHelper->InstallUeDevice(ueNodes, allBwps);
+    nrHelper->AssignStreams(gnbNetDev, 1);
+    nrHelper->AssignStreams(ueNetDev, 100);
+    Ptr<NrGnbNetDevice> gnb = DynamicCast<NrGnbNetDevice>(gnbNetDev.Get(0));
+    NS_ABORT_MSG_IF(gnb->GetPhy(0)->GetCellId() == gnb->GetPhy(1)->GetCellId(),
+                    "The BWPs of the gNB share a cell ID, the check needs them distinct");
+
+    Ptr<Node> pgw = nrEpcHelper->GetPgwNode();
+    NodeContainer remoteHostContainer;
+    remoteHostContainer.Create(1);
+    Ptr<Node> remoteHost = remoteHostContainer.Get(0);
+    InternetStackHelper internet;
+    internet.Install(remoteHostContainer);
+    PointToPointHelper p2ph;
+    p2ph.SetDeviceAttribute("DataRate", DataRateValue(DataRate("100Gb/s")));
+    p2ph.SetDeviceAttribute("Mtu", UintegerValue(2500));
+    p2ph.SetChannelAttribute("Delay", TimeValue(Seconds(0.000)));
+    NetDeviceContainer internetDevices = p2ph.Install(pgw, remoteHost);
+    Ipv4AddressHelper ipv4h;
+    ipv4h.SetBase("8.0.0.0", "255.0.0.0");
+    ipv4h.Assign(internetDevices);
+    Ipv4StaticRoutingHelper ipv4RoutingHelper;
+    ipv4RoutingHelper.GetStaticRouting(remoteHost->GetObject<Ipv4>())
+        ->AddNetworkRouteTo(Ipv4Address("7.0.0.0"), Ipv4Mask("255.0.0.0"), 1);
+
+    internet.Install(ueNodes);
+    Ipv4InterfaceContainer ueIpIface = nrEpcHelper->AssignUeIpv4Address(ueNetDev);
+    ipv4RoutingHelper.GetStaticRouting(ueNodes.Get(0)->GetObject<Ipv4>())
+        ->SetDefaultRoute(nrEpcHelper->GetUeDefaultGatewayAddress(), 1);
+    nrHelper->AttachToGnb(ueNetDev.Get(0), gnbNetDev.Get(0));
+
+    uint16_t port = 1234;
+    UdpServerHelper sink(port);
+    ApplicationContainer serverApps = sink.Install(ueNodes);
+    UdpClientHelper client(ueIpIface.GetAddress(0), port);
+    client.SetAttribute("MaxPackets", UintegerValue(0xFFFFFFFF));
+    client.SetAttribute("PacketSize", UintegerValue(1000));
+    client.SetAttribute("Interval", TimeValue(MicroSeconds(100)));
+    ApplicationContainer clientApps = client.Install(remoteHost);
+    serverApps.Start(appStartTime);
+    clientApps.Start(appStartTime);
+
+    Ptr<KpmBwpLoad> bwpLoad = CreateObject<KpmBwpLoad>();
+    bwpLoad->Install(gnbNetDev, appStartTime, MilliSeconds(50));
+
+    Simulator::Stop(simTime);
+    Simulator::Run();
+    double load0 = bwpLoad->GetLoad(0, 0);
+    double load1 = bwpLoad->GetLoad(0, 1);
+    Simulator::Destroy();
+
+    std::cout << "BWP 0 load " << load0 << ", BWP 1 load " << load1 << std::endl;
+    if (load1 > 0 && load1 > load0)
+    {
+        return EXIT_SUCCESS;
+    }
+    std::cerr << "FAIL: the loaded BWP 1 is not measured" << std::endl;
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,253 @@
+#ifndef KPM_CHECKPOINT_H
+#define KPM_CHECKPOINT_H
+
+#include "ns3/core-module.h"
+#include "ns3/flow-monitor-module.h"
+
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+
+namespace ns3
+{
+
+/**
+ * Statistics checkpoint of a scenario run.
+ *
+ * ns-3 cannot serialize its event queue or the in-flight state of the NR
+ * stack (HARQ, RLC buffers), so a checkpoint keeps what the results are made
+ * of: the FlowMonitor statistics of every flow, together with the simulated
+ * time they cover and the parameters of the run. A restored run rebuilds the
+ * same scenario with the next RNG run number, lets it attach again,
+ * simulates only the remaining time and adds its statistics to the
+ * checkpointed ones.
+ *
+ * Since no network state is saved, a checkpoint is not a warm-up that other
+ * parameter variants could reuse: the restored run must have the same
+ * parameters, and restoring with different ones aborts. A restored segment
+ * also goes through a second attach transient, and the packets in flight at
+ * the checkpoint never reach their sink, so the merged totals count them as
+ * lost (sent, never received).
+ *
+ * The flows are keyed by their five-tuple, not by FlowId: the monitor numbers
+ * the flows in the order of their first packet, which changes with the RNG
+ * run, while the addresses and ports of the rebuilt scenario are the same.
+ *
+ * File layout (native endianness): magic "KPMCKPT2", parameter string,
+ * segment, time step covered, flow count and per-flow fixed-size records
+ * (five-tuple, then statistics).
+ */
+struct KpmCheckpoint
+{
+    using FlowStatsByTuple = std::map<Ipv4FlowClassifier::FiveTuple, FlowMonitor::FlowStats>;
+
+    std::string parameters; //!< parameters of the run, must match on restore
+    uint32_t segment{0};    //!< number of runs merged so far
+    int64_t time{0};        //!< simulated time covered, in time steps
+    FlowStatsByTuple flows; //!< per-flow statistics
+
+    bool Save(const std::string& filename) const
+    {
+        std::string tmp = filename + ".tmp";
+        std::ofstream os(tmp.c_str(), std::ios::binary | std::ios::trunc);
+        if (!os.is_open())
+        {
+            return false;
+        }
+        os.write(MAGIC, sizeof(MAGIC));
+        WriteString(os, parameters);
+        Write(os, segment);
+        Write(os, time);
+        Write(os, static_cast<uint32_t>(flows.size()));
+        for (const auto& flow : flows)
+        {
+            const Ipv4FlowClassifier::FiveTuple& t = flow.first;
+            const FlowMonitor::FlowStats& s = flow.second;
+            Write(os, t.sourceAddress.Get());
+            Write(os, t.destinationAddress.Get());
+            Write(os, t.protocol);
+            Write(os, t.sourcePort);
+            Write(os, t.destinationPort);
+            Write(os, s.timeFirstTxPacket.GetTimeStep());
+            Write(os, s.timeFirstRxPacket.GetTimeStep());
+            Write(os, s.timeLastTxPacket.GetTimeStep());
+            Write(os, s.timeLastRxPacket.GetTimeStep());
+            Write(os, s.delaySum.GetTimeStep());
+            Write(os, s.jitterSum.GetTimeStep());
+            Write(os, s.lastDelay.GetTimeStep());
+            Write(os, s.txBytes);
+            Write(os, s.rxBytes);
+            Write(os, s.txPackets);
+            Write(os, s.rxPackets);
+            Write(os, s.lostPackets);
+            Write(os, s.timesForwarded);
+        }
+        os.close();
+        return os.good() && std::rename(tmp.c_str(), filename.c_str()) == 0;
+    }
+
+    bool Load(const std::string& filename)
+    {
+        std::ifstream is(filename.c_str(), std::ios::binary);
+        char magic[sizeof(MAGIC)];
+        if (!is.read(magic, sizeof(magic)) ||
+            std::string(magic, sizeof(magic)) != std::string(MAGIC, sizeof(MAGIC)))
+        {
+            return false;
+        }
+        parameters = ReadString(is);
+        Read(is, segment);
+        Read(is, time);
+        uint32_t numFlows = 0;
+        Read(is, numFlows);
+        flows.clear();
+        for (uint32_t i = 0; i < numFlows; ++i)
+        {
+            Ipv4FlowClassifier::FiveTuple t;
+            uint32_t address = 0;
+            Read(is, address);
+            t.sourceAddress = Ipv4Address(address);
+            Read(is, address);
+            t.destinationAddress = Ipv4Address(address);
+            Read(is, t.protocol);
+            Read(is, t.sourcePort);
+            Read(is, t.destinationPort);
+            FlowMonitor::FlowStats& s = flows[t];
+            s.timeFirstTxPacket = ReadTime(is);
+            s.timeFirstRxPacket = ReadTime(is);
+            s.timeLastTxPacket = ReadTime(is);
+            s.timeLastRxPacket = ReadTime(is);
+            s.delaySum = ReadTime(is);
+            s.jitterSum = ReadTime(is);
+            s.lastDelay = ReadTime(is);
+            Read(is, s.txBytes);
+            Read(is, s.rxBytes);
+            Read(is, s.txPackets);
+            Read(is, s.rxPackets);
+            Read(is, s.lostPackets);
+            Read(is, s.timesForwarded);
+        }
+        return !is.fail();
+    }
+
+    /**
+     * Add the statistics of from to the flows of into with the same
+     * five-tuple in classifier. Returns the number of flows of from that the
+     * run has no flow for, whose statistics are left out.
+     */
+    static uint32_t Merge(FlowMonitor::FlowStatsContainer& into,
+                          const Ptr<Ipv4FlowClassifier>& classifier,
+                          const FlowStatsByTuple& from)
+    {
+        std::map<Ipv4FlowClassifier::FiveTuple, FlowId> ids;
+        for (const auto& flow : into)
+        {
+            ids[classifier->FindFlow(flow.first)] = flow.first;
+        }
+        uint32_t unmatched = 0;
+        for (const auto& flow : from)
+        {
+            auto id = ids.find(flow.first);
+            if (id == ids.end())
+            {
+                unmatched++;
+                continue;
+            }
+            Add(into[id->second], flow.second);
+        }
+        return unmatched;
+    }
+
+    /**
+     * Snapshot of a running scenario: the statistics of base (the restored
+     * checkpoint, if any) plus what the monitor collected since.
+     */
+    static KpmCheckpoint Capture(const KpmCheckpoint& base,
+                                 const Ptr<FlowMonitor>& monitor,
+                                 const Ptr<Ipv4FlowClassifier>& classifier,
+                                 Time covered)
+    {
+        KpmCheckpoint checkpoint;
+        checkpoint.parameters = base.parameters;
+        checkpoint.segment = base.segment;
+        checkpoint.time = covered.GetTimeStep();
+        monitor->CheckForLostPackets();
+        for (const auto& flow : monitor->GetFlowStats())
+        {
+            checkpoint.flows[classifier->FindFlow(flow.first)] = flow.second;
+        }
+        for (const auto& flow : base.flows)
+        {
+            Add(checkpoint.flows[flow.first], flow.second);
+        }
+        return checkpoint;
+    }
+
+  private:
+    static constexpr char MAGIC[8] = {'K', 'P', 'M', 'C', 'K', 'P', 'T', '2'};
+
+    static void Add(FlowMonitor::FlowStats& d, const FlowMonitor::FlowStats& s)
+    {
+        d.delaySum += s.delaySum;
+        d.jitterSum += s.jitterSum;
+        d.txBytes += s.txBytes;
+        d.rxBytes += s.rxBytes;
+        d.txPackets += s.txPackets;
+        d.rxPackets += s.rxPackets;
+        d.lostPackets += s.lostPackets;
+        d.timesForwarded += s.timesForwarded;
+    }
+
+    template <typename T>
+    static void Write(std::ostream& os, const T& value)
+    {
+        os.write(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    template <typename T>
+    static void Read(std::istream& is, T& value)
+    {
+        is.read(reinterpret_cast<char*>(&value), sizeof(T));
+    }
+
+    static Time ReadTime(std::istream& is)
+    {
+        int64_t ts = 0;
+        Read(is, ts);
+        return TimeStep(ts);
+    }
+
+    static void WriteString(std::ostream& os, const std::string& value)
+    {
+        Write(os, static_cast<uint32_t>(value.size()));
+        os.write(value.data(), value.size());
+    }
+
+    static std::string ReadString(std::istream& is)
+    {
+        uint32_t size = 0;
+        Read(is, size);
+        std::string value(size, '\0');
+        is.read(&value[0], size);
+        return value;
+    }
+};
+
+/// Write a checkpoint of the running scenario (scheduled at the checkpoint times).
+inline void
+KpmSaveCheckpoint(const KpmCheckpoint* base,
+                  Ptr<FlowMonitor> monitor,
+                  Ptr<Ipv4FlowClassifier> classifier,
+                  Time offset,
+                  std::string filename)
+{
+    KpmCheckpoint checkpoint =
+        KpmCheckpoint::Capture(*base, monitor, classifier, Simulator::Now() + offset);
+    NS_ABORT_MSG_IF(!checkpoint.Save(filename), "Can't write checkpoint " << filename);
+}
+
+} // namespace ns3
+
+#endif // KPM_CHECKPOINT_H
@@ -0,0 +1,218 @@
+#ifndef KPM_FLOW_REPORT_H
+#define KPM_FLOW_REPORT_H
+
+#include "ns3/core-module.h"
+#include "ns3/flow-monitor-module.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace ns3
+{
+
+/**
+ * Per-flow results of a run, in the text format the scenarios have always
+ * written to kpm-out/<simTag>.
+ *
+ * The report is formatted in a single pass with snprintf into one buffer
+ * reserved for the flow count up front, instead of an ostream per line and
+ * a stringstream per flow for the protocol, and the same buffer is then
+ * written to the results file and/or stdout, so the file is not read back
+ * to print it. The numbers are printed as the fixed-format ofstream printed
+ * them (%f), so the output is byte for byte the same.
+ */
+class KpmFlowReport
+{
+  public:
+    /// Average only the flows to these destination ports (all flows if empty).
+    void SetMeanPorts(const std::vector<uint16_t>& ports)
+    {
+        m_meanPorts = ports;
+    }
+
+    /// Format every flow of stats, with throughputs over flowDuration seconds.
+    void Format(const FlowMonitor::FlowStatsContainer& stats,
+                Ptr<Ipv4FlowClassifier> classifier,
+                double flowDuration)
+    {
+        Begin(stats.size());
+        for (const auto& flow : stats)
+        {
+            AddFlow(flow.first, classifier->FindFlow(flow.first), flow.second, flowDuration);
+        }
+        End();
+    }
+
+    /// Start a report of numFlows flows, reusing the buffer of the last one.
+    void Begin(std::size_t numFlows)
+    {
+        m_size = 0;
+        m_buffer.resize(std::max(m_buffer.size(), numFlows * BYTES_PER_FLOW + 128));
+        m_flows = 0;
+        m_throughputSum = 0.0;
+        m_delaySum = 0.0;
+    }
+
+    void AddFlow(FlowId id,
+                 const Ipv4FlowClassifier::FiveTuple& t,
+                 const FlowMonitor::FlowStats& s,
+                 double flowDuration)
+    {
+        char protocol[8];
+        if (t.protocol == 6)
+        {
+            std::snprintf(protocol, sizeof(protocol), "TCP");
+        }
+        else if (t.protocol == 17)
+        {
+            std::snprintf(protocol, sizeof(protocol), "UDP");
+        }
+        else
+        {
+            std::snprintf(protocol, sizeof(protocol), "%u", t.protocol);
+        }
+        uint32_t source = t.sourceAddress.Get();
+        uint32_t destination = t.destinationAddress.Get();
+        // Over a steady-state window, packets sent before its start and received
+        // in it count as rx but not tx: the loss is clamped at 0.
+        uint32_t lost = s.txPackets > s.rxPackets ? s.txPackets - s.rxPackets : 0;
+        Append("Flow %u (%u.%u.%u.%u:%u -> %u.%u.%u.%u:%u) proto %s\n"
+               "  Tx Packets: %u\n"
+               "  Tx Bytes:   %llu\n"
+               "  TxOffered:  %f Mbps\n"
+               "  Rx Bytes:   %llu\n"
+               "  Lost Packets: %u\n"
+               "  Packet loss: %f%%\n",
+               id,
+               (source >> 24) & 0xff,
+               (source >> 16) & 0xff,
+               (source >> 8) & 0xff,
+               source & 0xff,
+               t.sourcePort,
+               (destination >> 24) & 0xff,
+               (destination >> 16) & 0xff,
+               (destination >> 8) & 0xff,
+               destination & 0xff,
+               t.destinationPort,
+               protocol,
+               s.txPackets,
+               static_cast<unsigned long long>(s.txBytes),
+               s.txBytes * 8.0 / flowDuration / 1000.0 / 1000.0,
+               static_cast<unsigned long long>(s.rxBytes),
+               lost,
+               ((lost * 1.0) / s.txPackets) * 100);
+        if (s.rxPackets > 0)
+        {
+            double throughput = s.rxBytes * 8.0 / flowDuration / 1000 / 1000;
+            double delay = 1000 * s.delaySum.GetSeconds() / s.rxPackets;
+            if (InMean(t))
+            {
+                m_throughputSum += throughput;
+                m_delaySum += delay;
+            }
+            Append("  Throughput: %f Mbps\n"
+                   "  Mean delay:  %f ms\n"
+                   "  Mean jitter:  %f ms\n",
+                   throughput,
+                   delay,
+                   1000 * s.jitterSum.GetSeconds() / s.rxPackets);
+        }
+        else
+        {
+            Append("  Throughput:  0 Mbps\n"
+                   "  Mean delay:  0 ms\n"
+                   "  Mean jitter: 0 ms\n");
+        }
+        Append("  Rx Packets: %u\n", s.rxPackets);
+        m_flows += InMean(t) ? 1 : 0;
+    }
+
+    /// Append the means over the averaged flows (flows without packets count as 0).
+    void End()
+    {
+        Append("\n\n  Mean flow throughput: %f\n"
+               "  Mean flow delay: %f\n",
+               GetMeanFlowThroughput(),
+               GetMeanFlowDelay());
+    }
+
+    double GetMeanFlowThroughput() const
+    {
+        return m_flows > 0 ? m_throughputSum / m_flows : 0.0;
+    }
+
+    double GetMeanFlowDelay() const
+    {
+        return m_flows > 0 ? m_delaySum / m_flows : 0.0;
+    }
+
+    /// The report text, GetSize() bytes without a terminating null.
+    const char* GetData() const
+    {
+        return m_buffer.data();
+    }
+
+    std::size_t GetSize() const
+    {
+        return m_size;
+    }
+
+    /**
+     * Write the report to filename (if not empty) and to stdout (if toStdout).
+     * Returns false if the file can't be written.
+     */
+    bool Write(const std::string& filename, bool toStdout) const
+    {
+        bool written = true;
+        if (!filename.empty())
+        {
+            std::FILE* file = std::fopen(filename.c_str(), "wb");
+            written = file && std::fwrite(m_buffer.data(), 1, m_size, file) == m_size;
+            written = file && std::fclose(file) == 0 && written;
+        }
+        if (toStdout)
+        {
+            std::fwrite(m_buffer.data(), 1, m_size, stdout);
+            std::fflush(stdout);
+        }
+        return written;
+    }
+
+  private:
+    bool InMean(const Ipv4FlowClassifier::FiveTuple& t) const
+    {
+        return m_meanPorts.empty() || std::find(m_meanPorts.begin(),
+                                                m_meanPorts.end(),
+                                                t.destinationPort) != m_meanPorts.end();
+    }
+
+    /// Upper bound of one flow's text with 20 digit counters, to reserve once.
+    static constexpr std::size_t BYTES_PER_FLOW = 512;
+
+    /// snprintf at the end of the text, growing the buffer only if the reserve ran out.
+    template <typename... Args>
+    void Append(const char* format, Args... args)
+    {
+        std::size_t room = m_buffer.size() - m_size;
+        int n = std::snprintf(&m_buffer[m_size], room, format, args...);
+        if (n >= 0 && static_cast<std::size_t>(n) >= room)
+        {
+            m_buffer.resize(std::max(2 * m_buffer.size(), m_size + n + 1));
+            std::snprintf(&m_buffer[m_size], n + 1, format, args...);
+        }
+        m_size += std::max(n, 0);
+    }
+
+    std::string m_buffer; //!< sized to the reserve, the text is its first m_size bytes
+    std::size_t m_size{0};
+    std::vector<uint16_t> m_meanPorts;
+    uint32_t m_flows{0}; //!< flows in the means
+    double m_throughputSum{0.0};
+    double m_delaySum{0.0};
+};
+
+} // namespace ns3
+
+#endif // KPM_FLOW_REPORT_H
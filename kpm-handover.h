@@ -0,0 +1,311 @@
+#ifndef KPM_HANDOVER_H
+#define KPM_HANDOVER_H
+
+#include "kpm-mobility.h"
+
+#include "ns3/core-module.h"
+#include "ns3/mobility-module.h"
+#include "ns3/nr-module.h"
+#include "ns3/propagation-module.h"
+#include "ns3/spectrum-module.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <map>
+#include <unordered_map>
+#include <vector>
+
+namespace ns3
+{
+
+/**
+ * A3 handover of the UEs between the gNBs of the grid, measured against a
+ * bounded neighbour set per UE instead of every gNB.
+ *
+ * The gNB positions go into a uniform grid of cells the size of the
+ * neighbour radius. A UE's neighbours are the nearest gNBs (at most
+ * maxNeighbours) in the 3 x 3 cells around it, looked up at install and
+ * again only when the UE moved (Moved, from KpmUeMobility), so a lookup
+ * costs the gNBs of nine cells whatever the size of the grid. Every
+ * measurement period the RSRP of the serving cell and of the neighbours is
+ * estimated from the propagation loss of the first BWP channel; a neighbour
+ * better than the serving cell by the hysteresis for the whole
+ * time-to-trigger gets a handover request over X2. When the UE reports the
+ * handover done, the beams of the new pair are computed and the handover
+ * callback is called; a failed handover lets the UE be measured again.
+ */
+class KpmHandover
+{
+  public:
+    /// A3 entry condition: neighbour > serving + hysteresis (dB) for timeToTrigger.
+    void SetA3(double hysteresis, Time timeToTrigger)
+    {
+        m_hysteresis = hysteresis;
+        m_timeToTrigger = timeToTrigger;
+    }
+
+    /// Radius (m) and size of the neighbour set of a UE.
+    void SetNeighbours(double radius, uint32_t maxNeighbours)
+    {
+        NS_ABORT_MSG_IF(radius <= 0 || maxNeighbours == 0, "Invalid handover neighbour set");
+        m_radius = radius;
+        m_maxNeighbours = maxNeighbours;
+    }
+
+    /// The ideal beamforming method of the scenario, for the beams after a handover.
+    void SetBeamformingMethod(Ptr<IdealBeamformingAlgorithm> method)
+    {
+        m_method = method;
+    }
+
+    /// Called with the UE and its new gNB when a handover completed.
+    void SetHandoverCallback(Callback<void, Ptr<NrUeNetDevice>, Ptr<NrGnbNetDevice>> handover)
+    {
+        m_handover = handover;
+    }
+
+    /**
+     * Index the gNBs, find the neighbours of the attached UEs and measure
+     * every period from start. The gNBs need an X2 interface between them.
+     */
+    void Install(Ptr<NrHelper> nrHelper,
+                 const NetDeviceContainer& gnbs,
+                 const NetDeviceContainer& ues,
+                 Time start,
+                 Time period)
+    {
+        m_nrHelper = nrHelper;
+        m_period = period;
+        for (uint32_t i = 0; i < gnbs.GetN(); ++i)
+        {
+            Gnb gnb;
+            gnb.device = DynamicCast<NrGnbNetDevice>(gnbs.Get(i));
+            gnb.mobility = gnb.device->GetNode()->GetObject<MobilityModel>();
+            Ptr<NrGnbPhy> phy = gnb.device->GetPhy(0);
+            gnb.txPower = phy->GetTxPower();
+            gnb.loss = phy->GetSpectrumPhy()->GetSpectrumChannel()->GetPropagationLossModel();
+            Vector position = gnb.mobility->GetPosition();
+            m_cells[CellKey(Cell(position.x), Cell(position.y))].push_back(i);
+            m_cellIds[gnb.device->GetCellId()] = i;
+            m_gnbs.push_back(gnb);
+        }
+        for (uint32_t i = 0; i < ues.GetN(); ++i)
+        {
+            Ue ue;
+            ue.device = DynamicCast<NrUeNetDevice>(ues.Get(i));
+            ue.mobility = ue.device->GetNode()->GetObject<MobilityModel>();
+            ue.serving = m_cellIds.at(ue.device->GetTargetGnb()->GetCellId());
+            m_index[ue.device] = m_ues.size();
+            m_ues.push_back(ue);
+            FindNeighbours(m_ues.back());
+            ue.device->GetRrc()->TraceConnectWithoutContext(
+                "HandoverEndOk",
+                MakeBoundCallback(&KpmHandover::HandoverEndOk, this, i));
+            ue.device->GetRrc()->TraceConnectWithoutContext(
+                "HandoverEndError",
+                MakeBoundCallback(&KpmHandover::HandoverEndError, this, i));
+        }
+        Simulator::Schedule(start, &KpmHandover::Measure, this);
+    }
+
+    /// The UE moved: look its neighbours up again.
+    void Moved(Ptr<NrUeNetDevice> device)
+    {
+        auto it = m_index.find(device);
+        if (it != m_index.end())
+        {
+            FindNeighbours(m_ues[it->second]);
+        }
+    }
+
+    /// RSRP estimates so far, serving cells included.
+    uint64_t GetMeasurements() const
+    {
+        return m_measurements;
+    }
+
+    uint64_t GetRequested() const
+    {
+        return m_requested;
+    }
+
+    uint64_t GetCompleted() const
+    {
+        return m_completed;
+    }
+
+  private:
+    struct Gnb
+    {
+        Ptr<NrGnbNetDevice> device;
+        Ptr<MobilityModel> mobility;
+        Ptr<PropagationLossModel> loss;
+        double txPower{0.0}; //!< dBm
+    };
+
+    struct Ue
+    {
+        Ptr<NrUeNetDevice> device;
+        Ptr<MobilityModel> mobility;
+        uint32_t serving{0};
+        std::vector<uint32_t> neighbours; //!< nearest first, the serving gNB excluded
+        uint32_t candidate{0};
+        Time candidateSince;
+        bool triggered{false}; //!< A3 holds for candidate since candidateSince
+        bool pending{false};   //!< a handover was requested and has not completed
+    };
+
+    int64_t Cell(double coordinate) const
+    {
+        return static_cast<int64_t>(std::floor(coordinate / m_radius));
+    }
+
+    /// Negative cells (gNBs at negative coordinates) are shifted as unsigned.
+    static uint64_t CellKey(int64_t x, int64_t y)
+    {
+        return (static_cast<uint64_t>(x) << 32) ^ static_cast<uint32_t>(y);
+    }
+
+    void FindNeighbours(Ue& ue)
+    {
+        Vector position = ue.mobility->GetPosition();
+        int64_t cx = Cell(position.x);
+        int64_t cy = Cell(position.y);
+        std::vector<std::pair<double, uint32_t>> found;
+        for (int64_t x = cx - 1; x <= cx + 1; ++x)
+        {
+            for (int64_t y = cy - 1; y <= cy + 1; ++y)
+            {
+                auto cell = m_cells.find(CellKey(x, y));
+                if (cell == m_cells.end())
+                {
+                    continue;
+                }
+                for (uint32_t gnb : cell->second)
+                {
+                    if (gnb != ue.serving)
+                    {
+                        found.emplace_back(
+                            CalculateDistance(position, m_gnbs[gnb].mobility->GetPosition()),
+                            gnb);
+                    }
+                }
+            }
+        }
+        std::size_t kept = std::min<std::size_t>(found.size(), m_maxNeighbours);
+        std::partial_sort(found.begin(), found.begin() + kept, found.end());
+        ue.neighbours.clear();
+        for (std::size_t i = 0; i < kept; ++i)
+        {
+            ue.neighbours.push_back(found[i].second);
+        }
+    }
+
+    double Rsrp(const Ue& ue, uint32_t gnb)
+    {
+        m_measurements++;
+        const Gnb& g = m_gnbs[gnb];
+        return g.loss->CalcRxPower(g.txPower, g.mobility, ue.mobility);
+    }
+
+    void Measure()
+    {
+        Time now = Simulator::Now();
+        for (auto& ue : m_ues)
+        {
+            if (ue.pending)
+            {
+                continue;
+            }
+            double threshold = Rsrp(ue, ue.serving) + m_hysteresis;
+            double best = threshold;
+            bool found = false;
+            uint32_t target = 0;
+            for (uint32_t gnb : ue.neighbours)
+            {
+                double rsrp = Rsrp(ue, gnb);
+                if (rsrp > best)
+                {
+                    best = rsrp;
+                    target = gnb;
+                    found = true;
+                }
+            }
+            if (!found)
+            {
+                ue.triggered = false;
+                continue;
+            }
+            if (!ue.triggered || ue.candidate != target)
+            {
+                ue.triggered = true;
+                ue.candidate = target;
+                ue.candidateSince = now;
+            }
+            if (now - ue.candidateSince >= m_timeToTrigger)
+            {
+                ue.pending = true;
+                ue.triggered = false;
+                m_requested++;
+                m_nrHelper->HandoverRequest(MilliSeconds(0),
+                                            ue.device,
+                                            m_gnbs[ue.serving].device,
+                                            m_gnbs[target].device);
+            }
+        }
+        Simulator::Schedule(m_period, &KpmHandover::Measure, this);
+    }
+
+    static void HandoverEndOk(KpmHandover* handover,
+                              uint32_t index,
+                              uint64_t /* imsi */,
+                              uint16_t cellId,
+                              uint16_t /* rnti */)
+    {
+        Ue& ue = handover->m_ues[index];
+        ue.pending = false;
+        ue.serving = handover->m_cellIds.at(cellId);
+        handover->FindNeighbours(ue);
+        handover->m_completed++;
+        Ptr<NrGnbNetDevice> gnb = handover->m_gnbs[ue.serving].device;
+        if (handover->m_method)
+        {
+            KpmUeMobility::UpdateBeams(handover->m_method, ue.device, gnb);
+        }
+        if (!handover->m_handover.IsNull())
+        {
+            handover->m_handover(ue.device, gnb);
+        }
+    }
+
+    static void HandoverEndError(KpmHandover* handover,
+                                 uint32_t index,
+                                 uint64_t /* imsi */,
+                                 uint16_t /* cellId */,
+                                 uint16_t /* rnti */)
+    {
+        handover->m_ues[index].pending = false;
+    }
+
+    double m_hysteresis{3.0};
+    Time m_timeToTrigger{MilliSeconds(256)};
+    double m_radius{50.0};
+    uint32_t m_maxNeighbours{8};
+    Time m_period{MilliSeconds(40)};
+    Ptr<NrHelper> m_nrHelper;
+    Ptr<IdealBeamformingAlgorithm> m_method;
+    Callback<void, Ptr<NrUeNetDevice>, Ptr<NrGnbNetDevice>> m_handover;
+    std::vector<Gnb> m_gnbs;
+    std::vector<Ue> m_ues;
+    std::unordered_map<uint64_t, std::vector<uint32_t>> m_cells; //!< grid cell -> gNBs
+    std::map<uint16_t, uint32_t> m_cellIds;                       //!< cell ID -> gNB
+    std::map<Ptr<NrUeNetDevice>, std::size_t> m_index;
+    uint64_t m_measurements{0};
+    uint64_t m_requested{0};
+    uint64_t m_completed{0};
+};
+
+} // namespace ns3
+
+#endif // KPM_HANDOVER_H
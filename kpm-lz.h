@@ -0,0 +1,181 @@
+#ifndef KPM_LZ_H
+#define KPM_LZ_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace ns3
+{
+
+/**
+ * Byte-oriented LZ77 block compressor in the LZ4 block layout, for the trace
+ * chunks: fast enough to keep up with the trace writer thread, and the trace
+ * records (fixed headers, repeated cell and RNTI fields, slowly changing
+ * times) compress well with it.
+ *
+ * A block is a sequence of: token (literal count in the high nibble, match
+ * length - 4 in the low one; 15 continues in bytes of 255 and a last byte),
+ * the literals, then the match offset (uint16, little endian) and the match
+ * length continuation. The last sequence has literals only.
+ */
+class KpmLz
+{
+  public:
+    /// Compress size bytes of src, appending to out.
+    void Compress(const char* src, std::size_t size, std::string& out)
+    {
+        m_table.assign(1 << HASH_BITS, -1);
+        std::size_t anchor = 0;
+        std::size_t i = 0;
+        while (i + MIN_MATCH <= size)
+        {
+            uint32_t sequence = Load32(src + i);
+            uint32_t hash = (sequence * 2654435761U) >> (32 - HASH_BITS);
+            int64_t candidate = m_table[hash];
+            m_table[hash] = static_cast<int64_t>(i);
+            if (candidate < 0 || i - candidate > MAX_OFFSET || Load32(src + candidate) != sequence)
+            {
+                i++;
+                continue;
+            }
+            std::size_t length = MIN_MATCH;
+            while (i + length < size && src[candidate + length] == src[i + length])
+            {
+                length++;
+            }
+            Emit(out, src + anchor, i - anchor, i - candidate, length);
+            i += length;
+            anchor = i;
+        }
+        Emit(out, src + anchor, size - anchor, 0, 0);
+    }
+
+    /**
+     * Decompress a block into exactly rawSize bytes appended to out; false if
+     * the block is malformed or does not decode to rawSize bytes.
+     */
+    static bool Decompress(const char* src, std::size_t size, std::size_t rawSize, std::string& out)
+    {
+        std::size_t base = out.size();
+        out.resize(base + rawSize);
+        char* dst = &out[base];
+        std::size_t in = 0;
+        std::size_t produced = 0;
+        while (in < size)
+        {
+            uint8_t token = src[in++];
+            std::size_t literals = token >> 4;
+            if (literals == 15 && !ReadLength(src, size, in, literals))
+            {
+                return false;
+            }
+            if (literals > size - in || literals > rawSize - produced)
+            {
+                return false;
+            }
+            std::memcpy(dst + produced, src + in, literals);
+            in += literals;
+            produced += literals;
+            if (in == size)
+            {
+                break;
+            }
+            if (size - in < 2)
+            {
+                return false;
+            }
+            std::size_t offset = static_cast<uint8_t>(src[in]) |
+                                 static_cast<std::size_t>(static_cast<uint8_t>(src[in + 1])) << 8;
+            in += 2;
+            std::size_t length = token & 15;
+            if (length == 15 && !ReadLength(src, size, in, length))
+            {
+                return false;
+            }
+            length += MIN_MATCH;
+            if (offset == 0 || offset > produced || length > rawSize - produced)
+            {
+                return false;
+            }
+            // Byte by byte: the match may overlap what it produces.
+            for (std::size_t k = 0; k < length; ++k)
+            {
+                dst[produced + k] = dst[produced - offset + k];
+            }
+            produced += length;
+        }
+        return produced == rawSize;
+    }
+
+  private:
+    static constexpr std::size_t MIN_MATCH = 4;
+    static constexpr std::size_t MAX_OFFSET = 65535;
+    static constexpr int HASH_BITS = 14;
+
+    static uint32_t Load32(const char* p)
+    {
+        uint32_t v;
+        std::memcpy(&v, p, sizeof(v));
+        return v;
+    }
+
+    static void PutLength(std::string& out, std::size_t length)
+    {
+        for (; length >= 255; length -= 255)
+        {
+            out.push_back(static_cast<char>(255));
+        }
+        out.push_back(static_cast<char>(length));
+    }
+
+    static bool ReadLength(const char* src, std::size_t size, std::size_t& in, std::size_t& length)
+    {
+        uint8_t byte = 255;
+        while (byte == 255)
+        {
+            if (in == size)
+            {
+                return false;
+            }
+            byte = src[in++];
+            length += byte;
+        }
+        return true;
+    }
+
+    /// A sequence of literals and, if length > 0, a match.
+    static void Emit(std::string& out,
+                     const char* literals,
+                     std::size_t numLiterals,
+                     std::size_t offset,
+                     std::size_t length)
+    {
+        std::size_t matchCode = length > 0 ? length - MIN_MATCH : 0;
+        out.push_back(static_cast<char>((std::min<std::size_t>(numLiterals, 15) << 4) |
+                                        std::min<std::size_t>(matchCode, 15)));
+        if (numLiterals >= 15)
+        {
+            PutLength(out, numLiterals - 15);
+        }
+        out.append(literals, numLiterals);
+        if (length == 0)
+        {
+            return;
+        }
+        out.push_back(static_cast<char>(offset & 0xff));
+        out.push_back(static_cast<char>(offset >> 8));
+        if (matchCode >= 15)
+        {
+            PutLength(out, matchCode - 15);
+        }
+    }
+
+    std::vector<int64_t> m_table;
+};
+
+} // namespace ns3
+
+#endif // KPM_LZ_H
@@ -0,0 +1,226 @@
+#ifndef KPM_MEMORY_H
+#define KPM_MEMORY_H
+
+#include "ns3/antenna-module.h"
+#include "ns3/core-module.h"
+#include "ns3/flow-monitor-module.h"
+#include "ns3/nr-module.h"
+
+#include <fstream>
+#include <functional>
+#include <malloc.h>
+#include <ostream>
+#include <string>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+namespace ns3
+{
+
+/**
+ * Memory accounting of the scenario, per gNB, per UE, per bearer and per
+ * flow.
+ *
+ * Every number is a measured growth of the resident set size. The entity
+ * view is the growth across each setup phase (gNB install, UE install,
+ * attach and bearer setup), divided by the number of entities created in
+ * that phase. The layer view is the growth of creating instances of the
+ * objects of each layer of the NR stack (net device, RRC, MAC, PHY,
+ * spectrum PHY, antenna, RLC, PDCP), per instance: what the objects
+ * allocate when constructed, but not the state they build once wired and
+ * configured (schedulers, HARQ processes, spectrum models), which only the
+ * entity view holds. The flow layers are the growth of holding copies of
+ * the FlowMonitor state, per flow. Free heap is returned to the system
+ * before each measurement, so that reusing it shows as growth too.
+ */
+class KpmMemoryReport
+{
+  public:
+    /// Resident set size of the process, in bytes.
+    static uint64_t GetRss()
+    {
+        std::ifstream statm("/proc/self/statm");
+        uint64_t size = 0;
+        uint64_t resident = 0;
+        statm >> size >> resident;
+        return resident * static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+    }
+
+    /// Peak resident set size of the process, in bytes.
+    static uint64_t GetPeakRss()
+    {
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        return static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+    }
+
+    /// Start measuring a phase that creates count entities of the given kind.
+    void Begin(const std::string& entity, uint64_t count)
+    {
+        m_entity = entity;
+        m_count = count;
+        m_rss = GetRss();
+    }
+
+    /// End the phase started by the last Begin call.
+    void End()
+    {
+        uint64_t rss = GetRss();
+        m_phases.push_back({m_entity, m_count, rss > m_rss ? rss - m_rss : 0});
+    }
+
+    /**
+     * Measure the layers of a gNB and a UE with numBwps BWPs and the given
+     * antenna panels, and of a bearer (RLC and PDCP at both ends). Call it
+     * before the scenario is built: some of the objects schedule events when
+     * constructed, and the simulator is destroyed to drop them.
+     */
+    void MeasureLayers(uint32_t numBwps,
+                       uint32_t gnbAntennaRows,
+                       uint32_t gnbAntennaColumns,
+                       uint32_t ueAntennaRows,
+                       uint32_t ueAntennaColumns)
+    {
+        m_layers.push_back(
+            {"gNB",
+             {{"net device", MeasureObject<NrGnbNetDevice>()},
+              {"rrc", MeasureObject<NrGnbRrc>()},
+              {"mac", numBwps * MeasureObject<NrGnbMac>()},
+              {"phy", numBwps * MeasureObject<NrGnbPhy>()},
+              {"spectrum phy", numBwps * MeasureObject<NrSpectrumPhy>()},
+              {"antenna", numBwps * MeasureAntenna(gnbAntennaRows, gnbAntennaColumns)}}});
+        m_layers.push_back(
+            {"UE",
+             {{"net device", MeasureObject<NrUeNetDevice>()},
+              {"rrc", MeasureObject<NrUeRrc>()},
+              {"mac", numBwps * MeasureObject<NrUeMac>()},
+              {"phy", numBwps * MeasureObject<NrUePhy>()},
+              {"spectrum phy", numBwps * MeasureObject<NrSpectrumPhy>()},
+              {"antenna", numBwps * MeasureAntenna(ueAntennaRows, ueAntennaColumns)}}});
+        m_layers.push_back(
+            {"bearer",
+             {{"rlc", 2 * MeasureObject<NrRlcUm>()}, {"pdcp", 2 * MeasureObject<NrPdcp>()}}});
+        Simulator::Destroy();
+    }
+
+    /**
+     * Measure the FlowMonitor state of each flow: the monitor statistics with
+     * their histograms, and the statistics kept by every probe that saw the
+     * flow. Call it after the run.
+     */
+    void MeasureFlows(const Ptr<FlowMonitor>& monitor)
+    {
+        const FlowMonitor::FlowStatsContainer& stats = monitor->GetFlowStats();
+        if (stats.empty())
+        {
+            return;
+        }
+        uint64_t probes = 0;
+        for (const auto& probe : monitor->GetAllProbes())
+        {
+            FlowProbe::Stats probeStats = probe->GetStats();
+            probes += Measure<FlowProbe::Stats>([&probeStats]() { return probeStats; });
+        }
+        m_layers.push_back(
+            {"flow",
+             {{"flow stats",
+               Measure<FlowMonitor::FlowStatsContainer>([&stats]() { return stats; }) /
+                   stats.size()},
+              {"probes", probes / stats.size()}}});
+    }
+
+    /// Write the report, after the phases and the layers are measured.
+    void Write(std::ostream& os) const
+    {
+        os << "Memory per entity (measured RSS growth)\n";
+        for (const auto& phase : m_phases)
+        {
+            os << "  " << phase.entity << ": "
+               << (phase.count > 0 ? phase.bytes / phase.count : phase.bytes) << " bytes x "
+               << phase.count << "\n";
+        }
+        os << "Memory per layer (measured RSS growth per created instance)\n";
+        for (const auto& layers : m_layers)
+        {
+            WriteLayers(os, layers.first, layers.second);
+        }
+        os << "  peak RSS: " << GetPeakRss() << " bytes\n";
+    }
+
+  private:
+    struct Phase
+    {
+        std::string entity;
+        uint64_t count;
+        uint64_t bytes;
+    };
+
+    using Layers = std::vector<std::pair<std::string, uint64_t>>;
+
+    /**
+     * RSS growth per instance of holding instances made by create. They are
+     * made until the RSS grew by 4 MB or 4096 of them exist, so that page
+     * rounding is small against the growth.
+     */
+    template <class T>
+    static uint64_t Measure(const std::function<T()>& create)
+    {
+        const std::size_t maxInstances = 4096;
+        const uint64_t minGrowth = 4 << 20;
+        std::vector<T> instances;
+        instances.reserve(maxInstances);
+        malloc_trim(0);
+        uint64_t rss = GetRss();
+        uint64_t growth = 0;
+        while (instances.size() < maxInstances && growth < minGrowth)
+        {
+            instances.push_back(create());
+            uint64_t now = GetRss();
+            growth = now > rss ? now - rss : 0;
+        }
+        return growth / instances.size();
+    }
+
+    template <class T>
+    static uint64_t MeasureObject()
+    {
+        return Measure<Ptr<T>>([]() { return CreateObject<T>(); });
+    }
+
+    static uint64_t MeasureAntenna(uint32_t rows, uint32_t columns)
+    {
+        return Measure<Ptr<UniformPlanarArray>>([rows, columns]() {
+            Ptr<UniformPlanarArray> antenna = CreateObject<UniformPlanarArray>();
+            antenna->SetAttribute("NumRows", UintegerValue(rows));
+            antenna->SetAttribute("NumColumns", UintegerValue(columns));
+            return antenna;
+        });
+    }
+
+    static void WriteLayers(std::ostream& os, const std::string& entity, const Layers& layers)
+    {
+        uint64_t total = 0;
+        for (const auto& layer : layers)
+        {
+            total += layer.second;
+        }
+        os << "  " << entity << ": " << total << " bytes";
+        for (const auto& layer : layers)
+        {
+            os << ", " << layer.first << " " << layer.second;
+        }
+        os << "\n";
+    }
+
+    std::string m_entity;
+    uint64_t m_count{0};
+    uint64_t m_rss{0};
+    std::vector<Phase> m_phases;
+    std::vector<std::pair<std::string, Layers>> m_layers;
+};
+
+} // namespace ns3
+
+#endif // KPM_MEMORY_H
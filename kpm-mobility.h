@@ -0,0 +1,262 @@
+#ifndef KPM_MOBILITY_H
+#define KPM_MOBILITY_H
+
+#include "ns3/core-module.h"
+#include "ns3/mobility-module.h"
+#include "ns3/nr-module.h"
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace ns3
+{
+
+/**
+ * Moves the UEs of the scenario and keeps what depends on their position up
+ * to date only for the UEs that actually moved.
+ *
+ * The UEs keep the ConstantPositionMobilityModel GridScenarioHelper gave
+ * them; every step each UE advances speed * step along its trajectory
+ * (LINEAR: a straight line at a random heading, reflected at the area
+ * bounds; WAYPOINT: towards a uniform random waypoint in the area, a new one
+ * on arrival) and its position is set. A UE whose position drifted more than
+ * the update distance from where its beams were last computed gets new
+ * ideal beams towards its serving gNB on every BWP (the one it attached to,
+ * until SetServingGnb tells of a handover), and the moved callback
+ * (handover measurements) is called for it; the others cost nothing else.
+ *
+ * The IdealBeamformingHelper periodic update of all the beams is meant to be
+ * disabled (BeamformingPeriodicity 0) when this runs. The 3GPP channel and
+ * its LOS/NLOS condition are not updated here: they follow their
+ * UpdatePeriod on every link, moved or not, and a period of 0 freezes them
+ * at the setup positions, so mobile runs need a non-zero one.
+ */
+class KpmUeMobility
+{
+  public:
+    enum Model
+    {
+        LINEAR,
+        WAYPOINT
+    };
+
+    KpmUeMobility()
+        : m_random(CreateObject<UniformRandomVariable>())
+    {
+    }
+
+    /// Model from its command line name, linear or waypoint; false if unknown.
+    static bool ParseModel(const std::string& name, Model& model)
+    {
+        if (name == "linear")
+        {
+            model = LINEAR;
+            return true;
+        }
+        if (name == "waypoint")
+        {
+            model = WAYPOINT;
+            return true;
+        }
+        return false;
+    }
+
+    /// Trajectories at speed m/s, within the area, advanced every step.
+    void SetModel(Model model, double speed, const Rectangle& area, Time step)
+    {
+        NS_ABORT_MSG_IF(speed < 0 || step.IsZero(), "Invalid UE mobility " << speed << " m/s");
+        m_model = model;
+        m_speed = speed;
+        m_area = area;
+        m_step = step;
+    }
+
+    /// Distance (m) a UE moves before its beams and measurements are updated.
+    void SetUpdateDistance(double distance)
+    {
+        m_updateDistance = distance;
+    }
+
+    /// The ideal beamforming method of the scenario, to recompute the beams.
+    void SetBeamformingMethod(Ptr<IdealBeamformingAlgorithm> method)
+    {
+        m_method = method;
+    }
+
+    /// Called with a UE that moved beyond the update distance, after its beams.
+    void SetMovedCallback(Callback<void, Ptr<NrUeNetDevice>> moved)
+    {
+        m_moved = moved;
+    }
+
+    int64_t AssignStreams(int64_t stream)
+    {
+        m_random->SetStream(stream);
+        return 1;
+    }
+
+    /// Start moving the UEs at start.
+    void Install(const NetDeviceContainer& ues, Time start)
+    {
+        for (uint32_t i = 0; i < ues.GetN(); ++i)
+        {
+            Ue ue;
+            ue.device = DynamicCast<NrUeNetDevice>(ues.Get(i));
+            NS_ABORT_MSG_IF(!ue.device,
+                            "Node " << ues.Get(i)->GetNode()->GetId() << " is not an NR UE");
+            ue.mobility = ue.device->GetNode()->GetObject<MobilityModel>();
+            ue.serving = ue.device->GetTargetGnb();
+            ue.updated = ue.mobility->GetPosition();
+            NewHeading(ue);
+            m_index[ue.device] = m_ues.size();
+            m_ues.push_back(ue);
+        }
+        Simulator::Schedule(start, &KpmUeMobility::Step, this);
+    }
+
+    /// The UE was handed over to gnb, which its beams follow from now on.
+    void SetServingGnb(Ptr<NrUeNetDevice> ue, Ptr<NrGnbNetDevice> gnb)
+    {
+        auto it = m_index.find(ue);
+        if (it != m_index.end())
+        {
+            m_ues[it->second].serving = gnb;
+        }
+    }
+
+    /// Ideal beams of the ue and gnb pair on every BWP, as the helper computes them.
+    static void UpdateBeams(Ptr<IdealBeamformingAlgorithm> method,
+                            Ptr<NrUeNetDevice> ue,
+                            Ptr<NrGnbNetDevice> gnb)
+    {
+        uint32_t numBwps = std::min(ue->GetCcMapSize(), gnb->GetCcMapSize());
+        for (uint32_t bwp = 0; bwp < numBwps; ++bwp)
+        {
+            Ptr<NrSpectrumPhy> gnbPhy = gnb->GetPhy(bwp)->GetSpectrumPhy();
+            Ptr<NrSpectrumPhy> uePhy = ue->GetPhy(bwp)->GetSpectrumPhy();
+            BeamformingVectorPair beams = method->GetBeamformingVectors(gnbPhy, uePhy);
+            gnbPhy->GetBeamManager()->SaveBeamformingVector(beams.first, ue);
+            uePhy->GetBeamManager()->SaveBeamformingVector(beams.second, gnb);
+        }
+    }
+
+    /// UEs updated so far, as UE × update, and steps taken.
+    uint64_t GetUpdates() const
+    {
+        return m_updates;
+    }
+
+    uint64_t GetSteps() const
+    {
+        return m_steps;
+    }
+
+  private:
+    struct Ue
+    {
+        Ptr<NrUeNetDevice> device;
+        Ptr<MobilityModel> mobility;
+        Ptr<NrGnbNetDevice> serving;
+        Vector updated;   //!< position of the last update
+        Vector direction; //!< unit vector of the trajectory
+        Vector waypoint;
+    };
+
+    void NewHeading(Ue& ue)
+    {
+        if (m_model == WAYPOINT)
+        {
+            ue.waypoint = Vector(m_random->GetValue(m_area.xMin, m_area.xMax),
+                                 m_random->GetValue(m_area.yMin, m_area.yMax),
+                                 0.0);
+            Vector position = ue.mobility->GetPosition();
+            double dx = ue.waypoint.x - position.x;
+            double dy = ue.waypoint.y - position.y;
+            double length = std::hypot(dx, dy);
+            ue.direction = length > 0 ? Vector(dx / length, dy / length, 0.0) : Vector();
+        }
+        else
+        {
+            double heading = m_random->GetValue(0, 2 * M_PI);
+            ue.direction = Vector(std::cos(heading), std::sin(heading), 0.0);
+        }
+    }
+
+    void Step()
+    {
+        double stride = m_speed * m_step.GetSeconds();
+        for (auto& ue : m_ues)
+        {
+            Vector position = ue.mobility->GetPosition();
+            if (m_model == WAYPOINT &&
+                std::hypot(ue.waypoint.x - position.x, ue.waypoint.y - position.y) <= stride)
+            {
+                position.x = ue.waypoint.x;
+                position.y = ue.waypoint.y;
+                NewHeading(ue);
+            }
+            else
+            {
+                position.x += ue.direction.x * stride;
+                position.y += ue.direction.y * stride;
+                Reflect(position.x, ue.direction.x, m_area.xMin, m_area.xMax);
+                Reflect(position.y, ue.direction.y, m_area.yMin, m_area.yMax);
+            }
+            ue.mobility->SetPosition(position);
+            if (CalculateDistance(position, ue.updated) > m_updateDistance)
+            {
+                Update(ue);
+                ue.updated = position;
+            }
+        }
+        m_steps++;
+        Simulator::Schedule(m_step, &KpmUeMobility::Step, this);
+    }
+
+    static void Reflect(double& coordinate, double& direction, double min, double max)
+    {
+        if (coordinate < min)
+        {
+            coordinate = 2 * min - coordinate;
+            direction = -direction;
+        }
+        else if (coordinate > max)
+        {
+            coordinate = 2 * max - coordinate;
+            direction = -direction;
+        }
+    }
+
+    void Update(const Ue& ue)
+    {
+        if (m_method && ue.serving)
+        {
+            UpdateBeams(m_method, ue.device, ue.serving);
+        }
+        if (!m_moved.IsNull())
+        {
+            m_moved(ue.device);
+        }
+        m_updates++;
+    }
+
+    Model m_model{LINEAR};
+    double m_speed{0.0};
+    Rectangle m_area;
+    Time m_step{MilliSeconds(10)};
+    double m_updateDistance{1.0};
+    Ptr<IdealBeamformingAlgorithm> m_method;
+    Callback<void, Ptr<NrUeNetDevice>> m_moved;
+    Ptr<UniformRandomVariable> m_random;
+    std::vector<Ue> m_ues;
+    std::map<Ptr<NrUeNetDevice>, std::size_t> m_index;
+    uint64_t m_updates{0};
+    uint64_t m_steps{0};
+};
+
+} // namespace ns3
+
+#endif // KPM_MOBILITY_H
@@ -0,0 +1,65 @@
+#include "kpm-rem-render.h"
+#include "kpm-rem-volume.h"
+
+#include "ns3/core-module.h"
+
+#include <chrono>
+#include <iostream>
+#include <list>
+#include <sstream>
+
+using namespace ns3;
+
+/*
+ * Render REM .out files to PNG without gnuplot: each file is read once and
+ * all the metric maps of all the files are rendered in parallel. Volumetric
+ * .vol files are rendered at one height level.
+ *
+ * ./ns3 run "scratch/kpm-rem-render.cc --input=nr-rem-DL_BEAM_SHAPE.out,nr-rem-UL_BEAM_SHAPE.out"
+ */
+
+int
+main(int argc, char* argv[])
+{
+    std::string input = "";
+    uint32_t threads = 0;
+    uint32_t level = 0;
+
+    CommandLine cmd(__FILE__);
+    cmd.AddValue("input", "comma separated REM .out files", input);
+    cmd.AddValue("threads", "rendering threads, 0 for one per core", threads);
+    cmd.AddValue("level", "height level to render from .vol files, 0 for the lowest", level);
+    cmd.Parse(argc, argv);
+
+    auto start = std::chrono::steady_clock::now();
+    // One set of columns per file, kept alive (and in place) until rendered.
+    std::list<std::vector<std::vector<double>>> columns;
+    std::vector<KpmRemPlot> plots;
+    std::stringstream inputList(input);
+    std::string filename;
+    while (std::getline(inputList, filename, ','))
+    {
+        columns.emplace_back();
+        bool volume = filename.size() > 4 && filename.compare(filename.size() - 4, 4, ".vol") == 0;
+        if (volume ? !KpmAddRemVolumePlots(filename, level, columns.back(), plots)
+                   : !KpmAddRemFilePlots(filename, columns.back(), plots))
+        {
+            std::cerr << "Can't read REM " << filename << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+    double read = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    if (!KpmRemRenderer::Render(plots, threads))
+    {
+        std::cerr << "Can't write the plots" << std::endl;
+        return EXIT_FAILURE;
+    }
+    double total = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    for (const auto& plot : plots)
+    {
+        std::cout << plot.filename << "\n";
+    }
+    std::cout << plots.size() << " maps, read " << read << " s, total " << total << " s\n";
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,386 @@
+#ifndef KPM_REM_RENDER_H
+#define KPM_REM_RENDER_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace ns3
+{
+
+/// One metric map to render: a grid stored x outer, y inner, as the REM writes it.
+struct KpmRemPlot
+{
+    std::string filename; //!< output PNG
+    uint32_t nx{0};       //!< points along x
+    uint32_t ny{0};       //!< points along y
+    const double* values{nullptr};
+    double min{0.0}; //!< value at the bottom of the palette (cbrange)
+    double max{0.0}; //!< value at the top of the palette (cbrange)
+};
+
+/**
+ * REM renderer writing the metric maps straight to PNG.
+ *
+ * It replaces the gnuplot scripts: the maps are rendered from memory (or
+ * from one read of a REM .out file), every map on its own thread, with the
+ * cbranges and the default pm3d palette (rgbformulae 7,5,15) of the
+ * scripts. Each grid point becomes a square of pixels, y grows upwards, and
+ * a color bar from min to max runs along the right edge. Axes and labels
+ * are not drawn. The PNG is written uncompressed (stored deflate blocks),
+ * which keeps the encoder trivial and fast for any grid size.
+ */
+class KpmRemRenderer
+{
+  public:
+    /// Color bar width and gap to the map, in pixels.
+    static constexpr uint32_t COLOR_BAR = 16;
+
+    /// cbrange of a metric, as in the gnuplot scripts.
+    static void GetRange(const std::string& metric, double& min, double& max)
+    {
+        if (metric.compare(0, 4, "ipsd") == 0)
+        {
+            min = -100;
+            max = -20;
+        }
+        else
+        {
+            min = -5;
+            max = 30;
+        }
+    }
+
+    /// gnuplot's default palette (rgbformulae 7,5,15) at value, clipped to [min, max].
+    static void Color(double value, double min, double max, uint8_t* rgb)
+    {
+        double x = max > min ? (value - min) / (max - min) : 0.0;
+        x = std::isnan(x) ? 0.0 : std::min(1.0, std::max(0.0, x));
+        rgb[0] = static_cast<uint8_t>(std::lround(255 * std::sqrt(x)));
+        rgb[1] = static_cast<uint8_t>(std::lround(255 * x * x * x));
+        rgb[2] = static_cast<uint8_t>(std::lround(255 * std::max(0.0, std::sin(2 * M_PI * x))));
+    }
+
+    /// Render one map; false if the file can't be written.
+    static bool Render(const KpmRemPlot& plot)
+    {
+        uint32_t scale = std::max<uint32_t>(1, 512 / std::max({plot.nx, plot.ny, 1U}));
+        uint32_t mapWidth = plot.nx * scale;
+        uint32_t width = mapWidth + 2 * COLOR_BAR;
+        uint32_t height = plot.ny * scale;
+        std::vector<uint8_t> rgb(static_cast<std::size_t>(width) * height * 3, 255);
+        for (uint32_t row = 0; row < height; ++row)
+        {
+            uint8_t* line = rgb.data() + static_cast<std::size_t>(row) * width * 3;
+            uint32_t j = plot.ny - 1 - row / scale;
+            for (uint32_t i = 0; i < plot.nx; ++i)
+            {
+                Color(plot.values[static_cast<std::size_t>(i) * plot.ny + j],
+                      plot.min,
+                      plot.max,
+                      line + i * scale * 3);
+                for (uint32_t k = 1; k < scale; ++k)
+                {
+                    std::memcpy(line + (i * scale + k) * 3, line + i * scale * 3, 3);
+                }
+            }
+            uint8_t bar[3];
+            Color(plot.max - (plot.max - plot.min) * row / std::max(1U, height - 1),
+                  plot.min,
+                  plot.max,
+                  bar);
+            for (uint32_t k = mapWidth + COLOR_BAR; k < width; ++k)
+            {
+                std::memcpy(line + k * 3, bar, 3);
+            }
+        }
+
+        std::ofstream os(plot.filename.c_str(), std::ios::binary | std::ios::trunc);
+        if (!os.is_open())
+        {
+            return false;
+        }
+        std::vector<uint8_t> png = EncodePng(rgb, width, height);
+        os.write(reinterpret_cast<const char*>(png.data()), png.size());
+        return os.good();
+    }
+
+    /**
+     * Render all maps, numThreads at a time (0 uses one thread per core);
+     * false if any file can't be written.
+     */
+    static bool Render(const std::vector<KpmRemPlot>& plots, unsigned numThreads = 0)
+    {
+        if (numThreads == 0)
+        {
+            numThreads = std::max(1U, std::thread::hardware_concurrency());
+        }
+        numThreads = std::min<unsigned>(numThreads, plots.size());
+        std::atomic<std::size_t> next{0};
+        std::atomic<bool> ok{true};
+        auto worker = [&]() {
+            for (std::size_t p = next++; p < plots.size(); p = next++)
+            {
+                if (!Render(plots[p]))
+                {
+                    ok = false;
+                }
+            }
+        };
+        std::vector<std::thread> threads;
+        for (unsigned t = 1; t < numThreads; ++t)
+        {
+            threads.emplace_back(worker);
+        }
+        worker();
+        for (auto& thread : threads)
+        {
+            thread.join();
+        }
+        return ok;
+    }
+
+    /**
+     * Read a REM .out file in one pass: whitespace-separated numbers, one
+     * point per line, '#' lines skipped. The columns are returned
+     * column-major, names from a leading '#' header if there is one.
+     */
+    static bool ReadColumns(const std::string& filename,
+                            std::vector<std::string>& names,
+                            std::vector<std::vector<double>>& columns)
+    {
+        std::ifstream is(filename.c_str(), std::ios::binary);
+        if (!is.is_open())
+        {
+            return false;
+        }
+        std::string text((std::istreambuf_iterator<char>(is)), std::istreambuf_iterator<char>());
+        names.clear();
+        columns.clear();
+
+        const char* p = text.c_str();
+        const char* end = p + text.size();
+        while (p < end)
+        {
+            const char* eol = static_cast<const char*>(std::memchr(p, '\n', end - p));
+            eol = eol ? eol : end;
+            if (*p == '#')
+            {
+                if (columns.empty())
+                {
+                    names = Split(std::string(p + 1, eol));
+                }
+            }
+            else
+            {
+                // The first point sets the number of columns.
+                bool first = columns.empty();
+                for (std::size_t c = 0; first || c < columns.size(); ++c)
+                {
+                    char* next = nullptr;
+                    double value = std::strtod(p, &next);
+                    if (next == p || next > eol)
+                    {
+                        break;
+                    }
+                    if (first)
+                    {
+                        columns.emplace_back();
+                    }
+                    columns[c].push_back(value);
+                    p = next;
+                }
+            }
+            p = eol + 1;
+        }
+        return !columns.empty();
+    }
+
+    /// Points along y of a grid written x outer: the run length of the first x.
+    static uint32_t CountY(const std::vector<double>& x)
+    {
+        uint32_t ny = 0;
+        while (ny < x.size() && x[ny] == x[0])
+        {
+            ++ny;
+        }
+        return ny;
+    }
+
+  private:
+    static std::vector<std::string> Split(const std::string& line)
+    {
+        std::vector<std::string> fields;
+        std::size_t start = line.find_first_not_of(" \t");
+        while (start != std::string::npos)
+        {
+            std::size_t stop = line.find_first_of(" \t\r", start);
+            fields.push_back(line.substr(start, stop - start));
+            start = line.find_first_not_of(" \t\r", stop);
+        }
+        return fields;
+    }
+
+    static uint32_t Crc32(const uint8_t* data, std::size_t size, uint32_t crc = 0)
+    {
+        static const std::array<uint32_t, 256> table = []() {
+            std::array<uint32_t, 256> t;
+            for (uint32_t n = 0; n < 256; ++n)
+            {
+                uint32_t c = n;
+                for (int k = 0; k < 8; ++k)
+                {
+                    c = (c & 1) ? 0xedb88320U ^ (c >> 1) : c >> 1;
+                }
+                t[n] = c;
+            }
+            return t;
+        }();
+        crc = ~crc;
+        for (std::size_t i = 0; i < size; ++i)
+        {
+            crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+        }
+        return ~crc;
+    }
+
+    static void PutBe32(std::vector<uint8_t>& out, uint32_t value)
+    {
+        out.push_back(value >> 24);
+        out.push_back(value >> 16);
+        out.push_back(value >> 8);
+        out.push_back(value);
+    }
+
+    static void PutChunk(std::vector<uint8_t>& out,
+                         const char* type,
+                         const std::vector<uint8_t>& data)
+    {
+        PutBe32(out, data.size());
+        std::size_t start = out.size();
+        out.insert(out.end(), type, type + 4);
+        out.insert(out.end(), data.begin(), data.end());
+        PutBe32(out, Crc32(out.data() + start, out.size() - start));
+    }
+
+    /// RGB image to PNG, filter type 0 and stored deflate blocks.
+    static std::vector<uint8_t> EncodePng(const std::vector<uint8_t>& rgb,
+                                          uint32_t width,
+                                          uint32_t height)
+    {
+        std::size_t stride = static_cast<std::size_t>(width) * 3;
+        std::size_t rawSize = (stride + 1) * height;
+        const std::size_t maxBlock = 65535;
+
+        std::vector<uint8_t> raw;
+        raw.reserve(rawSize);
+        for (uint32_t row = 0; row < height; ++row)
+        {
+            raw.push_back(0);
+            raw.insert(raw.end(), rgb.begin() + row * stride, rgb.begin() + (row + 1) * stride);
+        }
+
+        std::vector<uint8_t> zlib = {0x78, 0x01};
+        zlib.reserve(rawSize + 5 * (rawSize / maxBlock + 1) + 6);
+        uint32_t a = 1;
+        uint32_t b = 0;
+        for (std::size_t start = 0; start < rawSize; start += maxBlock)
+        {
+            std::size_t len = std::min(maxBlock, rawSize - start);
+            zlib.push_back(start + len >= rawSize ? 1 : 0);
+            zlib.push_back(len & 0xff);
+            zlib.push_back(len >> 8);
+            zlib.push_back(~len & 0xff);
+            zlib.push_back((~len >> 8) & 0xff);
+            zlib.insert(zlib.end(), raw.begin() + start, raw.begin() + start + len);
+            for (std::size_t i = start; i < start + len; ++i)
+            {
+                a = (a + raw[i]) % 65521;
+                b = (b + a) % 65521;
+            }
+        }
+        PutBe32(zlib, (b << 16) | a);
+
+        std::vector<uint8_t> png = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+        std::vector<uint8_t> header;
+        PutBe32(header, width);
+        PutBe32(header, height);
+        header.insert(header.end(), {8, 2, 0, 0, 0}); // 8-bit RGB
+        PutChunk(png, "IHDR", header);
+        PutChunk(png, "IDAT", zlib);
+        PutChunk(png, "IEND", {});
+        return png;
+    }
+};
+
+/**
+ * Render every metric of a REM .out file (the nr helper's single-BWP
+ * format, or KpmRemHelper's multi-band one with its header) to
+ * <file>[-bwp<id>]-<metric>.png next to it. The file is read once and the
+ * maps are appended to plots with their values kept in columns, so that the
+ * maps of several files can be rendered together.
+ */
+inline bool
+KpmAddRemFilePlots(const std::string& filename,
+                   std::vector<std::vector<double>>& columns,
+                   std::vector<KpmRemPlot>& plots)
+{
+    std::vector<std::string> names;
+    if (!KpmRemRenderer::ReadColumns(filename, names, columns) || columns.size() < 4)
+    {
+        return false;
+    }
+    if (names.size() != columns.size())
+    {
+        names = {"x", "y", "z", "snr", "sinr", "ipsd", "sir"};
+    }
+    uint32_t ny = KpmRemRenderer::CountY(columns[0]);
+    if (columns[0].size() % ny != 0)
+    {
+        return false;
+    }
+
+    std::string prefix = filename.substr(0, filename.rfind(".out"));
+    const std::string multiband = "-multiband";
+    if (prefix.size() > multiband.size() &&
+        prefix.compare(prefix.size() - multiband.size(), multiband.size(), multiband) == 0)
+    {
+        prefix.resize(prefix.size() - multiband.size());
+    }
+    for (std::size_t c = 3; c < columns.size() && c < names.size(); ++c)
+    {
+        // snr_bwp1 is written as -bwp1-snr, as the gnuplot scripts name the PDFs.
+        std::string metric = names[c];
+        std::string band;
+        std::size_t separator = metric.find('_');
+        if (separator != std::string::npos)
+        {
+            band = "-" + metric.substr(separator + 1);
+            metric.resize(separator);
+        }
+        if (metric != "snr" && metric != "sinr" && metric != "ipsd" && metric != "sir")
+        {
+            continue; // e.g. the serving transmitter and beam of a beam sweep
+        }
+        KpmRemPlot plot;
+        plot.filename = prefix + band + "-" + metric + ".png";
+        plot.nx = columns[c].size() / ny;
+        plot.ny = ny;
+        plot.values = columns[c].data();
+        KpmRemRenderer::GetRange(metric, plot.min, plot.max);
+        plots.push_back(plot);
+    }
+    return true;
+}
+
+} // namespace ns3
+
+#endif // KPM_REM_RENDER_H
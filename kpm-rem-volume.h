@@ -0,0 +1,349 @@
+#ifndef KPM_REM_VOLUME_H
+#define KPM_REM_VOLUME_H
+
+#include "kpm-rem-render.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <limits>
+#include <string>
+#include <vector>
+
+namespace ns3
+{
+
+/**
+ * Header of a volumetric REM file.
+ *
+ * The volume has nx x ny x nz points: the 2D grid of the REM (x outer, y
+ * inner) repeated at nz heights. Every point holds the SNR, SINR, IPSD and
+ * SIR of each BWP, GetNumMetrics() values in all.
+ */
+struct KpmRemVolumeHeader
+{
+    uint32_t nx{0};
+    uint32_t ny{0};
+    uint32_t nz{0};
+    uint32_t chunk{16}; //!< edge of a brick, in points
+    double xMin{0.0};
+    double xMax{0.0};
+    double yMin{0.0};
+    double yMax{0.0};
+    double zMin{0.0};
+    double zMax{0.0};
+    std::vector<uint16_t> bwpIds;
+    std::vector<double> frequencies; //!< central frequency of each BWP, Hz
+
+    uint32_t GetNumMetrics() const
+    {
+        return static_cast<uint32_t>(bwpIds.size()) * 4;
+    }
+
+    /// Points of the brick along one axis of n points, at brick index c.
+    uint32_t GetBrickSize(uint32_t n, uint32_t c) const
+    {
+        return std::min(chunk, n - c * chunk);
+    }
+
+    uint32_t GetNumBricks(uint32_t n) const
+    {
+        return (n + chunk - 1) / chunk;
+    }
+};
+
+/**
+ * Writer of the chunked volumetric REM layout.
+ *
+ * The volume is cut in bricks of chunk^3 points (truncated at the upper
+ * edges), so that a height slice, a vertical column or a small region reads
+ * a few bricks instead of the whole file. Bricks are stored z outer, then x,
+ * then y; a brick stores each metric in turn as float32, z outer, then x,
+ * then y.
+ *
+ * File layout (native endianness): magic "KPMREMV1", nx, ny, nz, chunk and
+ * the number of BWPs as uint32, the bounds as six doubles, the id (uint16)
+ * and central frequency (double) of each BWP, then the bricks.
+ *
+ * Levels are added bottom-up as they are computed and buffered until a row
+ * of bricks is complete.
+ */
+class KpmRemVolumeWriter
+{
+  public:
+    bool Open(const std::string& filename, const KpmRemVolumeHeader& header)
+    {
+        m_header = header;
+        m_levels = 0;
+        m_buffer.clear();
+        m_os.open(filename.c_str(), std::ios::binary | std::ios::trunc);
+        if (!m_os.is_open())
+        {
+            return false;
+        }
+        m_os.write(MAGIC, sizeof(MAGIC));
+        Write(header.nx);
+        Write(header.ny);
+        Write(header.nz);
+        Write(header.chunk);
+        Write(static_cast<uint32_t>(header.bwpIds.size()));
+        for (double bound :
+             {header.xMin, header.xMax, header.yMin, header.yMax, header.zMin, header.zMax})
+        {
+            Write(bound);
+        }
+        for (std::size_t b = 0; b < header.bwpIds.size(); ++b)
+        {
+            Write(header.bwpIds[b]);
+            Write(header.frequencies[b]);
+        }
+        return m_os.good();
+    }
+
+    /**
+     * Add the next level: metrics[m] points to the nx * ny values of metric
+     * m (SNR, SINR, IPSD, SIR of the first BWP, then of the next one...).
+     */
+    void AddLevel(const std::vector<const double*>& metrics)
+    {
+        std::size_t plane = static_cast<std::size_t>(m_header.nx) * m_header.ny;
+        for (uint32_t m = 0; m < m_header.GetNumMetrics(); ++m)
+        {
+            m_buffer.insert(m_buffer.end(), metrics[m], metrics[m] + plane);
+        }
+        m_levels++;
+        uint32_t levelsInRow = m_header.GetBrickSize(m_header.nz, (m_levels - 1) / m_header.chunk);
+        if ((m_levels - 1) % m_header.chunk + 1 == levelsInRow)
+        {
+            WriteBrickRow(levelsInRow);
+            m_buffer.clear();
+        }
+    }
+
+    /// Close the file; false if a write failed or levels are missing.
+    bool Close()
+    {
+        m_os.close();
+        return !m_os.fail() && m_levels == m_header.nz;
+    }
+
+  private:
+    static constexpr char MAGIC[8] = {'K', 'P', 'M', 'R', 'E', 'M', 'V', '1'};
+
+    template <typename T>
+    void Write(const T& value)
+    {
+        m_os.write(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    /// Write the bricks of the buffered levels; m_buffer is level, metric, x, y.
+    void WriteBrickRow(uint32_t levels)
+    {
+        const KpmRemVolumeHeader& h = m_header;
+        std::size_t plane = static_cast<std::size_t>(h.nx) * h.ny;
+        std::vector<float> brick;
+        for (uint32_t ci = 0; ci < h.GetNumBricks(h.nx); ++ci)
+        {
+            for (uint32_t cj = 0; cj < h.GetNumBricks(h.ny); ++cj)
+            {
+                brick.clear();
+                for (uint32_t m = 0; m < h.GetNumMetrics(); ++m)
+                {
+                    for (uint32_t k = 0; k < levels; ++k)
+                    {
+                        const double* values =
+                            m_buffer.data() + (k * h.GetNumMetrics() + m) * plane;
+                        for (uint32_t i = ci * h.chunk; i < ci * h.chunk + h.GetBrickSize(h.nx, ci);
+                             ++i)
+                        {
+                            const double* row = values + static_cast<std::size_t>(i) * h.ny;
+                            brick.insert(brick.end(),
+                                         row + cj * h.chunk,
+                                         row + cj * h.chunk + h.GetBrickSize(h.ny, cj));
+                        }
+                    }
+                }
+                m_os.write(reinterpret_cast<const char*>(brick.data()),
+                           brick.size() * sizeof(float));
+            }
+        }
+    }
+
+    KpmRemVolumeHeader m_header;
+    std::ofstream m_os;
+    uint32_t m_levels{0};
+    std::vector<double> m_buffer;
+};
+
+/// Reader of the chunked volumetric REM layout, one brick in memory at a time.
+class KpmRemVolumeReader
+{
+  public:
+    bool Open(const std::string& filename)
+    {
+        m_is.open(filename.c_str(), std::ios::binary);
+        char magic[8];
+        if (!m_is.read(magic, sizeof(magic)) ||
+            std::string(magic, sizeof(magic)) != std::string("KPMREMV1", 8))
+        {
+            return false;
+        }
+        KpmRemVolumeHeader& h = m_header;
+        uint32_t numBwps = 0;
+        Read(h.nx);
+        Read(h.ny);
+        Read(h.nz);
+        Read(h.chunk);
+        Read(numBwps);
+        for (double* bound : {&h.xMin, &h.xMax, &h.yMin, &h.yMax, &h.zMin, &h.zMax})
+        {
+            Read(*bound);
+        }
+        h.bwpIds.resize(numBwps);
+        h.frequencies.resize(numBwps);
+        for (uint32_t b = 0; b < numBwps; ++b)
+        {
+            Read(h.bwpIds[b]);
+            Read(h.frequencies[b]);
+        }
+        if (!m_is || h.chunk == 0)
+        {
+            return false;
+        }
+
+        // Bricks have fixed sizes, so their offsets follow from the header.
+        m_offsets.clear();
+        uint64_t offset = m_is.tellg();
+        for (uint32_t ck = 0; ck < h.GetNumBricks(h.nz); ++ck)
+        {
+            for (uint32_t ci = 0; ci < h.GetNumBricks(h.nx); ++ci)
+            {
+                for (uint32_t cj = 0; cj < h.GetNumBricks(h.ny); ++cj)
+                {
+                    m_offsets.push_back(offset);
+                    offset += static_cast<uint64_t>(h.GetBrickSize(h.nz, ck)) *
+                              h.GetBrickSize(h.nx, ci) * h.GetBrickSize(h.ny, cj) *
+                              h.GetNumMetrics() * sizeof(float);
+                }
+            }
+        }
+        m_brick = m_offsets.size();
+        return true;
+    }
+
+    const KpmRemVolumeHeader& GetHeader() const
+    {
+        return m_header;
+    }
+
+    /// Metric m at grid point (i, j) of level k; NaN if the file is short.
+    float Get(uint32_t i, uint32_t j, uint32_t k, uint32_t m)
+    {
+        const KpmRemVolumeHeader& h = m_header;
+        LoadBrick(i / h.chunk, j / h.chunk, k / h.chunk);
+        return m_values[GetIndex(i % h.chunk, j % h.chunk, k % h.chunk, m)];
+    }
+
+    /// Metric m of level k over the whole grid, x outer, y inner; one brick row is read.
+    void ReadLevel(uint32_t k, uint32_t m, std::vector<double>& values)
+    {
+        const KpmRemVolumeHeader& h = m_header;
+        values.resize(static_cast<std::size_t>(h.nx) * h.ny);
+        for (uint32_t ci = 0; ci < h.GetNumBricks(h.nx); ++ci)
+        {
+            for (uint32_t cj = 0; cj < h.GetNumBricks(h.ny); ++cj)
+            {
+                LoadBrick(ci, cj, k / h.chunk);
+                for (uint32_t i = 0; i < m_sx; ++i)
+                {
+                    for (uint32_t j = 0; j < m_sy; ++j)
+                    {
+                        values[static_cast<std::size_t>(ci * h.chunk + i) * h.ny + cj * h.chunk +
+                               j] = m_values[GetIndex(i, j, k % h.chunk, m)];
+                    }
+                }
+            }
+        }
+    }
+
+  private:
+    void LoadBrick(uint32_t ci, uint32_t cj, uint32_t ck)
+    {
+        const KpmRemVolumeHeader& h = m_header;
+        std::size_t brick =
+            (static_cast<std::size_t>(ck) * h.GetNumBricks(h.nx) + ci) * h.GetNumBricks(h.ny) + cj;
+        if (brick == m_brick)
+        {
+            return;
+        }
+        m_sx = h.GetBrickSize(h.nx, ci);
+        m_sy = h.GetBrickSize(h.ny, cj);
+        m_sz = h.GetBrickSize(h.nz, ck);
+        m_values.assign(static_cast<std::size_t>(m_sx) * m_sy * m_sz * h.GetNumMetrics(),
+                        std::numeric_limits<float>::quiet_NaN());
+        m_is.clear();
+        m_is.seekg(m_offsets[brick]);
+        m_is.read(reinterpret_cast<char*>(m_values.data()), m_values.size() * sizeof(float));
+        m_brick = brick;
+    }
+
+    /// Index in the loaded brick of point (i, j, k) relative to its corner.
+    std::size_t GetIndex(uint32_t i, uint32_t j, uint32_t k, uint32_t m) const
+    {
+        return ((static_cast<std::size_t>(m) * m_sz + k) * m_sx + i) * m_sy + j;
+    }
+
+    template <typename T>
+    void Read(T& value)
+    {
+        m_is.read(reinterpret_cast<char*>(&value), sizeof(T));
+    }
+
+    KpmRemVolumeHeader m_header;
+    std::ifstream m_is;
+    std::vector<uint64_t> m_offsets;
+    std::size_t m_brick{0}; //!< index of the loaded brick
+    uint32_t m_sx{0};       //!< size of the loaded brick along x
+    uint32_t m_sy{0};
+    uint32_t m_sz{0};
+    std::vector<float> m_values;
+};
+
+/**
+ * Render every metric of level k of a volumetric REM file to
+ * <file>-z<k>[-bwp<id>]-<metric>.png next to it, with the values kept in
+ * columns as KpmAddRemFilePlots does.
+ */
+inline bool
+KpmAddRemVolumePlots(const std::string& filename,
+                     uint32_t level,
+                     std::vector<std::vector<double>>& columns,
+                     std::vector<KpmRemPlot>& plots)
+{
+    KpmRemVolumeReader reader;
+    if (!reader.Open(filename) || level >= reader.GetHeader().nz)
+    {
+        return false;
+    }
+    const KpmRemVolumeHeader& h = reader.GetHeader();
+    const std::string metrics[] = {"snr", "sinr", "ipsd", "sir"};
+    std::string prefix = filename.substr(0, filename.rfind(".vol")) + "-z" + std::to_string(level);
+    columns.resize(h.GetNumMetrics());
+    for (uint32_t m = 0; m < h.GetNumMetrics(); ++m)
+    {
+        reader.ReadLevel(level, m, columns[m]);
+        std::string band = h.bwpIds.size() > 1 ? "-bwp" + std::to_string(h.bwpIds[m / 4]) : "";
+        KpmRemPlot plot;
+        plot.filename = prefix + band + "-" + metrics[m % 4] + ".png";
+        plot.nx = h.nx;
+        plot.ny = h.ny;
+        plot.values = columns[m].data();
+        KpmRemRenderer::GetRange(metrics[m % 4], plot.min, plot.max);
+        plots.push_back(plot);
+    }
+    return true;
+}
+
+} // namespace ns3
+
+#endif // KPM_REM_VOLUME_H
@@ -0,0 +1,966 @@
+#ifndef KPM_REM_H
+#define KPM_REM_H
+
+#include "kpm-beamforming.h"
+#include "kpm-rem-render.h"
+#include "kpm-rem-volume.h"
+
+#include "ns3/core-module.h"
+#include "ns3/mobility-module.h"
+#include "ns3/nr-module.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace ns3
+{
+
+/// SNR, SINR, IPSD and SIR of one BWP, in the order of the grid points.
+struct KpmRemMap
+{
+    uint16_t bwpId{0};
+    double frequency{0.0};    //!< central frequency, Hz
+    std::vector<double> snr;  //!< dB
+    std::vector<double> sinr; //!< dB
+    std::vector<double> ipsd; //!< interference power, dBm
+    std::vector<double> sir;  //!< dB
+    std::vector<uint32_t> tx;   //!< beam sweep only: serving transmitter
+    std::vector<uint32_t> beam; //!< beam sweep only: its best candidate beam
+
+    void Resize(uint16_t id, double fc, std::size_t n)
+    {
+        bwpId = id;
+        frequency = fc;
+        snr.resize(n);
+        sinr.resize(n);
+        ipsd.resize(n);
+        sir.resize(n);
+    }
+
+    /// Metrics of point i from the serving and interfering powers, in mW.
+    void Set(std::size_t i, double signal, double interference, double noise)
+    {
+        interference = std::max(interference, std::numeric_limits<double>::min());
+        snr[i] = 10 * std::log10(signal / noise);
+        sinr[i] = 10 * std::log10(signal / (noise + interference));
+        ipsd[i] = 10 * std::log10(interference);
+        sir[i] = 10 * std::log10(signal / interference);
+    }
+};
+
+/**
+ * Radio environment map computed with the batched array-gain engine.
+ *
+ * It takes the same parameters and writes the same nr-rem-<simTag>.out
+ * columns (x, y, z, SNR, SINR, IPSD, SIR) as NrRadioEnvironmentMapHelper,
+ * but evaluates each transmitter's beam over the whole grid in one batch,
+ * and can map several BWPs in the same sweep.
+ * Path loss follows 3GPP TR 38.901 UMi-Street Canyon without shadowing
+ * (as configured in the scenario), with LOS and NLOS weighted by the LOS
+ * probability so that the map is deterministic and draws no random numbers.
+ *
+ * The modes follow the nr helper:
+ * - BEAM_SHAPE: transmitters keep their configured beams, the receiver at
+ *   each point is quasi-omni;
+ * - COVERAGE_AREA: every transmitter and the receiver beam towards each
+ *   other at each point;
+ * - UE_COVERAGE: transmitters keep their configured beams, the receiver at
+ *   each point beams towards each transmitter.
+ *
+ * With SetMaxZ and SetResZ the grid is repeated at several heights and each
+ * map is written as a volume (KpmRemVolumeWriter) instead of a .out file.
+ *
+ * Interferers transmit all the time (full buffer) unless SetLoad gives the
+ * fraction of resources a transmitter actually uses on a BWP; the
+ * interference it causes is then scaled by that fraction, while the serving
+ * transmitter's power is not.
+ */
+class KpmRemHelper
+{
+  public:
+    void SetMinX(double xMin)
+    {
+        m_xMin = xMin;
+    }
+
+    void SetMaxX(double xMax)
+    {
+        m_xMax = xMax;
+    }
+
+    void SetResX(uint16_t xRes)
+    {
+        m_xRes = xRes;
+    }
+
+    void SetMinY(double yMin)
+    {
+        m_yMin = yMin;
+    }
+
+    void SetMaxY(double yMax)
+    {
+        m_yMax = yMax;
+    }
+
+    void SetResY(uint16_t yRes)
+    {
+        m_yRes = yRes;
+    }
+
+    void SetZ(double z)
+    {
+        m_z = z;
+    }
+
+    /// Top height of a volumetric map; the bottom one is SetZ.
+    void SetMaxZ(double zMax)
+    {
+        m_zMax = zMax;
+    }
+
+    /// Height steps of a volumetric map, 0 for a map at SetZ only.
+    void SetResZ(uint16_t zRes)
+    {
+        m_zRes = zRes;
+    }
+
+    void SetSimTag(const std::string& simTag)
+    {
+        m_simTag = simTag;
+    }
+
+    void SetRemMode(NrRadioEnvironmentMapHelper::RemMode remMode)
+    {
+        m_remMode = remMode;
+    }
+
+    /// Fraction of the resources of bwpId used by tx, 1 (full buffer) if never set.
+    void SetLoad(const Ptr<NetDevice>& tx, uint16_t bwpId, double load)
+    {
+        m_load[{tx->GetNode()->GetId(), bwpId}] = load;
+    }
+
+    /// Render the maps to PNG instead of writing a gnuplot script.
+    void SetPng(bool png)
+    {
+        m_png = png;
+    }
+
+    /// Number of grid points evaluated by the last CreateRem call.
+    std::size_t GetLastNumPoints() const
+    {
+        return m_lastNumPoints;
+    }
+
+    /// Wall time of the last CreateRem call, in seconds.
+    double GetLastElapsed() const
+    {
+        return m_lastElapsed;
+    }
+
+    /**
+     * Compute the map for the transmitting devices rtdNetDev (gNBs for DL,
+     * UEs for UL) as received by a device configured like rrdDevice placed
+     * at each grid point.
+     */
+    void CreateRem(const NetDeviceContainer& rtdNetDev,
+                   const Ptr<NetDevice>& rrdDevice,
+                   uint16_t bwpId)
+    {
+        CreateRem(rtdNetDev, rrdDevice, std::vector<uint16_t>{bwpId});
+    }
+
+    /**
+     * Compute the maps of several BWPs in one sweep of the grid. The
+     * geometry of every link and the frequency-independent part of its path
+     * loss are computed once for all bands, and so are the beam gains of the
+     * bands whose panels and beams are the same. A single BWP is written in
+     * the nr helper format; several are written to one file with the x, y, z
+     * columns followed by SNR, SINR, IPSD and SIR of each BWP in turn.
+     */
+    void CreateRem(const NetDeviceContainer& rtdNetDev,
+                   const Ptr<NetDevice>& rrdDevice,
+                   const std::vector<uint16_t>& bwpIds)
+    {
+        Compute(rtdNetDev, rrdDevice, bwpIds, {m_remMode}, {m_simTag});
+    }
+
+    /**
+     * Compute the maps of several modes from one sweep: the path gains and
+     * the configured beam gains do not depend on the mode, only the gains
+     * that are applied to them do. Each mode is written as by CreateRem,
+     * with the simulation tag <simTag>_<mode name>.
+     */
+    void CreateRems(const NetDeviceContainer& rtdNetDev,
+                    const Ptr<NetDevice>& rrdDevice,
+                    const std::vector<uint16_t>& bwpIds,
+                    const std::vector<NrRadioEnvironmentMapHelper::RemMode>& remModes)
+    {
+        std::vector<std::string> simTags;
+        for (auto remMode : remModes)
+        {
+            simTags.push_back(m_simTag + "_" + GetModeName(remMode));
+        }
+        Compute(rtdNetDev, rrdDevice, bwpIds, remModes, simTags);
+    }
+
+    /**
+     * Beam-sweep map of the transmitters rtdNetDev: at every point each
+     * transmitter uses the best of its candidate beams, the strongest one
+     * serves and the others interfere with their configured beams, as seen
+     * by a quasi-omni receiver configured like rrdDevice. The candidates of
+     * transmitter t are candidates[t], for its panel (the same on every BWP).
+     * Their responses are computed once per transmitter on the phase table of
+     * the grid, so the cost grows with the distinct beam factors rather than
+     * with the beams (KpmArrayGainEngine::ComputeBestGain). Besides the four
+     * metrics the map records, for each BWP, the serving transmitter and the
+     * index of its best beam.
+     */
+    void CreateBeamSweepRem(const NetDeviceContainer& rtdNetDev,
+                            const Ptr<NetDevice>& rrdDevice,
+                            const std::vector<uint16_t>& bwpIds,
+                            const std::vector<std::vector<KpmArrayGainEngine::Beam>>& candidates)
+    {
+        NS_ABORT_MSG_IF(bwpIds.empty(), "No BWP to compute the REM for");
+        NS_ABORT_MSG_IF(candidates.size() != rtdNetDev.GetN(), "One beam set per transmitter");
+        auto start = std::chrono::steady_clock::now();
+
+        std::vector<Vector> points = GetGridPoints();
+        std::size_t n = points.size();
+        std::size_t numBands = bwpIds.size();
+        uint32_t numTx = rtdNetDev.GetN();
+
+        std::vector<double> rxMaxGain;
+        std::vector<double> noiseMw;
+        std::vector<double> fc;
+        GetReceiver(rrdDevice, bwpIds, rxMaxGain, noiseMw, fc);
+
+        std::vector<std::vector<std::vector<double>>> pathGain(
+            numBands,
+            std::vector<std::vector<double>>(numTx));
+        std::vector<std::vector<const double*>> beamGain(numBands,
+                                                         std::vector<const double*>(numTx));
+        std::vector<std::vector<double>> bestGain(numTx, std::vector<double>(n));
+        std::vector<std::vector<uint32_t>> bestBeam(numTx, std::vector<uint32_t>(n));
+        std::vector<std::vector<double>> load = GetLoads(rtdNetDev, bwpIds);
+        std::vector<std::vector<BandGain>> gains(numTx);
+        Links links;
+        for (uint32_t t = 0; t < numTx; ++t)
+        {
+            Vector txPos = rtdNetDev.Get(t)->GetNode()->GetObject<MobilityModel>()->GetPosition();
+            GetLinks(txPos, points, links);
+            SetHeight(txPos, m_z, links);
+            gains[t].reserve(numBands);
+            for (std::size_t b = 0; b < numBands; ++b)
+            {
+                Ptr<NrPhy> phy = GetPhy(rtdNetDev.Get(t), bwpIds[b]);
+                beamGain[b][t] = GetBeamGain(phy, links, gains[t]);
+                NS_ABORT_MSG_IF(gains[t].back().engine != gains[t].front().engine ||
+                                    gains[t].back().bearing != gains[t].front().bearing,
+                                "Beam sweep needs the same panel on every BWP");
+                GetPathGain(phy, txPos, m_z, fc[b], links, pathGain[b][t]);
+            }
+            // The phase table of the configured beam serves the candidates too.
+            gains[t].front().engine->ComputeBestGain(candidates[t],
+                                                     *gains[t].front().dirs,
+                                                     bestGain[t].data(),
+                                                     bestBeam[t].data());
+        }
+
+        m_maps.assign(numBands, KpmRemMap());
+        for (std::size_t b = 0; b < numBands; ++b)
+        {
+            KpmRemMap& map = m_maps[b];
+            map.Resize(bwpIds[b], fc[b], n);
+            map.tx.resize(n);
+            map.beam.resize(n);
+            for (std::size_t i = 0; i < n; ++i)
+            {
+                uint32_t serving = 0;
+                double best = 0.0;
+                double total = 0.0;
+                for (uint32_t t = 0; t < numTx; ++t)
+                {
+                    double swept = pathGain[b][t][i] * bestGain[t][i];
+                    if (swept > best)
+                    {
+                        best = swept;
+                        serving = t;
+                    }
+                    total += load[b][t] * pathGain[b][t][i] * beamGain[b][t][i];
+                }
+                double interference = total - load[b][serving] * pathGain[b][serving][i] *
+                                                  beamGain[b][serving][i];
+                map.Set(i, best, std::max(interference, 0.0), noiseMw[b]);
+                map.tx[i] = serving;
+                map.beam[i] = bestBeam[serving][i];
+            }
+        }
+        WriteMaps(m_simTag, points);
+        if (m_png)
+        {
+            RenderPng(m_simTag);
+        }
+        else
+        {
+            WriteGnuplotScript(m_simTag);
+        }
+
+        m_lastNumPoints = n;
+        m_lastElapsed =
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    /// Direct-path beams of tx on the panel of bwpId towards each of targets.
+    static std::vector<KpmArrayGainEngine::Beam> GetDirectPathBeams(
+        const Ptr<NetDevice>& tx,
+        uint16_t bwpId,
+        const std::vector<Ptr<NetDevice>>& targets)
+    {
+        Ptr<const UniformPlanarArray> antenna = DynamicCast<const UniformPlanarArray>(
+            GetPhy(tx, bwpId)->GetSpectrumPhy()->GetAntenna());
+        auto engine = KpmGetArrayGainEngine(antenna);
+        Vector txPos = tx->GetNode()->GetObject<MobilityModel>()->GetPosition();
+        std::vector<KpmArrayGainEngine::Beam> beams;
+        for (const auto& target : targets)
+        {
+            double zenith;
+            double azimuth;
+            KpmLocalAngles(txPos,
+                           target->GetNode()->GetObject<MobilityModel>()->GetPosition(),
+                           KpmGetBearing(antenna),
+                           zenith,
+                           azimuth);
+            beams.push_back(engine->DirectPathBeam(zenith, azimuth));
+        }
+        return beams;
+    }
+
+    /// DFT codebook of the panel of tx on bwpId, oversampled in both dimensions.
+    static std::vector<KpmArrayGainEngine::Beam> GetCodebook(const Ptr<NetDevice>& tx,
+                                                             uint16_t bwpId,
+                                                             uint32_t oversampling)
+    {
+        auto engine = KpmGetArrayGainEngine(DynamicCast<const UniformPlanarArray>(
+            GetPhy(tx, bwpId)->GetSpectrumPhy()->GetAntenna()));
+        return engine->DftCodebook(engine->GetNumRows() * oversampling,
+                                   engine->GetNumColumns() * oversampling);
+    }
+
+    /// Name of a mode, as given to the scenario's --mode option.
+    static std::string GetModeName(NrRadioEnvironmentMapHelper::RemMode remMode)
+    {
+        switch (remMode)
+        {
+        case NrRadioEnvironmentMapHelper::BEAM_SHAPE:
+            return "BEAM_SHAPE";
+        case NrRadioEnvironmentMapHelper::COVERAGE_AREA:
+            return "COVERAGE_AREA";
+        case NrRadioEnvironmentMapHelper::UE_COVERAGE:
+            return "UE_COVERAGE";
+        default:
+            return "UNKNOWN";
+        }
+    }
+
+    /// Maps of the last mode computed, one per BWP, in the order requested.
+    const std::vector<KpmRemMap>& GetMaps() const
+    {
+        return m_maps;
+    }
+
+    /// Terms of the UMi path loss that depend on the band and the heights only.
+    struct UmiBand
+    {
+        double dBp;     //!< breakpoint distance, m
+        double losNear; //!< LOS path loss before the breakpoint, less 21 log10(d3D)
+        double losFar;  //!< LOS path loss after the breakpoint, less 40 log10(d3D)
+        double nlos;    //!< NLOS path loss, less 35.3 log10(d3D)
+    };
+
+    static UmiBand UmiBandTerms(double hBs, double hUt, double fc)
+    {
+        double log10FcGHz = std::log10(fc / 1e9);
+        double dBp = 4 * std::max(hBs - 1.0, 0.1) * std::max(hUt - 1.0, 0.1) * fc / 299792458.0;
+        return {dBp,
+                32.4 + 20 * log10FcGHz,
+                32.4 + 20 * log10FcGHz - 9.5 * std::log10(dBp * dBp + (hBs - hUt) * (hBs - hUt)),
+                22.4 + 21.3 * log10FcGHz - 0.3 * (hUt - 1.5)};
+    }
+
+    /// LOS probability of 3GPP TR 38.901 UMi-Street Canyon (Table 7.4.2-1).
+    static double UmiLosProbability(double d2D)
+    {
+        return d2D <= 18.0 ? 1.0 : 18.0 / d2D + std::exp(-d2D / 36.0) * (1 - 18.0 / d2D);
+    }
+
+    /**
+     * Path loss in dB of 3GPP TR 38.901 UMi-Street Canyon (Table 7.4.1-1),
+     * LOS and NLOS combined in the linear domain with the LOS probability of
+     * Table 7.4.2-1.
+     */
+    static double UmiPathLossDb(double d2D, double d3D, double hBs, double hUt, double fc)
+    {
+        return UmiPathLossDb(d2D,
+                             std::log10(std::max(d3D, 1.0)),
+                             UmiLosProbability(d2D),
+                             UmiBandTerms(hBs, hUt, fc));
+    }
+
+    /// Same as above, from the precomputed terms of the link and of the band.
+    static double UmiPathLossDb(double d2D, double log10D3D, double pLos, const UmiBand& band)
+    {
+        double plLos = d2D <= band.dBp ? band.losNear + 21 * log10D3D : band.losFar + 40 * log10D3D;
+        double plNlos = std::max(plLos, band.nlos + 35.3 * log10D3D);
+        double gain =
+            pLos * std::pow(10.0, -plLos / 10) + (1 - pLos) * std::pow(10.0, -plNlos / 10);
+        return -10 * std::log10(gain);
+    }
+
+  private:
+    /**
+     * Maps of every mode at every height. The horizontal geometry of the
+     * links and everything on the transmitter side that does not depend on
+     * the height (phy, panel, maximum gain, transmit power) is prepared once;
+     * per height only the elevation terms, the path loss and the beam gains
+     * are recomputed, and all modes share them.
+     */
+    void Compute(const NetDeviceContainer& rtdNetDev,
+                 const Ptr<NetDevice>& rrdDevice,
+                 const std::vector<uint16_t>& bwpIds,
+                 const std::vector<NrRadioEnvironmentMapHelper::RemMode>& remModes,
+                 const std::vector<std::string>& simTags)
+    {
+        NS_ABORT_MSG_IF(bwpIds.empty(), "No BWP to compute the REM for");
+        auto start = std::chrono::steady_clock::now();
+
+        std::vector<Vector> points = GetGridPoints();
+        std::vector<double> heights = GetHeights();
+        std::size_t n = points.size();
+        std::size_t numBands = bwpIds.size();
+        uint32_t numTx = rtdNetDev.GetN();
+        bool needBeams = std::any_of(remModes.begin(), remModes.end(), [](auto remMode) {
+            return remMode != NrRadioEnvironmentMapHelper::COVERAGE_AREA;
+        });
+
+        std::vector<double> rxMaxGain;
+        std::vector<double> noiseMw;
+        std::vector<double> fc;
+        GetReceiver(rrdDevice, bwpIds, rxMaxGain, noiseMw, fc);
+
+        // Per band and transmitter: transmit power times path gain at every
+        // point in mW, the gain of the configured beam at every point and the
+        // maximum gain of the panel.
+        std::vector<std::vector<std::vector<double>>> pathGain(
+            numBands,
+            std::vector<std::vector<double>>(numTx, std::vector<double>(n)));
+        std::vector<std::vector<const double*>> beamGain(numBands,
+                                                         std::vector<const double*>(numTx));
+        std::vector<std::vector<double>> txMaxGain(numBands, std::vector<double>(numTx));
+        std::vector<std::vector<Ptr<NrPhy>>> phys(numBands, std::vector<Ptr<NrPhy>>(numTx));
+        std::vector<std::vector<double>> load = GetLoads(rtdNetDev, bwpIds);
+        std::vector<Vector> txPos(numTx);
+        std::vector<Links> links(numTx);
+        for (uint32_t t = 0; t < numTx; ++t)
+        {
+            txPos[t] = rtdNetDev.Get(t)->GetNode()->GetObject<MobilityModel>()->GetPosition();
+            GetLinks(txPos[t], points, links[t]);
+            for (std::size_t b = 0; b < numBands; ++b)
+            {
+                phys[b][t] = GetPhy(rtdNetDev.Get(t), bwpIds[b]);
+                txMaxGain[b][t] =
+                    KpmGetArrayGainEngine(DynamicCast<const UniformPlanarArray>(
+                                              phys[b][t]->GetSpectrumPhy()->GetAntenna()))
+                        ->MaxGain();
+            }
+        }
+
+        bool volume = heights.size() > 1;
+        std::vector<KpmRemVolumeWriter> writers(volume ? remModes.size() : 0);
+        for (std::size_t m = 0; m < writers.size(); ++m)
+        {
+            std::string filename = GetVolumeFilename(simTags[m]);
+            NS_ABORT_MSG_IF(!writers[m].Open(filename, GetVolumeHeader(bwpIds, fc)),
+                            "Can't open file " << filename);
+        }
+
+        std::vector<std::vector<BandGain>> gains(numTx);
+        for (double z : heights)
+        {
+            for (uint32_t t = 0; t < numTx; ++t)
+            {
+                SetHeight(txPos[t], z, links[t]);
+                gains[t].clear();
+                for (std::size_t b = 0; b < numBands; ++b)
+                {
+                    if (needBeams)
+                    {
+                        beamGain[b][t] = GetBeamGain(phys[b][t], links[t], gains[t]);
+                    }
+                    GetPathGain(phys[b][t], txPos[t], z, fc[b], links[t], pathGain[b][t]);
+                }
+            }
+
+            for (std::size_t m = 0; m < remModes.size(); ++m)
+            {
+                bool maxTxGain = remModes[m] == NrRadioEnvironmentMapHelper::COVERAGE_AREA;
+                m_maps.assign(numBands, KpmRemMap());
+                for (std::size_t b = 0; b < numBands; ++b)
+                {
+                    double rxGain = remModes[m] == NrRadioEnvironmentMapHelper::BEAM_SHAPE
+                                        ? KpmArrayGainEngine::QuasiOmniGain()
+                                        : rxMaxGain[b];
+                    KpmRemMap& map = m_maps[b];
+                    map.Resize(bwpIds[b], fc[b], n);
+                    for (std::size_t i = 0; i < n; ++i)
+                    {
+                        double best = 0.0;
+                        double bestLoad = 1.0;
+                        double total = 0.0;
+                        for (uint32_t t = 0; t < numTx; ++t)
+                        {
+                            double txGain = maxTxGain ? txMaxGain[b][t] : beamGain[b][t][i];
+                            double rxPower = pathGain[b][t][i] * txGain * rxGain;
+                            if (rxPower > best)
+                            {
+                                best = rxPower;
+                                bestLoad = load[b][t];
+                            }
+                            total += load[b][t] * rxPower;
+                        }
+                        map.Set(i, best, total - bestLoad * best, noiseMw[b]);
+                    }
+                }
+                if (volume)
+                {
+                    std::vector<const double*> metrics;
+                    for (const auto& map : m_maps)
+                    {
+                        metrics.insert(metrics.end(),
+                                       {map.snr.data(),
+                                        map.sinr.data(),
+                                        map.ipsd.data(),
+                                        map.sir.data()});
+                    }
+                    writers[m].AddLevel(metrics);
+                    continue;
+                }
+                WriteMaps(simTags[m], points);
+                if (m_png)
+                {
+                    RenderPng(simTags[m]);
+                }
+                else
+                {
+                    WriteGnuplotScript(simTags[m]);
+                }
+            }
+        }
+        for (std::size_t m = 0; m < writers.size(); ++m)
+        {
+            NS_ABORT_MSG_IF(!writers[m].Close(),
+                            "Can't write file " << GetVolumeFilename(simTags[m]));
+        }
+
+        m_lastNumPoints = n * heights.size();
+        m_lastElapsed =
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    /// Load of every transmitter on every band, [band][transmitter].
+    std::vector<std::vector<double>> GetLoads(const NetDeviceContainer& rtdNetDev,
+                                              const std::vector<uint16_t>& bwpIds) const
+    {
+        std::vector<std::vector<double>> load(bwpIds.size(),
+                                              std::vector<double>(rtdNetDev.GetN(), 1.0));
+        for (std::size_t b = 0; b < bwpIds.size(); ++b)
+        {
+            for (uint32_t t = 0; t < rtdNetDev.GetN(); ++t)
+            {
+                auto it = m_load.find({rtdNetDev.Get(t)->GetNode()->GetId(), bwpIds[b]});
+                if (it != m_load.end())
+                {
+                    load[b][t] = it->second;
+                }
+            }
+        }
+        return load;
+    }
+
+    /// Receiver side of each band: maximum gain of the panel, noise in mW, central frequency.
+    static void GetReceiver(const Ptr<NetDevice>& rrdDevice,
+                            const std::vector<uint16_t>& bwpIds,
+                            std::vector<double>& rxMaxGain,
+                            std::vector<double>& noiseMw,
+                            std::vector<double>& fc)
+    {
+        rxMaxGain.resize(bwpIds.size());
+        noiseMw.resize(bwpIds.size());
+        fc.resize(bwpIds.size());
+        for (std::size_t b = 0; b < bwpIds.size(); ++b)
+        {
+            Ptr<NrPhy> rrdPhy = GetPhy(rrdDevice, bwpIds[b]);
+            rxMaxGain[b] =
+                KpmGetArrayGainEngine(
+                    DynamicCast<const UniformPlanarArray>(rrdPhy->GetSpectrumPhy()->GetAntenna()))
+                    ->MaxGain();
+            DoubleValue noiseFigure;
+            rrdPhy->GetAttribute("NoiseFigure", noiseFigure);
+            double noiseDbm =
+                -174.0 + 10 * std::log10(rrdPhy->GetChannelBandwidth()) + noiseFigure.Get();
+            noiseMw[b] = std::pow(10.0, noiseDbm / 10);
+            fc[b] = rrdPhy->GetCentralFrequency();
+        }
+    }
+
+    /**
+     * Frequency-independent terms of the links from a transmitter to every
+     * point. The horizontal ones are set once by GetLinks, the ones that
+     * depend on the height of the points by SetHeight.
+     */
+    struct Links
+    {
+        std::vector<double> dx;
+        std::vector<double> dy;
+        std::vector<double> d2D;
+        std::vector<double> pLos;
+        double dz{0.0};
+        std::vector<double> d3D;
+        std::vector<double> log10D3D;
+    };
+
+    static void GetLinks(const Vector& txPos, const std::vector<Vector>& points, Links& links)
+    {
+        std::size_t n = points.size();
+        links.dx.resize(n);
+        links.dy.resize(n);
+        links.d2D.resize(n);
+        links.pLos.resize(n);
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            links.dx[i] = points[i].x - txPos.x;
+            links.dy[i] = points[i].y - txPos.y;
+            links.d2D[i] = std::sqrt(links.dx[i] * links.dx[i] + links.dy[i] * links.dy[i]);
+            links.pLos[i] = UmiLosProbability(links.d2D[i]);
+        }
+    }
+
+    static void SetHeight(const Vector& txPos, double z, Links& links)
+    {
+        std::size_t n = links.d2D.size();
+        links.dz = z - txPos.z;
+        links.d3D.resize(n);
+        links.log10D3D.resize(n);
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            links.d3D[i] = std::sqrt(links.d2D[i] * links.d2D[i] + links.dz * links.dz);
+            links.log10D3D[i] = std::log10(std::max(links.d3D[i], 1.0));
+        }
+    }
+
+    /// Transmit power of phy times the path gain of every link to height z, in mW.
+    static void GetPathGain(const Ptr<NrPhy>& phy,
+                            const Vector& txPos,
+                            double z,
+                            double fc,
+                            const Links& links,
+                            std::vector<double>& pathGain)
+    {
+        DoubleValue txPower;
+        phy->GetAttribute("TxPower", txPower);
+        UmiBand band = UmiBandTerms(std::max(txPos.z, z), std::min(txPos.z, z), fc);
+        pathGain.resize(links.d2D.size());
+        for (std::size_t i = 0; i < links.d2D.size(); ++i)
+        {
+            double pathLoss =
+                UmiPathLossDb(links.d2D[i], links.log10D3D[i], links.pLos[i], band);
+            pathGain[i] = std::pow(10.0, (txPower.Get() - pathLoss) / 10);
+        }
+    }
+
+    /// Beam gain of one transmitter over the grid, with what it was computed for.
+    struct BandGain
+    {
+        std::shared_ptr<const KpmArrayGainEngine> engine;
+        double bearing;
+        KpmArrayGainEngine::Weights weights;
+        std::shared_ptr<KpmArrayGainEngine::Directions> dirs;
+        std::vector<double> gain;
+    };
+
+    /**
+     * Gain of the transmitter's configured beam on phy towards every point.
+     * The phase table and the gains already computed for another band of
+     * the same transmitter are reused when the panel and the beam match.
+     */
+    static const double* GetBeamGain(const Ptr<NrPhy>& phy,
+                                     const Links& links,
+                                     std::vector<BandGain>& gains)
+    {
+        Ptr<const UniformPlanarArray> antenna =
+            DynamicCast<const UniformPlanarArray>(phy->GetSpectrumPhy()->GetAntenna());
+        BandGain current;
+        current.engine = KpmGetArrayGainEngine(antenna);
+        current.bearing = KpmGetBearing(antenna);
+        current.weights = KpmFromComplexVector(
+            phy->GetSpectrumPhy()->GetBeamManager()->GetCurrentBeamformingVector());
+
+        for (const auto& previous : gains)
+        {
+            if (previous.engine == current.engine && previous.bearing == current.bearing)
+            {
+                if (previous.weights == current.weights)
+                {
+                    return previous.gain.data();
+                }
+                current.dirs = previous.dirs;
+            }
+        }
+
+        std::size_t n = links.d2D.size();
+        if (!current.dirs)
+        {
+            // Direction cosines in the panel frame straight from the link
+            // vector, as KpmLocalAngles would give without the acos/atan2.
+            std::vector<double> u(n);
+            std::vector<double> v(n);
+            double cosBearing = std::cos(current.bearing);
+            double sinBearing = std::sin(current.bearing);
+            for (std::size_t i = 0; i < n; ++i)
+            {
+                double d = links.d3D[i];
+                u[i] = d > 0 ? (links.dy[i] * cosBearing - links.dx[i] * sinBearing) / d
+                             : -sinBearing;
+                v[i] = d > 0 ? links.dz / d : 0.0;
+            }
+            current.dirs = std::make_shared<KpmArrayGainEngine::Directions>(
+                current.engine->PrepareDirectionCosines(u.data(), v.data(), n));
+        }
+        current.gain.resize(n);
+        current.engine->ComputeGain(current.engine->MakeBeam(current.weights),
+                                    *current.dirs,
+                                    current.gain.data());
+        gains.push_back(std::move(current));
+        return gains.back().gain.data();
+    }
+
+    static Ptr<NrPhy> GetPhy(const Ptr<NetDevice>& device, uint16_t bwpId)
+    {
+        Ptr<NrGnbNetDevice> gnbDevice = DynamicCast<NrGnbNetDevice>(device);
+        if (gnbDevice)
+        {
+            return gnbDevice->GetPhy(bwpId);
+        }
+        Ptr<NrUeNetDevice> ueDevice = DynamicCast<NrUeNetDevice>(device);
+        NS_ABORT_MSG_IF(!ueDevice, "REM devices must be NR gNB or UE devices");
+        return ueDevice->GetPhy(bwpId);
+    }
+
+    /// Grid points in the order of the nr helper: x outer, y inner, bounds included.
+    std::vector<Vector> GetGridPoints() const
+    {
+        std::vector<Vector> points;
+        double xStep = (m_xMax - m_xMin) / m_xRes;
+        double yStep = (m_yMax - m_yMin) / m_yRes;
+        points.reserve((m_xRes + 1) * (m_yRes + 1));
+        for (uint16_t i = 0; i <= m_xRes; ++i)
+        {
+            for (uint16_t j = 0; j <= m_yRes; ++j)
+            {
+                points.emplace_back(m_xMin + i * xStep, m_yMin + j * yStep, m_z);
+            }
+        }
+        return points;
+    }
+
+    /// Heights of the map, bottom-up: m_z only unless a z range is set.
+    std::vector<double> GetHeights() const
+    {
+        std::vector<double> heights;
+        double zStep = m_zRes > 0 ? (m_zMax - m_z) / m_zRes : 0.0;
+        for (uint16_t k = 0; k <= m_zRes; ++k)
+        {
+            heights.push_back(m_z + k * zStep);
+        }
+        return heights;
+    }
+
+    KpmRemVolumeHeader GetVolumeHeader(const std::vector<uint16_t>& bwpIds,
+                                       const std::vector<double>& fc) const
+    {
+        KpmRemVolumeHeader header;
+        header.nx = m_xRes + 1;
+        header.ny = m_yRes + 1;
+        header.nz = m_zRes + 1;
+        header.xMin = m_xMin;
+        header.xMax = m_xMax;
+        header.yMin = m_yMin;
+        header.yMax = m_yMax;
+        header.zMin = m_z;
+        header.zMax = m_zMax;
+        header.bwpIds = bwpIds;
+        header.frequencies = fc;
+        return header;
+    }
+
+    static std::string GetVolumeFilename(const std::string& simTag)
+    {
+        return "nr-rem-" + simTag + ".vol";
+    }
+
+    /// Output file of the maps: the nr helper's for one BWP.
+    std::string GetOutputFilename(const std::string& simTag) const
+    {
+        return "nr-rem-" + simTag + (m_maps.size() > 1 ? "-multiband" : "") + ".out";
+    }
+
+    void WriteMaps(const std::string& simTag, const std::vector<Vector>& points) const
+    {
+        std::string filename = GetOutputFilename(simTag);
+        std::ofstream outFile(filename.c_str(), std::ofstream::out | std::ofstream::trunc);
+        NS_ABORT_MSG_IF(!outFile.is_open(), "Can't open file " << filename);
+        bool sweep = !m_maps.front().beam.empty();
+        if (m_maps.size() > 1 || sweep)
+        {
+            outFile << "# x\ty\tz";
+            for (const auto& map : m_maps)
+            {
+                std::string suffix = m_maps.size() > 1 ? "_bwp" + std::to_string(map.bwpId) : "";
+                outFile << "\tsnr" << suffix << "\tsinr" << suffix << "\tipsd" << suffix << "\tsir"
+                        << suffix;
+                if (sweep)
+                {
+                    outFile << "\ttx" << suffix << "\tbeam" << suffix;
+                }
+            }
+            outFile << "\n";
+        }
+        for (std::size_t i = 0; i < points.size(); ++i)
+        {
+            outFile << points[i].x << "\t" << points[i].y << "\t" << points[i].z << "\t";
+            for (const auto& map : m_maps)
+            {
+                outFile << map.snr[i] << "\t" << map.sinr[i] << "\t" << map.ipsd[i] << "\t"
+                        << map.sir[i] << "\t";
+                if (sweep)
+                {
+                    outFile << map.tx[i] << "\t" << map.beam[i] << "\t";
+                }
+            }
+            outFile << "\n";
+        }
+        outFile.close();
+    }
+
+    /// PNG of every map from memory, with the names of the gnuplot script's PDFs.
+    void RenderPng(const std::string& simTag) const
+    {
+        std::vector<KpmRemPlot> plots;
+        for (const auto& map : m_maps)
+        {
+            std::string prefix = "nr-rem-" + simTag;
+            if (m_maps.size() > 1)
+            {
+                prefix += "-bwp" + std::to_string(map.bwpId);
+            }
+            const std::pair<std::string, const std::vector<double>*> metrics[] = {
+                {"snr", &map.snr},
+                {"sinr", &map.sinr},
+                {"ipsd", &map.ipsd},
+                {"sir", &map.sir}};
+            for (const auto& metric : metrics)
+            {
+                KpmRemPlot plot;
+                plot.filename = prefix + "-" + metric.first + ".png";
+                plot.nx = m_xRes + 1;
+                plot.ny = m_yRes + 1;
+                plot.values = metric.second->data();
+                KpmRemRenderer::GetRange(metric.first, plot.min, plot.max);
+                plots.push_back(plot);
+            }
+        }
+        NS_ABORT_MSG_IF(!KpmRemRenderer::Render(plots), "Can't write the REM plots of " << simTag);
+    }
+
+    /// One script for all maps; with several BWPs the PDFs are named per BWP.
+    void WriteGnuplotScript(const std::string& simTag) const
+    {
+        struct Metric
+        {
+            std::string name;
+            std::string label;
+            std::string range;
+            int column;
+        };
+
+        const Metric metrics[] = {{"snr", "SNR (dB)", "[-5:30]", 4},
+                                  {"sinr", "SINR (dB)", "[-5:30]", 5},
+                                  {"ipsd", "IPSD (dBm)", "[-100:-20]", 6},
+                                  {"sir", "SIR (dB)", "[-5:30]", 7}};
+
+        std::string filename = "nr-rem-" + simTag + "-plot-rem.gnuplot";
+        std::ofstream outFile(filename.c_str(), std::ofstream::out | std::ofstream::trunc);
+        NS_ABORT_MSG_IF(!outFile.is_open(), "Can't open file " << filename);
+        std::size_t columnsPerMap = m_maps.front().beam.empty() ? 4 : 6;
+        for (std::size_t b = 0; b < m_maps.size(); ++b)
+        {
+            std::string prefix = "nr-rem-" + simTag;
+            if (m_maps.size() > 1)
+            {
+                prefix += "-bwp" + std::to_string(m_maps[b].bwpId);
+            }
+            for (const auto& metric : metrics)
+            {
+                outFile << "set xlabel \"x-coordinate (m)\"\n"
+                        << "set ylabel \"y-coordinate (m)\"\n"
+                        << "set cblabel \"" << metric.label << "\"\n"
+                        << "set cblabel offset 3\n"
+                        << "unset key\n"
+                        << "set terminal pdf\n"
+                        << "set output \"" << prefix << "-" << metric.name << ".pdf\"\n"
+                        << "set size ratio -1\n"
+                        << "set cbrange " << metric.range << "\n"
+                        << "set xrange [" << m_xMin << ":" << m_xMax << "]\n"
+                        << "set yrange [" << m_yMin << ":" << m_yMax << "]\n"
+                        << "set xtics font \"Times New Roman,17\"\n"
+                        << "set ytics font \"Times New Roman,17\"\n"
+                        << "set cbtics font \"Times New Roman,17\"\n"
+                        << "set xlabel font \"Times New Roman,17\"\n"
+                        << "set ylabel font \"Times New Roman,17\"\n"
+                        << "set cblabel font \"Times New Roman,17\"\n"
+                        << "plot \"" << GetOutputFilename(simTag) << "\" using ($1):($2):($"
+                        << metric.column + columnsPerMap * b << ") with image\n";
+            }
+        }
+    }
+
+    double m_xMin{0.0};
+    double m_xMax{0.0};
+    uint16_t m_xRes{100};
+    double m_yMin{0.0};
+    double m_yMax{0.0};
+    uint16_t m_yRes{100};
+    double m_z{1.5};
+    double m_zMax{1.5};
+    uint16_t m_zRes{0};
+    std::string m_simTag;
+    NrRadioEnvironmentMapHelper::RemMode m_remMode{NrRadioEnvironmentMapHelper::COVERAGE_AREA};
+    bool m_png{false};
+    std::map<std::pair<uint32_t, uint16_t>, double> m_load; //!< (node id, BWP) to load
+
+    std::vector<KpmRemMap> m_maps;
+    std::size_t m_lastNumPoints{0};
+    double m_lastElapsed{0.0};
+};
+
+} // namespace ns3
+
+#endif // KPM_REM_H
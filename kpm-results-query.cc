@@ -0,0 +1,210 @@
+#include "kpm-results.h"
+
+#include "ns3/core-module.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <map>
+#include <sstream>
+
+using namespace ns3;
+
+/*
+ * Query the results store the scenarios append to: the mean, minimum and
+ * maximum of metrics over the runs that match a filter, grouped by one
+ * parameter (a curve) or two (a surface).
+ *
+ * ./ns3 run "scratch/kpm-results-query.cc --x=power --y=lambdaVideo
+ *   --metrics=meanFlowThroughput,meanFlowDelay --where=scenario=haca-kpm,direction=DL"
+ * ./ns3 run "scratch/kpm-results-query.cc --list"
+ */
+
+namespace
+{
+
+/// Value of a column in a row as a group key: numbers sort numerically.
+struct Key
+{
+    double number{0.0};
+    std::string text;
+
+    bool operator<(const Key& other) const
+    {
+        return number != other.number ? number < other.number : text < other.text;
+    }
+};
+
+Key
+GetKey(const KpmResultsStore& store, const std::string& column, std::size_t row)
+{
+    Key key;
+    if (column.empty())
+    {
+        return key;
+    }
+    if (const std::vector<double>* numbers = store.GetNumbers(column))
+    {
+        // Runs without the column sort last.
+        key.number = std::isnan((*numbers)[row]) ? INFINITY : (*numbers)[row];
+        std::ostringstream text;
+        text << (*numbers)[row];
+        key.text = text.str();
+    }
+    else if (const std::vector<std::string>* text = store.GetText(column))
+    {
+        key.text = (*text)[row];
+    }
+    return key;
+}
+
+struct Summary
+{
+    std::size_t count{0};
+    double sum{0.0};
+    double min{INFINITY};
+    double max{-INFINITY};
+};
+
+} // namespace
+
+int
+main(int argc, char* argv[])
+{
+    std::string db = "./kpm-out/results.kpmdb";
+    std::string x = "power";
+    std::string y = "";
+    std::string metrics = "meanFlowThroughput,meanFlowDelay";
+    std::string where = "";
+    bool list = false;
+
+    CommandLine cmd(__FILE__);
+    cmd.AddValue("db", "results store", db);
+    cmd.AddValue("x", "parameter to group by", x);
+    cmd.AddValue("y", "second parameter to group by, for a surface", y);
+    cmd.AddValue("metrics", "comma separated number columns to summarize", metrics);
+    cmd.AddValue("where", "comma separated column=value filters", where);
+    cmd.AddValue("list", "list the columns and the number of runs", list);
+    cmd.Parse(argc, argv);
+
+    KpmResultsStore store;
+    if (!store.Load(db))
+    {
+        std::cerr << "Can't read results store " << db << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (store.GetNumSkipped() > 0)
+    {
+        std::cerr << store.GetNumSkipped() << " corrupt records skipped" << std::endl;
+    }
+
+    if (list)
+    {
+        std::vector<std::string> text;
+        std::vector<std::string> numbers;
+        store.GetColumns(text, numbers);
+        std::cout << store.GetNumRows() << " runs\ntext:";
+        for (const auto& name : text)
+        {
+            std::cout << " " << name;
+        }
+        std::cout << "\nnumbers:";
+        for (const auto& name : numbers)
+        {
+            std::cout << " " << name;
+        }
+        std::cout << "\n";
+        return EXIT_SUCCESS;
+    }
+
+    // Rows that match every filter; numbers compare by value, so 35 matches 35.0.
+    std::vector<bool> selected(store.GetNumRows(), true);
+    std::stringstream filters(where);
+    std::string filter;
+    while (std::getline(filters, filter, ','))
+    {
+        std::size_t equals = filter.find('=');
+        if (equals == std::string::npos)
+        {
+            std::cerr << "Invalid filter " << filter << std::endl;
+            return EXIT_FAILURE;
+        }
+        std::string column = filter.substr(0, equals);
+        std::string value = filter.substr(equals + 1);
+        bool numeric = store.GetNumbers(column) != nullptr;
+        double number = numeric ? std::stod(value) : 0.0;
+        for (std::size_t row = 0; row < store.GetNumRows(); ++row)
+        {
+            Key key = GetKey(store, column, row);
+            selected[row] = selected[row] && (numeric ? key.number == number : key.text == value);
+        }
+    }
+
+    std::vector<std::string> metricNames;
+    std::vector<const std::vector<double>*> metricColumns;
+    std::stringstream metricList(metrics);
+    std::string metric;
+    while (std::getline(metricList, metric, ','))
+    {
+        const std::vector<double>* column = store.GetNumbers(metric);
+        if (!column)
+        {
+            std::cerr << "No number column " << metric << std::endl;
+            return EXIT_FAILURE;
+        }
+        metricNames.push_back(metric);
+        metricColumns.push_back(column);
+    }
+
+    std::map<std::pair<Key, Key>, std::vector<Summary>> groups;
+    for (std::size_t row = 0; row < store.GetNumRows(); ++row)
+    {
+        if (!selected[row])
+        {
+            continue;
+        }
+        std::vector<Summary>& summaries =
+            groups[{GetKey(store, x, row), GetKey(store, y, row)}];
+        summaries.resize(metricColumns.size());
+        for (std::size_t m = 0; m < metricColumns.size(); ++m)
+        {
+            double value = (*metricColumns[m])[row];
+            if (std::isnan(value))
+            {
+                continue;
+            }
+            Summary& summary = summaries[m];
+            summary.count++;
+            summary.sum += value;
+            summary.min = std::min(summary.min, value);
+            summary.max = std::max(summary.max, value);
+        }
+    }
+
+    std::cout << "# " << x << (y.empty() ? "" : "\t" + y);
+    for (const auto& name : metricNames)
+    {
+        std::cout << "\t" << name << "_n\t" << name << "_mean\t" << name << "_min\t" << name
+                  << "_max";
+    }
+    std::cout << "\n";
+    for (const auto& group : groups)
+    {
+        std::cout << group.first.first.text << (y.empty() ? "" : "\t" + group.first.second.text);
+        for (const auto& summary : group.second)
+        {
+            std::cout << "\t" << summary.count;
+            if (summary.count > 0)
+            {
+                std::cout << "\t" << summary.sum / summary.count << "\t" << summary.min << "\t"
+                          << summary.max;
+            }
+            else
+            {
+                std::cout << "\tnan\tnan\tnan";
+            }
+        }
+        std::cout << "\n";
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,296 @@
+#ifndef KPM_RESULTS_H
+#define KPM_RESULTS_H
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <string>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+namespace ns3
+{
+
+/// One run: its parameters and results, as named text and number fields.
+struct KpmResultRow
+{
+    std::vector<std::pair<std::string, std::string>> text;
+    std::vector<std::pair<std::string, double>> numbers;
+
+    void Set(const std::string& name, const std::string& value)
+    {
+        text.emplace_back(name, value);
+    }
+
+    void Set(const std::string& name, double value)
+    {
+        numbers.emplace_back(name, value);
+    }
+};
+
+/**
+ * Append-only store of the results of every run, shared by the scenarios.
+ *
+ * Each run appends one self-describing record, so runs with different
+ * parameter sets (or scenarios) live in the same file and no schema has to
+ * be agreed on. A record is written with a single write(2) on a file opened
+ * with O_APPEND, so runs of a sweep can append concurrently. Load reads the
+ * whole file once into one column per field name, with NaN or an empty
+ * string where a row lacks the field, which is what the queries scan.
+ *
+ * Record layout (native endianness): magic "KPMR", payload length (uint32),
+ * payload, CRC-32 of the payload. The payload is the number of text fields
+ * (uint16), each as name and value, then the number of number fields
+ * (uint16), each as name and double; strings are a uint16 length and the
+ * bytes. Records that are torn or corrupt are skipped.
+ */
+class KpmResultsStore
+{
+  public:
+    /// Append row to filename, creating the file if needed.
+    static bool Append(const std::string& filename, const KpmResultRow& row)
+    {
+        std::string payload;
+        PutU16(payload, row.text.size());
+        for (const auto& field : row.text)
+        {
+            PutString(payload, field.first);
+            PutString(payload, field.second);
+        }
+        PutU16(payload, row.numbers.size());
+        for (const auto& field : row.numbers)
+        {
+            PutString(payload, field.first);
+            payload.append(reinterpret_cast<const char*>(&field.second), sizeof(double));
+        }
+        std::string record(MAGIC, sizeof(MAGIC));
+        PutU32(record, payload.size());
+        record += payload;
+        PutU32(record, Crc32(payload));
+
+        int fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (fd < 0)
+        {
+            return false;
+        }
+        bool written = ::write(fd, record.data(), record.size()) ==
+                       static_cast<ssize_t>(record.size());
+        return ::close(fd) == 0 && written;
+    }
+
+    /// Read every record of filename into columns; false if it can't be read.
+    bool Load(const std::string& filename)
+    {
+        m_rows = 0;
+        m_numbers.clear();
+        m_text.clear();
+        m_skipped = 0;
+        std::ifstream is(filename.c_str(), std::ios::binary);
+        if (!is.is_open())
+        {
+            return false;
+        }
+        std::string data((std::istreambuf_iterator<char>(is)), std::istreambuf_iterator<char>());
+        std::size_t pos = 0;
+        while (pos + sizeof(MAGIC) + 8 <= data.size())
+        {
+            uint32_t length = 0;
+            std::memcpy(&length, data.data() + pos + sizeof(MAGIC), sizeof(length));
+            std::size_t end = pos + sizeof(MAGIC) + 4 + length + 4;
+            bool valid =
+                std::memcmp(data.data() + pos, MAGIC, sizeof(MAGIC)) == 0 && end <= data.size();
+            if (valid)
+            {
+                uint32_t crc = 0;
+                std::memcpy(&crc, data.data() + end - 4, sizeof(crc));
+                std::string payload = data.substr(pos + sizeof(MAGIC) + 4, length);
+                valid = crc == Crc32(payload) && AddRow(payload);
+            }
+            if (!valid)
+            {
+                // Resynchronize on the next record.
+                m_skipped++;
+                pos = data.find(std::string(MAGIC, sizeof(MAGIC)), pos + 1);
+                if (pos == std::string::npos)
+                {
+                    break;
+                }
+                continue;
+            }
+            pos = end;
+        }
+        return true;
+    }
+
+    std::size_t GetNumRows() const
+    {
+        return m_rows;
+    }
+
+    /// Records that could not be read by the last Load.
+    std::size_t GetNumSkipped() const
+    {
+        return m_skipped;
+    }
+
+    /// Number column, NaN in rows without it; nullptr if no row has it.
+    const std::vector<double>* GetNumbers(const std::string& name) const
+    {
+        auto it = m_numbers.find(name);
+        return it == m_numbers.end() ? nullptr : &it->second;
+    }
+
+    /// Text column, empty in rows without it; nullptr if no row has it.
+    const std::vector<std::string>* GetText(const std::string& name) const
+    {
+        auto it = m_text.find(name);
+        return it == m_text.end() ? nullptr : &it->second;
+    }
+
+    /// Names of the text and the number columns.
+    void GetColumns(std::vector<std::string>& text, std::vector<std::string>& numbers) const
+    {
+        for (const auto& column : m_text)
+        {
+            text.push_back(column.first);
+        }
+        for (const auto& column : m_numbers)
+        {
+            numbers.push_back(column.first);
+        }
+    }
+
+  private:
+    static constexpr char MAGIC[4] = {'K', 'P', 'M', 'R'};
+
+    static void PutU16(std::string& out, std::size_t value)
+    {
+        uint16_t v = static_cast<uint16_t>(value);
+        out.append(reinterpret_cast<const char*>(&v), sizeof(v));
+    }
+
+    static void PutU32(std::string& out, std::size_t value)
+    {
+        uint32_t v = static_cast<uint32_t>(value);
+        out.append(reinterpret_cast<const char*>(&v), sizeof(v));
+    }
+
+    static void PutString(std::string& out, const std::string& value)
+    {
+        PutU16(out, value.size());
+        out += value;
+    }
+
+    static uint32_t Crc32(const std::string& data)
+    {
+        uint32_t crc = 0xffffffff;
+        for (unsigned char c : data)
+        {
+            crc ^= c;
+            for (int k = 0; k < 8; ++k)
+            {
+                crc = (crc >> 1) ^ (0xedb88320 & (0 - (crc & 1)));
+            }
+        }
+        return ~crc;
+    }
+
+    /// Cursor over a payload that fails, rather than overruns, on short input.
+    struct Reader
+    {
+        const std::string& data;
+        std::size_t pos{0};
+        bool ok{true};
+
+        bool Read(void* out, std::size_t size)
+        {
+            ok = ok && pos + size <= data.size();
+            if (ok)
+            {
+                std::memcpy(out, data.data() + pos, size);
+                pos += size;
+            }
+            return ok;
+        }
+
+        uint16_t ReadU16()
+        {
+            uint16_t v = 0;
+            Read(&v, sizeof(v));
+            return v;
+        }
+
+        std::string ReadString()
+        {
+            uint16_t size = ReadU16();
+            ok = ok && pos + size <= data.size();
+            if (!ok)
+            {
+                return "";
+            }
+            pos += size;
+            return data.substr(pos - size, size);
+        }
+    };
+
+    bool AddRow(const std::string& payload)
+    {
+        Reader reader{payload};
+        KpmResultRow row;
+        for (uint16_t i = reader.ReadU16(); reader.ok && i > 0; --i)
+        {
+            std::string name = reader.ReadString();
+            row.Set(name, reader.ReadString());
+        }
+        for (uint16_t i = reader.ReadU16(); reader.ok && i > 0; --i)
+        {
+            std::string name = reader.ReadString();
+            double value = 0.0;
+            reader.Read(&value, sizeof(value));
+            row.Set(name, value);
+        }
+        if (!reader.ok || reader.pos != payload.size())
+        {
+            return false;
+        }
+
+        for (const auto& field : row.text)
+        {
+            std::vector<std::string>& column = m_text[field.first];
+            column.resize(m_rows + 1);
+            column[m_rows] = field.second;
+        }
+        for (const auto& field : row.numbers)
+        {
+            std::vector<double>& column = m_numbers[field.first];
+            column.resize(m_rows + 1, std::numeric_limits<double>::quiet_NaN());
+            column[m_rows] = field.second;
+        }
+        m_rows++;
+        // Columns missing from this row are padded so all have m_rows entries.
+        for (auto& column : m_text)
+        {
+            column.second.resize(m_rows);
+        }
+        for (auto& column : m_numbers)
+        {
+            column.second.resize(m_rows, std::numeric_limits<double>::quiet_NaN());
+        }
+        return true;
+    }
+
+    std::size_t m_rows{0};
+    std::size_t m_skipped{0};
+    std::map<std::string, std::vector<double>> m_numbers;
+    std::map<std::string, std::vector<std::string>> m_text;
+};
+
+} // namespace ns3
+
+#endif // KPM_RESULTS_H
@@ -0,0 +1,461 @@
+#ifndef KPM_SCHEDULER_H
+#define KPM_SCHEDULER_H
+
+#include "ns3/core-module.h"
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <vector>
+
+namespace ns3
+{
+
+/**
+ * Bucketed timing-wheel event scheduler.
+ *
+ * The wheel covers NumBuckets * BucketWidth of simulated time starting at
+ * the bucket of the earliest pending event. Events inside that window go to
+ * the bucket of their timestamp, where they almost always land at the back
+ * because the scenario's events are strictly periodic (slot boundaries,
+ * symbols, UDP sends), so insertion and removal are O(1). Events beyond the
+ * window (application stop, RRC timers, ...) wait in an ordered overflow map
+ * and are moved into the wheel as it turns. An empty bucket is an empty
+ * vector, which allocates nothing, so a large wheel only costs memory where
+ * events are.
+ */
+class KpmTimingWheelScheduler : public Scheduler
+{
+  public:
+    static TypeId GetTypeId()
+    {
+        static TypeId tid =
+            TypeId("ns3::KpmTimingWheelScheduler")
+                .SetParent<Scheduler>()
+                .AddConstructor<KpmTimingWheelScheduler>()
+                .AddAttribute("BucketWidth",
+                              "Simulated time covered by one bucket",
+                              TimeValue(MicroSeconds(5)),
+                              MakeTimeAccessor(&KpmTimingWheelScheduler::SetBucketWidth,
+                                               &KpmTimingWheelScheduler::GetBucketWidth),
+                              MakeTimeChecker(TimeStep(1)))
+                .AddAttribute("NumBuckets",
+                              "Number of buckets, rounded up to a power of two",
+                              UintegerValue(256),
+                              MakeUintegerAccessor(&KpmTimingWheelScheduler::SetNumBuckets,
+                                                   &KpmTimingWheelScheduler::GetNumBuckets),
+                              MakeUintegerChecker<uint32_t>(1));
+        return tid;
+    }
+
+    /**
+     * Bucket width and count for a workload whose shortest period is
+     * minPeriod and longest is maxPeriod: one bucket per NR symbol of the
+     * shortest period, enough buckets to hold a few of the longest periods,
+     * at most 65536. Beyond that the longest periods are sparse application
+     * events, which the overflow map takes.
+     */
+    static void Size(Time minPeriod, Time maxPeriod, Time& bucketWidth, uint32_t& numBuckets)
+    {
+        const int64_t symbolsPerSlot = 14;
+        const int64_t periodsInWindow = 4;
+        const int64_t maxBuckets = 1 << 16;
+        bucketWidth = TimeStep(std::max<int64_t>(1, minPeriod.GetTimeStep() / symbolsPerSlot));
+        int64_t window = periodsInWindow * maxPeriod.GetTimeStep();
+        numBuckets = static_cast<uint32_t>(
+            std::min<int64_t>(maxBuckets,
+                              (window + bucketWidth.GetTimeStep() - 1) /
+                                  bucketWidth.GetTimeStep()));
+    }
+
+    void SetBucketWidth(Time bucketWidth)
+    {
+        NS_ABORT_MSG_IF(m_size > 0, "BucketWidth must be set before scheduling events");
+        m_width = static_cast<uint64_t>(bucketWidth.GetTimeStep());
+    }
+
+    Time GetBucketWidth() const
+    {
+        return TimeStep(m_width);
+    }
+
+    void SetNumBuckets(uint32_t numBuckets)
+    {
+        NS_ABORT_MSG_IF(m_size > 0, "NumBuckets must be set before scheduling events");
+        uint32_t n = 1;
+        while (n < numBuckets)
+        {
+            n <<= 1;
+        }
+        m_buckets.assign(n, Bucket());
+        m_mask = n - 1;
+    }
+
+    uint32_t GetNumBuckets() const
+    {
+        return static_cast<uint32_t>(m_buckets.size());
+    }
+
+    void Insert(const Event& ev) override
+    {
+        if (m_size == 0 && m_overflow.empty())
+        {
+            m_base = Slot(ev.key.m_ts);
+        }
+        if (Slot(ev.key.m_ts) < m_base)
+        {
+            // Only possible right after the wheel jumped ahead to the
+            // overflow; rewind so that every pending event stays in the window.
+            Rewind(Slot(ev.key.m_ts));
+        }
+        if (Slot(ev.key.m_ts) < m_base + m_buckets.size())
+        {
+            InsertInBucket(ev);
+        }
+        else
+        {
+            m_overflow.insert(std::make_pair(ev.key, ev.impl));
+        }
+    }
+
+    bool IsEmpty() const override
+    {
+        return m_size == 0 && m_overflow.empty();
+    }
+
+    Event PeekNext() const override
+    {
+        NS_ASSERT(!IsEmpty());
+        const Bucket& bucket = m_buckets[FirstNonEmpty()];
+        return bucket.Front();
+    }
+
+    Event RemoveNext() override
+    {
+        NS_ASSERT(!IsEmpty());
+        uint64_t index = FirstNonEmpty();
+        Bucket& bucket = m_buckets[index];
+        Event ev = bucket.Front();
+        bucket.PopFront();
+        m_size--;
+        return ev;
+    }
+
+    void Remove(const Event& ev) override
+    {
+        uint64_t slot = Slot(ev.key.m_ts);
+        if (slot >= m_base && slot < m_base + m_buckets.size())
+        {
+            Bucket& bucket = m_buckets[slot & m_mask];
+            for (auto it = bucket.events.begin() + bucket.head; it != bucket.events.end(); ++it)
+            {
+                if (it->key.m_uid == ev.key.m_uid)
+                {
+                    bucket.events.erase(it);
+                    if (bucket.IsEmpty())
+                    {
+                        bucket.Clear();
+                    }
+                    m_size--;
+                    return;
+                }
+            }
+        }
+        auto it = m_overflow.find(ev.key);
+        NS_ASSERT(it != m_overflow.end());
+        m_overflow.erase(it);
+    }
+
+  private:
+    /// Events of one bucket in timestamp order, from head on.
+    struct Bucket
+    {
+        std::vector<Event> events;
+        std::size_t head{0};
+
+        bool IsEmpty() const
+        {
+            return head == events.size();
+        }
+
+        std::size_t GetSize() const
+        {
+            return events.size() - head;
+        }
+
+        const Event& Front() const
+        {
+            return events[head];
+        }
+
+        /// Consume the front event; the storage is reused once all are consumed.
+        void PopFront()
+        {
+            if (++head == events.size())
+            {
+                Clear();
+            }
+        }
+
+        void Clear()
+        {
+            events.clear();
+            head = 0;
+        }
+    };
+
+    struct EventKeyCompare
+    {
+        bool operator()(const EventKey& a, const EventKey& b) const
+        {
+            return a < b;
+        }
+    };
+
+    uint64_t Slot(uint64_t ts) const
+    {
+        return ts / m_width;
+    }
+
+    void InsertInBucket(const Event& ev)
+    {
+        Bucket& bucket = m_buckets[Slot(ev.key.m_ts) & m_mask];
+        auto first = bucket.events.begin() + bucket.head;
+        auto it = bucket.events.end();
+        while (it != first && ev.key < (it - 1)->key)
+        {
+            --it;
+        }
+        bucket.events.insert(it, ev);
+        m_size++;
+    }
+
+    /**
+     * Index of the bucket holding the next event, turning the wheel (and
+     * refilling it from the overflow) as needed.
+     */
+    uint64_t FirstNonEmpty() const
+    {
+        auto self = const_cast<KpmTimingWheelScheduler*>(this);
+        while (true)
+        {
+            if (m_size == 0)
+            {
+                // Jump straight to the earliest overflow event.
+                self->m_base = Slot(m_overflow.begin()->first.m_ts);
+                self->Refill();
+                continue;
+            }
+            if (!m_buckets[m_base & m_mask].IsEmpty())
+            {
+                return m_base & m_mask;
+            }
+            self->m_base++;
+            self->Refill();
+        }
+    }
+
+    /// Move the overflow events that entered the window into their buckets.
+    void Refill()
+    {
+        uint64_t end = m_base + m_buckets.size();
+        while (!m_overflow.empty() && Slot(m_overflow.begin()->first.m_ts) < end)
+        {
+            Event ev;
+            ev.key = m_overflow.begin()->first;
+            ev.impl = m_overflow.begin()->second;
+            m_overflow.erase(m_overflow.begin());
+            InsertInBucket(ev);
+        }
+    }
+
+    /// Move the window back to start at slot, spilling events that fall out.
+    void Rewind(uint64_t slot)
+    {
+        uint64_t end = slot + m_buckets.size();
+        for (uint64_t s = std::max(end, m_base); s < m_base + m_buckets.size(); ++s)
+        {
+            Bucket& bucket = m_buckets[s & m_mask];
+            for (auto it = bucket.events.begin() + bucket.head; it != bucket.events.end(); ++it)
+            {
+                m_overflow.insert(std::make_pair(it->key, it->impl));
+            }
+            m_size -= bucket.GetSize();
+            bucket.Clear();
+        }
+        m_base = slot;
+    }
+
+    uint64_t m_width{5000};
+    uint64_t m_mask{255};
+    uint64_t m_base{0};
+    uint64_t m_size{0};
+    std::vector<Bucket> m_buckets{256};
+    std::map<EventKey, EventImpl*, EventKeyCompare> m_overflow;
+};
+
+NS_OBJECT_ENSURE_REGISTERED(KpmTimingWheelScheduler);
+
+/**
+ * Event scheduler that counts the events executed per node (the context
+ * the event runs in) and leaves the ordering to the scheduler it wraps, to
+ * find the nodes whose event processing dominates a run.
+ *
+ * The counts are shared by all instances, since the simulator does not
+ * hand its scheduler out, and constructing one resets them, so that they
+ * cover a single run. Events without a node context are counted apart.
+ */
+class KpmNodeLoadScheduler : public Scheduler
+{
+  public:
+    static TypeId GetTypeId()
+    {
+        static TypeId tid =
+            TypeId("ns3::KpmNodeLoadScheduler")
+                .SetParent<Scheduler>()
+                .AddConstructor<KpmNodeLoadScheduler>()
+                .AddAttribute("Scheduler",
+                              "Factory of the scheduler that orders the events",
+                              ObjectFactoryValue(),
+                              MakeObjectFactoryAccessor(&KpmNodeLoadScheduler::m_factory),
+                              MakeObjectFactoryChecker());
+        return tid;
+    }
+
+    KpmNodeLoadScheduler()
+    {
+        Counts().clear();
+        Other() = 0;
+    }
+
+    /// Factory of a KpmNodeLoadScheduler wrapping the scheduler of factory.
+    static ObjectFactory Wrap(const ObjectFactory& factory)
+    {
+        ObjectFactory wrapper;
+        wrapper.SetTypeId(GetTypeId());
+        wrapper.Set("Scheduler", ObjectFactoryValue(factory));
+        return wrapper;
+    }
+
+    /// Events executed so far per node ID.
+    static const std::vector<uint64_t>& GetNodeEvents()
+    {
+        return Counts();
+    }
+
+    /// Events executed so far without a node context.
+    static uint64_t GetOtherEvents()
+    {
+        return Other();
+    }
+
+    void Insert(const Event& ev) override
+    {
+        m_scheduler->Insert(ev);
+    }
+
+    bool IsEmpty() const override
+    {
+        return m_scheduler->IsEmpty();
+    }
+
+    Event PeekNext() const override
+    {
+        return m_scheduler->PeekNext();
+    }
+
+    Event RemoveNext() override
+    {
+        Event ev = m_scheduler->RemoveNext();
+        uint32_t context = ev.key.m_context;
+        if (context == Simulator::NO_CONTEXT)
+        {
+            Other()++;
+        }
+        else
+        {
+            std::vector<uint64_t>& counts = Counts();
+            if (context >= counts.size())
+            {
+                counts.resize(context + 1, 0);
+            }
+            counts[context]++;
+        }
+        return ev;
+    }
+
+    void Remove(const Event& ev) override
+    {
+        m_scheduler->Remove(ev);
+    }
+
+  protected:
+    void NotifyConstructionCompleted() override
+    {
+        m_scheduler = m_factory.Create<Scheduler>();
+        Scheduler::NotifyConstructionCompleted();
+    }
+
+  private:
+    static std::vector<uint64_t>& Counts()
+    {
+        static std::vector<uint64_t> counts;
+        return counts;
+    }
+
+    static uint64_t& Other()
+    {
+        static uint64_t other = 0;
+        return other;
+    }
+
+    ObjectFactory m_factory;
+    Ptr<Scheduler> m_scheduler;
+};
+
+NS_OBJECT_ENSURE_REGISTERED(KpmNodeLoadScheduler);
+
+/**
+ * Scheduler factory for the --scheduler option: map (the ns-3 default),
+ * heap, list, calendar or wheel. The wheel is sized from the shortest and
+ * longest periods of the scenario's events.
+ */
+inline ObjectFactory
+KpmSchedulerFactory(const std::string& scheduler, Time minPeriod, Time maxPeriod)
+{
+    ObjectFactory factory;
+    if (scheduler == "map")
+    {
+        factory.SetTypeId(MapScheduler::GetTypeId());
+    }
+    else if (scheduler == "heap")
+    {
+        factory.SetTypeId(HeapScheduler::GetTypeId());
+    }
+    else if (scheduler == "list")
+    {
+        factory.SetTypeId(ListScheduler::GetTypeId());
+    }
+    else if (scheduler == "calendar")
+    {
+        factory.SetTypeId(CalendarScheduler::GetTypeId());
+    }
+    else if (scheduler == "wheel")
+    {
+        Time bucketWidth;
+        uint32_t numBuckets;
+        KpmTimingWheelScheduler::Size(minPeriod, maxPeriod, bucketWidth, numBuckets);
+        factory.SetTypeId(KpmTimingWheelScheduler::GetTypeId());
+        factory.Set("BucketWidth", TimeValue(bucketWidth));
+        factory.Set("NumBuckets", UintegerValue(numBuckets));
+    }
+    else
+    {
+        NS_ABORT_MSG("Unknown scheduler " << scheduler);
+    }
+    return factory;
+}
+
+} // namespace ns3
+
+#endif // KPM_SCHEDULER_H
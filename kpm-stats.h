@@ -0,0 +1,918 @@
+#ifndef KPM_STATS_H
+#define KPM_STATS_H
+
+#include "ns3/core-module.h"
+#include "ns3/flow-monitor-module.h"
+#include "ns3/nr-module.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <map>
+#include <ostream>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace ns3
+{
+
+/**
+ * Steady-state statistics of the flows.
+ *
+ * The sampler snapshots the FlowMonitor counters every interval and builds
+ * two series: the mean flow throughput and the mean packet delay of each
+ * interval. The warm-up (attach, bearer activation, queues filling) is cut
+ * with the MSER-5 rule on both series, and the results are computed from
+ * the counters accumulated after the cut only. Optionally the run is
+ * stopped as soon as the 95% confidence half-widths of both steady-state
+ * means, from batch means, are within a target fraction of the means.
+ */
+class KpmStatsSampler
+{
+  public:
+    /// MSER batch size.
+    static constexpr uint32_t MSER_BATCH = 5;
+    /// Batches used for the confidence intervals.
+    static constexpr uint32_t CI_BATCHES = 10;
+
+    KpmStatsSampler(Ptr<FlowMonitor> monitor, Time interval)
+        : m_monitor(monitor),
+          m_interval(interval)
+    {
+    }
+
+    virtual ~KpmStatsSampler() = default;
+
+    /// Stop the simulation once both relative half-widths are below target (0 disables).
+    void SetTargetPrecision(double targetPrecision)
+    {
+        m_targetPrecision = targetPrecision;
+    }
+
+    /// Take the first snapshot at start, then one every interval.
+    void Start(Time start)
+    {
+        Simulator::Schedule(start, &KpmStatsSampler::Sample, this);
+    }
+
+    /// Time of the snapshot the steady-state statistics start from.
+    Time GetWarmupEnd() const
+    {
+        return m_snapshots.empty() ? Seconds(0) : m_snapshots[GetWarmupSamples()].time;
+    }
+
+    /// Time of the last snapshot, or of the early stop.
+    Time GetEnd() const
+    {
+        return m_snapshots.empty() ? Seconds(0) : m_snapshots.back().time;
+    }
+
+    bool StoppedEarly() const
+    {
+        return m_stoppedEarly;
+    }
+
+    /// Warm-up length in samples, the larger MSER-5 cut of the two series.
+    uint32_t GetWarmupSamples() const
+    {
+        return std::max(MserTruncation(m_throughput), MserTruncation(m_delay));
+    }
+
+    /**
+     * Statistics accumulated between the end of the warm-up and the last
+     * snapshot, flow by flow. A flow's rxPackets can exceed its txPackets:
+     * packets in flight at the cut are received in the window, sent before it.
+     */
+    FlowMonitor::FlowStatsContainer GetSteadyStateStats() const
+    {
+        FlowMonitor::FlowStatsContainer stats;
+        if (m_snapshots.size() < 2)
+        {
+            return stats;
+        }
+        const Snapshot& first = m_snapshots[GetWarmupSamples()];
+        const Snapshot& last = m_snapshots.back();
+        for (const auto& flow : last.flows)
+        {
+            FlowMonitor::FlowStats& s = stats[flow.first];
+            s = flow.second;
+            auto it = first.flows.find(flow.first);
+            if (it == first.flows.end())
+            {
+                continue;
+            }
+            s.delaySum -= it->second.delaySum;
+            s.jitterSum -= it->second.jitterSum;
+            s.txBytes -= it->second.txBytes;
+            s.rxBytes -= it->second.rxBytes;
+            s.txPackets -= it->second.txPackets;
+            s.rxPackets -= it->second.rxPackets;
+            s.lostPackets -= it->second.lostPackets;
+        }
+        return stats;
+    }
+
+    /**
+     * MSER truncation point of a series, in samples: the number of leading
+     * samples d (a multiple of batch, at most half of the series) that
+     * minimizes the squared standard error of the mean of the rest,
+     * computed over batch means.
+     */
+    static uint32_t MserTruncation(const std::vector<double>& series, uint32_t batch = MSER_BATCH)
+    {
+        std::size_t numBatches = series.size() / batch;
+        if (numBatches < 2)
+        {
+            return 0;
+        }
+        std::vector<double> means(numBatches, 0.0);
+        for (std::size_t b = 0; b < numBatches; ++b)
+        {
+            for (uint32_t i = 0; i < batch; ++i)
+            {
+                means[b] += series[b * batch + i] / batch;
+            }
+        }
+        // Suffix sums give the mean and variance of every tail in O(n).
+        double sum = 0.0;
+        double sumSq = 0.0;
+        double best = std::numeric_limits<double>::max();
+        std::size_t bestD = 0;
+        for (std::size_t d = numBatches; d-- > 0;)
+        {
+            sum += means[d];
+            sumSq += means[d] * means[d];
+            std::size_t n = numBatches - d;
+            if (d > numBatches / 2 || n < 2)
+            {
+                continue;
+            }
+            double mean = sum / n;
+            double mser = std::max(0.0, sumSq / n - mean * mean) / n;
+            if (mser <= best)
+            {
+                best = mser;
+                bestD = d;
+            }
+        }
+        return static_cast<uint32_t>(bestD * batch);
+    }
+
+    /**
+     * Relative 95% confidence half-width of the mean of series[from...],
+     * from CI_BATCHES batch means; infinity if there is not enough data.
+     */
+    static double RelativeHalfWidth(const std::vector<double>& series, std::size_t from)
+    {
+        std::size_t n = series.size() > from ? series.size() - from : 0;
+        std::size_t batch = n / CI_BATCHES;
+        if (batch < 2)
+        {
+            return std::numeric_limits<double>::infinity();
+        }
+        double sum = 0.0;
+        double sumSq = 0.0;
+        for (uint32_t b = 0; b < CI_BATCHES; ++b)
+        {
+            double mean = 0.0;
+            for (std::size_t i = 0; i < batch; ++i)
+            {
+                mean += series[from + b * batch + i] / batch;
+            }
+            sum += mean;
+            sumSq += mean * mean;
+        }
+        double mean = sum / CI_BATCHES;
+        double variance = std::max(0.0, (sumSq - CI_BATCHES * mean * mean) / (CI_BATCHES - 1));
+        // Student t quantile, 97.5%, CI_BATCHES - 1 = 9 degrees of freedom.
+        const double t = 2.262;
+        double halfWidth = t * std::sqrt(variance / CI_BATCHES);
+        return mean != 0.0 ? halfWidth / std::abs(mean)
+                           : std::numeric_limits<double>::infinity();
+    }
+
+  protected:
+    struct Snapshot
+    {
+        Time time;
+        FlowMonitor::FlowStatsContainer flows;
+    };
+
+    void Sample()
+    {
+        m_monitor->CheckForLostPackets();
+        Snapshot snapshot;
+        snapshot.time = Simulator::Now();
+        snapshot.flows = m_monitor->GetFlowStats();
+        if (!m_snapshots.empty())
+        {
+            AddInterval(m_snapshots.back(), snapshot);
+        }
+        m_snapshots.push_back(std::move(snapshot));
+
+        if (m_targetPrecision > 0 && Converged())
+        {
+            m_stoppedEarly = true;
+            Simulator::Stop();
+            return;
+        }
+        Simulator::Schedule(m_interval, &KpmStatsSampler::Sample, this);
+    }
+
+    /// Append the throughput and delay of the interval between two snapshots.
+    virtual void AddInterval(const Snapshot& previous, const Snapshot& current)
+    {
+        double seconds = (current.time - previous.time).GetSeconds();
+        double throughput = 0.0;
+        double delay = 0.0;
+        uint64_t packets = 0;
+        for (const auto& flow : current.flows)
+        {
+            auto it = previous.flows.find(flow.first);
+            uint64_t rxBytes = flow.second.rxBytes;
+            uint64_t rxPackets = flow.second.rxPackets;
+            Time delaySum = flow.second.delaySum;
+            if (it != previous.flows.end())
+            {
+                rxBytes -= it->second.rxBytes;
+                rxPackets -= it->second.rxPackets;
+                delaySum -= it->second.delaySum;
+            }
+            throughput += rxBytes * 8.0 / seconds / 1000 / 1000;
+            delay += 1000 * delaySum.GetSeconds();
+            packets += rxPackets;
+        }
+        m_throughput.push_back(current.flows.empty() ? 0.0 : throughput / current.flows.size());
+        m_delay.push_back(packets > 0 ? delay / packets : 0.0);
+    }
+
+    virtual bool Converged() const
+    {
+        std::size_t from = GetWarmupSamples();
+        return RelativeHalfWidth(m_throughput, from) < m_targetPrecision &&
+               RelativeHalfWidth(m_delay, from) < m_targetPrecision;
+    }
+
+    Ptr<FlowMonitor> m_monitor;
+    Time m_interval;
+    double m_targetPrecision{0.0};
+    bool m_stoppedEarly{false};
+    std::vector<Snapshot> m_snapshots;
+    std::vector<double> m_throughput; //!< mean flow throughput per interval, Mbps
+    std::vector<double> m_delay;      //!< mean packet delay per interval, ms
+};
+
+/**
+ * Steady-state sampler whose early stop waits for every bearer.
+ *
+ * The flows are grouped by destination port, one per bearer in the
+ * scenarios, and each group gets its own throughput and delay series next
+ * to the ones over all flows. The warm-up cut stays the one of the overall
+ * series; the run stops once the half-widths of both series of every
+ * bearer are within the target, so a light bearer that converges slowly
+ * is not hidden by the mean over all flows.
+ */
+class KpmBearerStatsSampler : public KpmStatsSampler
+{
+  public:
+    KpmBearerStatsSampler(Ptr<FlowMonitor> monitor,
+                          Ptr<Ipv4FlowClassifier> classifier,
+                          Time interval)
+        : KpmStatsSampler(monitor, interval),
+          m_classifier(classifier)
+    {
+    }
+
+    /// Relative half-widths of the throughput and delay means, per bearer port.
+    std::map<uint16_t, std::pair<double, double>> GetHalfWidths() const
+    {
+        std::map<uint16_t, std::pair<double, double>> halfWidths;
+        std::size_t from = GetWarmupSamples();
+        for (const auto& bearer : m_bearers)
+        {
+            halfWidths[bearer.first] = {RelativeHalfWidth(bearer.second.throughput, from),
+                                        RelativeHalfWidth(bearer.second.delay, from)};
+        }
+        return halfWidths;
+    }
+
+  protected:
+    struct Series
+    {
+        std::vector<double> throughput; //!< mean flow throughput per interval, Mbps
+        std::vector<double> delay;      //!< mean packet delay per interval, ms
+    };
+
+    struct Interval
+    {
+        double throughput{0.0};
+        double delaySum{0.0}; //!< ms
+        uint64_t packets{0};
+        uint32_t flows{0};
+    };
+
+    void AddInterval(const Snapshot& previous, const Snapshot& current) override
+    {
+        KpmStatsSampler::AddInterval(previous, current);
+        double seconds = (current.time - previous.time).GetSeconds();
+        std::map<uint16_t, Interval> intervals;
+        for (const auto& flow : current.flows)
+        {
+            auto it = previous.flows.find(flow.first);
+            uint64_t rxBytes = flow.second.rxBytes;
+            uint64_t rxPackets = flow.second.rxPackets;
+            Time delaySum = flow.second.delaySum;
+            if (it != previous.flows.end())
+            {
+                rxBytes -= it->second.rxBytes;
+                rxPackets -= it->second.rxPackets;
+                delaySum -= it->second.delaySum;
+            }
+            Interval& interval = intervals[m_classifier->FindFlow(flow.first).destinationPort];
+            interval.throughput += rxBytes * 8.0 / seconds / 1000 / 1000;
+            interval.delaySum += 1000 * delaySum.GetSeconds();
+            interval.packets += rxPackets;
+            interval.flows++;
+        }
+        for (const auto& interval : intervals)
+        {
+            // A bearer seen for the first time had no traffic before; once
+            // seen, FlowMonitor keeps its flows, so it gets every interval.
+            Series& series = m_bearers[interval.first];
+            series.throughput.resize(m_throughput.size() - 1, 0.0);
+            series.delay.resize(m_delay.size() - 1, 0.0);
+            const Interval& i = interval.second;
+            series.throughput.push_back(i.throughput / i.flows);
+            series.delay.push_back(i.packets > 0 ? i.delaySum / i.packets : 0.0);
+        }
+    }
+
+    bool Converged() const override
+    {
+        if (m_bearers.empty())
+        {
+            return false;
+        }
+        std::size_t from = GetWarmupSamples();
+        for (const auto& bearer : m_bearers)
+        {
+            if (RelativeHalfWidth(bearer.second.throughput, from) >= m_targetPrecision ||
+                RelativeHalfWidth(bearer.second.delay, from) >= m_targetPrecision)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    Ptr<Ipv4FlowClassifier> m_classifier;
+    std::map<uint16_t, Series> m_bearers; //!< per destination port
+};
+
+/**
+ * Average PRB utilization of every gNB and BWP during the traffic: the
+ * resource elements (RBs times symbols) the PHY used for data over those it
+ * had available, from the SlotDataStats trace of every gNB PHY, summed over
+ * the slots after Start.
+ */
+class KpmPrbUtilization
+{
+  public:
+    /// Connect to the PHY of every BWP of the gNBs.
+    void Install(const NetDeviceContainer& gnbs)
+    {
+        for (uint32_t i = 0; i < gnbs.GetN(); ++i)
+        {
+            Ptr<NrGnbNetDevice> gnb = DynamicCast<NrGnbNetDevice>(gnbs.Get(i));
+            for (uint32_t bwpId = 0; bwpId < gnb->GetCcMapSize(); ++bwpId)
+            {
+                gnb->GetPhy(bwpId)->TraceConnectWithoutContext(
+                    "SlotDataStats",
+                    MakeCallback(&KpmPrbUtilization::SlotDataStats, this));
+            }
+        }
+    }
+
+    /// Count the slots from start on (e.g. once the applications start).
+    void Start(Time start)
+    {
+        Simulator::Schedule(start, &KpmPrbUtilization::Enable, this);
+    }
+
+    /// Utilization of bwpId, whose PHY has cellId, 0 if it had no slot.
+    double Get(uint16_t cellId, uint16_t bwpId) const
+    {
+        auto it = m_counters.find({cellId, bwpId});
+        return it == m_counters.end() || it->second.available == 0
+                   ? 0.0
+                   : static_cast<double>(it->second.used) / it->second.available;
+    }
+
+  private:
+    struct Counter
+    {
+        uint64_t used{0};      //!< resource elements used by data
+        uint64_t available{0}; //!< resource elements available for data
+    };
+
+    void Enable()
+    {
+        m_enabled = true;
+    }
+
+    void SlotDataStats(const SfnSf& /* sfnSf */,
+                       uint32_t /* scheduledUe */,
+                       uint32_t usedReg,
+                       uint32_t /* usedSym */,
+                       uint32_t availableRb,
+                       uint32_t availableSym,
+                       uint16_t bwpId,
+                       uint16_t cellId)
+    {
+        if (!m_enabled)
+        {
+            return;
+        }
+        Counter& counter = m_counters[{cellId, bwpId}];
+        counter.used += usedReg;
+        counter.available += static_cast<uint64_t>(availableRb) * availableSym;
+    }
+
+    bool m_enabled{false};
+    std::map<std::pair<uint16_t, uint16_t>, Counter> m_counters; //!< per (cell id, BWP id)
+};
+
+/**
+ * Per-UE KPMs aggregated online from the trace callbacks, in place of
+ * dumping the PDCP and PHY traces and reducing them offline.
+ *
+ * For every UE the DL PDCP PDUs received give the throughput and the mean
+ * and largest PDCP delay, and for every UE and BWP the PHY transport blocks
+ * give the BLER (corrupt over received TBs) and the mean SINR. The counters
+ * are fixed-size arrays indexed by UE and BWP. Every interval one line per
+ * UE is written and the interval counters are reset, so memory does not
+ * grow with the run; Finish writes the totals of the whole run in the same
+ * columns, with time "total".
+ */
+class KpmOnlineKpms
+{
+  public:
+    /**
+     * Connect to the PHY of every BWP of the UEs now, and to the PDCP of
+     * their data radio bearers whenever the RRC creates one (attach, a
+     * dedicated bearer, the bearers rebuilt by a handover); write a line per
+     * UE to os every interval from start on.
+     */
+    void Install(const NetDeviceContainer& ues, Time start, Time interval, std::ostream& os)
+    {
+        m_os = &os;
+        m_interval = interval;
+        m_ues.clear();
+        m_numBwps = 0;
+        for (uint32_t i = 0; i < ues.GetN(); ++i)
+        {
+            Ptr<NrUeNetDevice> ue = DynamicCast<NrUeNetDevice>(ues.Get(i));
+            m_ues.push_back(ue);
+            m_numBwps = std::max<uint32_t>(m_numBwps, ue->GetCcMapSize());
+        }
+        m_ue.assign(m_ues.size(), {});
+        m_ueTotal.assign(m_ues.size(), {});
+        m_bwp.assign(m_ues.size() * m_numBwps, {});
+        m_bwpTotal.assign(m_ues.size() * m_numBwps, {});
+        for (uint32_t i = 0; i < m_ues.size(); ++i)
+        {
+            for (uint32_t bwpId = 0; bwpId < m_ues[i]->GetCcMapSize(); ++bwpId)
+            {
+                m_ues[i]->GetPhy(bwpId)->GetSpectrumPhy()->TraceConnectWithoutContext(
+                    "RxPacketTraceUe",
+                    MakeBoundCallback(&KpmOnlineKpms::RxPacketUe, this, i));
+            }
+            m_ues[i]->GetRrc()->TraceConnectWithoutContext(
+                "DrbCreated",
+                MakeBoundCallback(&KpmOnlineKpms::DrbCreated, this, i));
+            m_ues[i]->GetRrc()->TraceConnectWithoutContext(
+                "HandoverEndOk",
+                MakeBoundCallback(&KpmOnlineKpms::HandoverEndOk, this, i));
+        }
+
+        *m_os << "# time_ms\timsi\tthroughput_mbps\tdelay_ms\tmax_delay_ms\tpdus";
+        for (uint32_t bwpId = 0; bwpId < m_numBwps; ++bwpId)
+        {
+            *m_os << "\ttbs_bwp" << bwpId << "\tbler_bwp" << bwpId << "\tsinr_db_bwp" << bwpId;
+        }
+        *m_os << "\n";
+        Simulator::Schedule(start, &KpmOnlineKpms::Begin, this);
+    }
+
+    /// Write the last, partial interval and the totals of the run.
+    void Finish()
+    {
+        if (m_started)
+        {
+            Flush();
+            Write("total", m_ueTotal, m_bwpTotal, (Simulator::Now() - m_start).GetSeconds());
+        }
+        m_os->flush();
+    }
+
+  private:
+    struct UeCounter
+    {
+        uint64_t rxBytes{0};
+        uint64_t pdus{0};
+        uint64_t delaySum{0}; //!< ns
+        uint64_t maxDelay{0}; //!< ns
+    };
+
+    struct BwpCounter
+    {
+        uint64_t tbs{0};
+        uint64_t corruptTbs{0};
+        double sinrSum{0.0}; //!< linear
+    };
+
+    void Begin()
+    {
+        for (uint32_t i = 0; i < m_ues.size(); ++i)
+        {
+            ConnectPdcp(i);
+        }
+        m_started = true;
+        m_start = Simulator::Now();
+        m_intervalStart = m_start;
+        Simulator::Schedule(m_interval, &KpmOnlineKpms::Tick, this);
+    }
+
+    /**
+     * Connect to the PDCP entities of the data radio bearers of a UE not
+     * connected yet. A wildcard path only binds the bearers that exist when
+     * it is connected, so this runs again on every new bearer.
+     */
+    void ConnectPdcp(uint32_t ue)
+    {
+        std::ostringstream path;
+        path << "/NodeList/" << m_ues[ue]->GetNode()->GetId() << "/DeviceList/"
+             << m_ues[ue]->GetIfIndex()
+             << "/$ns3::NrUeNetDevice/NrUeRrc/DataRadioBearerMap/*/NrPdcp";
+        Config::MatchContainer pdcps = Config::LookupMatches(path.str());
+        for (uint32_t k = 0; k < pdcps.GetN(); ++k)
+        {
+            Ptr<Object> pdcp = pdcps.Get(k);
+            if (m_pdcps.insert(pdcp).second)
+            {
+                pdcp->TraceConnectWithoutContext(
+                    "RxPDU",
+                    MakeBoundCallback(&KpmOnlineKpms::RxPdu, this, ue));
+            }
+        }
+    }
+
+    /// Fired by the RRC while it sets the bearers up: connect once it is done.
+    static void DrbCreated(KpmOnlineKpms* kpms,
+                           uint32_t ue,
+                           uint64_t /* imsi */,
+                           uint16_t /* cellId */,
+                           uint16_t /* rnti */,
+                           uint8_t /* lcid */)
+    {
+        Simulator::ScheduleNow(&KpmOnlineKpms::ConnectPdcp, kpms, ue);
+    }
+
+    static void HandoverEndOk(KpmOnlineKpms* kpms,
+                              uint32_t ue,
+                              uint64_t /* imsi */,
+                              uint16_t /* cellId */,
+                              uint16_t /* rnti */)
+    {
+        Simulator::ScheduleNow(&KpmOnlineKpms::ConnectPdcp, kpms, ue);
+    }
+
+    void Tick()
+    {
+        Flush();
+        Simulator::Schedule(m_interval, &KpmOnlineKpms::Tick, this);
+    }
+
+    /// Write the interval counters, add them to the totals and reset them.
+    void Flush()
+    {
+        double seconds = (Simulator::Now() - m_intervalStart).GetSeconds();
+        if (seconds <= 0)
+        {
+            return;
+        }
+        std::ostringstream time;
+        time.setf(std::ios_base::fixed);
+        time.precision(3);
+        time << m_intervalStart.GetSeconds() * 1000;
+        Write(time.str(), m_ue, m_bwp, seconds);
+        for (std::size_t i = 0; i < m_ue.size(); ++i)
+        {
+            m_ueTotal[i].rxBytes += m_ue[i].rxBytes;
+            m_ueTotal[i].pdus += m_ue[i].pdus;
+            m_ueTotal[i].delaySum += m_ue[i].delaySum;
+            m_ueTotal[i].maxDelay = std::max(m_ueTotal[i].maxDelay, m_ue[i].maxDelay);
+            m_ue[i] = {};
+        }
+        for (std::size_t k = 0; k < m_bwp.size(); ++k)
+        {
+            m_bwpTotal[k].tbs += m_bwp[k].tbs;
+            m_bwpTotal[k].corruptTbs += m_bwp[k].corruptTbs;
+            m_bwpTotal[k].sinrSum += m_bwp[k].sinrSum;
+            m_bwp[k] = {};
+        }
+        m_intervalStart = Simulator::Now();
+    }
+
+    void Write(const std::string& time,
+               const std::vector<UeCounter>& ue,
+               const std::vector<BwpCounter>& bwp,
+               double seconds)
+    {
+        for (std::size_t i = 0; i < ue.size(); ++i)
+        {
+            const UeCounter& c = ue[i];
+            *m_os << time << "\t" << m_ues[i]->GetImsi() << "\t"
+                  << c.rxBytes * 8.0 / seconds / 1000 / 1000 << "\t"
+                  << (c.pdus > 0 ? c.delaySum / 1e6 / c.pdus : 0.0) << "\t" << c.maxDelay / 1e6
+                  << "\t" << c.pdus;
+            for (uint32_t bwpId = 0; bwpId < m_numBwps; ++bwpId)
+            {
+                const BwpCounter& b = bwp[i * m_numBwps + bwpId];
+                double bler = b.tbs > 0 ? static_cast<double>(b.corruptTbs) / b.tbs : 0.0;
+                double sinr = b.tbs > 0 ? 10 * std::log10(b.sinrSum / b.tbs) : 0.0;
+                *m_os << "\t" << b.tbs << "\t" << bler << "\t" << sinr;
+            }
+            *m_os << "\n";
+        }
+    }
+
+    static void RxPacketUe(KpmOnlineKpms* kpms, uint32_t ue, RxPacketTraceParams params)
+    {
+        if (!kpms->m_started || params.m_bwpId >= kpms->m_numBwps)
+        {
+            return;
+        }
+        BwpCounter& c = kpms->m_bwp[ue * kpms->m_numBwps + params.m_bwpId];
+        c.tbs++;
+        c.corruptTbs += params.m_corrupt ? 1 : 0;
+        c.sinrSum += params.m_sinr;
+    }
+
+    static void RxPdu(KpmOnlineKpms* kpms,
+                      uint32_t ue,
+                      uint16_t /* rnti */,
+                      uint8_t /* lcid */,
+                      uint32_t size,
+                      uint64_t delay)
+    {
+        if (!kpms->m_started)
+        {
+            return;
+        }
+        UeCounter& c = kpms->m_ue[ue];
+        c.rxBytes += size;
+        c.pdus++;
+        c.delaySum += delay;
+        c.maxDelay = std::max(c.maxDelay, delay);
+    }
+
+    std::ostream* m_os{nullptr};
+    Time m_interval;
+    Time m_start;
+    Time m_intervalStart;
+    bool m_started{false};
+    uint32_t m_numBwps{0};
+    std::vector<Ptr<NrUeNetDevice>> m_ues;
+    std::vector<UeCounter> m_ue;        //!< current interval, per UE
+    std::vector<UeCounter> m_ueTotal;   //!< whole run, per UE
+    std::vector<BwpCounter> m_bwp;      //!< current interval, per UE and BWP
+    std::vector<BwpCounter> m_bwpTotal; //!< whole run, per UE and BWP
+    std::set<Ptr<Object>> m_pdcps;      //!< PDCP entities connected to RxPdu
+};
+
+/**
+ * Per-UE uplink KPMs of a run with uplink traffic: from the flows the UE
+ * sends to one of the uplink ports, the throughput, mean delay and loss;
+ * from the gNB PHY, the uplink TBs of the UE, their BLER and mean SINR;
+ * and the mean PUSCH transmit power the UE power control reported (the
+ * configured PHY power if it reported none, e.g. with power control off).
+ * One line per UE is written at the end of the run.
+ */
+class KpmUplinkKpms
+{
+  public:
+    /**
+     * Connect to the gNB PHY and the UE power control of every BWP, and to
+     * the UE RRC connection and handover events; count from start.
+     */
+    void Install(const NetDeviceContainer& gnbs, const NetDeviceContainer& ues, Time start)
+    {
+        m_ues.clear();
+        for (uint32_t i = 0; i < ues.GetN(); ++i)
+        {
+            Ptr<NrUeNetDevice> ue = DynamicCast<NrUeNetDevice>(ues.Get(i));
+            m_ues.push_back(ue);
+            for (uint32_t bwpId = 0; bwpId < ue->GetCcMapSize(); ++bwpId)
+            {
+                ue->GetPhy(bwpId)->GetUplinkPowerControl()->TraceConnectWithoutContext(
+                    "ReportPuschTxPower",
+                    MakeBoundCallback(&KpmUplinkKpms::PuschTxPower, this, i));
+            }
+            ue->GetRrc()->TraceConnectWithoutContext(
+                "ConnectionEstablished",
+                MakeBoundCallback(&KpmUplinkKpms::Connected, this, i));
+            ue->GetRrc()->TraceConnectWithoutContext(
+                "HandoverEndOk",
+                MakeBoundCallback(&KpmUplinkKpms::Connected, this, i));
+        }
+        m_ue.assign(m_ues.size(), {});
+        m_keys.assign(m_ues.size(), {});
+        for (uint32_t i = 0; i < gnbs.GetN(); ++i)
+        {
+            Ptr<NrGnbNetDevice> gnb = DynamicCast<NrGnbNetDevice>(gnbs.Get(i));
+            m_gnbs[gnb->GetCellId()] = gnb;
+            for (uint32_t bwpId = 0; bwpId < gnb->GetCcMapSize(); ++bwpId)
+            {
+                gnb->GetPhy(bwpId)->GetSpectrumPhy()->TraceConnectWithoutContext(
+                    "RxPacketTraceGnb",
+                    MakeCallback(&KpmUplinkKpms::RxPacketGnb, this));
+            }
+        }
+        Simulator::Schedule(start, &KpmUplinkKpms::Begin, this);
+    }
+
+    /**
+     * Write a line per UE to os, with the flows of the run to the ports in
+     * ulPorts; throughputs over flowDuration seconds. The means over the UEs
+     * with uplink flows go to meanThroughput (Mbps) and meanDelay (ms).
+     */
+    void Write(std::ostream& os,
+               const FlowMonitor::FlowStatsContainer& stats,
+               Ptr<Ipv4FlowClassifier> classifier,
+               const std::vector<uint16_t>& ulPorts,
+               double flowDuration,
+               double& meanThroughput,
+               double& meanDelay) const
+    {
+        std::map<Ipv4Address, uint32_t> addresses;
+        for (uint32_t i = 0; i < m_ues.size(); ++i)
+        {
+            Ptr<Ipv4> ipv4 = m_ues[i]->GetNode()->GetObject<Ipv4>();
+            int32_t interface = ipv4->GetInterfaceForDevice(m_ues[i]);
+            if (interface >= 0)
+            {
+                addresses[ipv4->GetAddress(interface, 0).GetLocal()] = i;
+            }
+        }
+        std::vector<FlowCounter> flows(m_ues.size());
+        for (const auto& flow : stats)
+        {
+            Ipv4FlowClassifier::FiveTuple t = classifier->FindFlow(flow.first);
+            auto ue = addresses.find(t.sourceAddress);
+            if (ue == addresses.end() ||
+                std::find(ulPorts.begin(), ulPorts.end(), t.destinationPort) == ulPorts.end())
+            {
+                continue;
+            }
+            FlowCounter& c = flows[ue->second];
+            c.flows++;
+            c.txPackets += flow.second.txPackets;
+            c.rxPackets += flow.second.rxPackets;
+            c.rxBytes += flow.second.rxBytes;
+            c.delaySum += flow.second.delaySum.GetSeconds();
+        }
+
+        os << "# imsi\tul_flows\tul_throughput_mbps\tul_delay_ms\tul_loss\tul_tbs\tul_bler"
+              "\tul_sinr_db\tpusch_tx_power_dbm\n";
+        double throughputSum = 0.0;
+        double delaySum = 0.0;
+        uint32_t withFlows = 0;
+        for (uint32_t i = 0; i < m_ues.size(); ++i)
+        {
+            const FlowCounter& f = flows[i];
+            const UeCounter& c = m_ue[i];
+            double throughput = f.rxBytes * 8.0 / flowDuration / 1000 / 1000;
+            double delay = f.rxPackets > 0 ? 1000 * f.delaySum / f.rxPackets : 0.0;
+            // Steady-state windows can count more rx than tx packets, see
+            // GetSteadyStateStats: the loss is clamped at 0.
+            double loss = f.txPackets > f.rxPackets
+                              ? static_cast<double>(f.txPackets - f.rxPackets) / f.txPackets
+                              : 0.0;
+            double bler = c.tbs > 0 ? static_cast<double>(c.corruptTbs) / c.tbs : 0.0;
+            double sinr = c.tbs > 0 ? 10 * std::log10(c.sinrSum / c.tbs) : 0.0;
+            double txPower = c.powerReports > 0 ? c.txPowerSum / c.powerReports
+                                                : m_ues[i]->GetPhy(0)->GetTxPower();
+            os << m_ues[i]->GetImsi() << "\t" << f.flows << "\t" << throughput << "\t" << delay
+               << "\t" << loss << "\t" << c.tbs << "\t" << bler << "\t" << sinr << "\t"
+               << txPower << "\n";
+            if (f.flows > 0)
+            {
+                throughputSum += throughput;
+                delaySum += delay;
+                withFlows++;
+            }
+        }
+        meanThroughput = withFlows > 0 ? throughputSum / withFlows : 0.0;
+        meanDelay = withFlows > 0 ? delaySum / withFlows : 0.0;
+    }
+
+  private:
+    struct UeCounter
+    {
+        uint64_t tbs{0};
+        uint64_t corruptTbs{0};
+        double sinrSum{0.0}; //!< linear
+        uint64_t powerReports{0};
+        double txPowerSum{0.0}; //!< dBm
+    };
+
+    struct FlowCounter
+    {
+        uint32_t flows{0};
+        uint64_t txPackets{0};
+        uint64_t rxPackets{0};
+        uint64_t rxBytes{0};
+        double delaySum{0.0}; //!< s
+    };
+
+    void Begin()
+    {
+        m_started = true;
+    }
+
+    /**
+     * The UE connected to, or was handed over to, the gNB whose primary cell
+     * is cellId: its RNTI there maps it from the cell ID of every BWP of the
+     * gNB, as each BWP PHY reports its own.
+     */
+    static void Connected(KpmUplinkKpms* kpms,
+                          uint32_t ue,
+                          uint64_t /* imsi */,
+                          uint16_t cellId,
+                          uint16_t rnti)
+    {
+        for (const auto& key : kpms->m_keys[ue])
+        {
+            kpms->m_rntis.erase(key);
+        }
+        kpms->m_keys[ue].clear();
+        auto gnb = kpms->m_gnbs.find(cellId);
+        if (gnb == kpms->m_gnbs.end())
+        {
+            return;
+        }
+        for (uint32_t bwpId = 0; bwpId < gnb->second->GetCcMapSize(); ++bwpId)
+        {
+            std::pair<uint16_t, uint16_t> key{gnb->second->GetPhy(bwpId)->GetCellId(), rnti};
+            kpms->m_rntis[key] = ue;
+            kpms->m_keys[ue].push_back(key);
+        }
+    }
+
+    void RxPacketGnb(RxPacketTraceParams params)
+    {
+        if (!m_started)
+        {
+            return;
+        }
+        auto ue = m_rntis.find({params.m_cellId, params.m_rnti});
+        if (ue == m_rntis.end())
+        {
+            return;
+        }
+        UeCounter& c = m_ue[ue->second];
+        c.tbs++;
+        c.corruptTbs += params.m_corrupt ? 1 : 0;
+        c.sinrSum += params.m_sinr;
+    }
+
+    static void PuschTxPower(KpmUplinkKpms* kpms,
+                             uint32_t ue,
+                             uint16_t /* cellId */,
+                             uint16_t /* rnti */,
+                             double txPower)
+    {
+        if (!kpms->m_started)
+        {
+            return;
+        }
+        UeCounter& c = kpms->m_ue[ue];
+        c.powerReports++;
+        c.txPowerSum += txPower;
+    }
+
+    bool m_started{false};
+    std::vector<Ptr<NrUeNetDevice>> m_ues;
+    std::vector<UeCounter> m_ue; //!< whole run, per UE
+    std::map<uint16_t, Ptr<NrGnbNetDevice>> m_gnbs;            //!< primary cell ID -> gNB
+    std::map<std::pair<uint16_t, uint16_t>, uint32_t> m_rntis; //!< (BWP cell ID, RNTI) -> UE
+    /// Per UE, its keys in m_rntis.
+    std::vector<std::vector<std::pair<uint16_t, uint16_t>>> m_keys;
+};
+
+} // namespace ns3
+
+#endif // KPM_STATS_H
@@ -0,0 +1,103 @@
+#include "kpm-trace-sink.h"
+
+#include "ns3/core-module.h"
+
+#include <cstdio>
+#include <iostream>
+
+using namespace ns3;
+
+/*
+ * Read a time window of a trace stream written with --traceSink: the PHY RX
+ * packet records as a table, or the per-flow results of the runs. Only the
+ * chunks that overlap the window are decompressed.
+ *
+ * ./ns3 run "scratch/kpm-trace-query.cc --trace=kpm-out/sweep.kpmt --from=200 --to=210"
+ * ./ns3 run "scratch/kpm-trace-query.cc --trace=kpm-out/sweep.kpmt --index"
+ */
+
+int
+main(int argc, char* argv[])
+{
+    std::string trace = "./kpm-out/traces.kpmt";
+    double from = 0.0;
+    double to = 1e9;
+    std::string run = "";
+    bool flows = false;
+    bool index = false;
+
+    CommandLine cmd(__FILE__);
+    cmd.AddValue("trace", "trace stream", trace);
+    cmd.AddValue("from", "start of the window, ms", from);
+    cmd.AddValue("to", "end of the window, ms", to);
+    cmd.AddValue("run",
+                 "run tag (<simTag>/<parameter hash>/run<n>) to read, all runs if empty",
+                 run);
+    cmd.AddValue("flows", "print the per-flow results instead of the RX packet records", flows);
+    cmd.AddValue("index", "list the chunks of the stream", index);
+    cmd.Parse(argc, argv);
+
+    KpmTraceReader reader;
+    if (!reader.Open(trace))
+    {
+        std::cerr << "Can't read trace stream " << trace << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (index)
+    {
+        std::printf("# run\tfirst_ms\tlast_ms\trecords\traw\tstored\tparameters\n");
+        for (const auto& chunk : reader.GetChunks())
+        {
+            std::printf("%s\t%.6f\t%.6f\t%u\t%u\t%u\t%s\n",
+                        chunk.runTag.c_str(),
+                        TimeStep(chunk.first).GetSeconds() * 1000,
+                        TimeStep(chunk.last).GetSeconds() * 1000,
+                        chunk.records,
+                        chunk.rawSize,
+                        chunk.storedSize,
+                        chunk.parameters.c_str());
+        }
+        return EXIT_SUCCESS;
+    }
+
+    if (!flows)
+    {
+        std::printf("# run\ttime_ms\tside\tcellId\trnti\tbwpId\tsymStart\tnumSym\tmcs\ttbSize"
+                    "\tsinr\ttbler\tcorrupt\n");
+    }
+    bool ok = reader.ForEach(MilliSeconds(from), MilliSeconds(to), run, [&](const auto& record) {
+        if (flows && record.type == KpmTraceSink::FLOW_REPORT)
+        {
+            std::fwrite(record.data, 1, record.size, stdout);
+        }
+        else if (!flows && (record.type == KpmTraceSink::RX_PACKET_UE ||
+                            record.type == KpmTraceSink::RX_PACKET_GNB))
+        {
+            KpmRxPacketRecord rx;
+            std::memcpy(&rx, record.data, sizeof(rx));
+            std::printf("%s\t%.6f\t%s\t%u\t%u\t%u\t%u\t%u\t%u\t%u\t%f\t%f\t%u\n",
+                        record.runTag->c_str(),
+                        record.time.GetSeconds() * 1000,
+                        record.type == KpmTraceSink::RX_PACKET_UE ? "UE" : "gNB",
+                        rx.cellId,
+                        rx.rnti,
+                        rx.bwpId,
+                        rx.symStart,
+                        rx.numSym,
+                        rx.mcs,
+                        rx.tbSize,
+                        rx.sinr,
+                        rx.tbler,
+                        rx.corrupt);
+        }
+    });
+    std::cerr << reader.GetChunksRead() << " of " << reader.GetChunks().size()
+              << " chunks decompressed" << std::endl;
+    if (!ok)
+    {
+        std::cerr << "Corrupt chunk in " << trace << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,631 @@
+#ifndef KPM_TRACE_SINK_H
+#define KPM_TRACE_SINK_H
+
+#include "kpm-lz.h"
+
+#include "ns3/core-module.h"
+#include "ns3/nr-module.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace ns3
+{
+
+/**
+ * Single-producer single-consumer byte ring of trace records.
+ *
+ * The producer only writes m_head and the consumer only m_tail, each with
+ * release order after touching the bytes, so neither side takes a lock. The
+ * producer publishes whole records, so whatever the consumer pops is a
+ * sequence of complete records.
+ */
+class KpmTraceRing
+{
+  public:
+    /// capacity is rounded up to a power of two.
+    explicit KpmTraceRing(std::size_t capacity)
+    {
+        std::size_t size = 1;
+        while (size < capacity)
+        {
+            size <<= 1;
+        }
+        m_data.resize(size);
+        m_mask = size - 1;
+    }
+
+    /// Append a record made of two parts; false if it does not fit right now.
+    bool TryPush(const void* a, std::size_t aSize, const void* b, std::size_t bSize)
+    {
+        uint64_t head = m_head.load(std::memory_order_relaxed);
+        uint64_t tail = m_tail.load(std::memory_order_acquire);
+        if (m_data.size() - (head - tail) < aSize + bSize)
+        {
+            return false;
+        }
+        Copy(head, a, aSize);
+        Copy(head + aSize, b, bSize);
+        m_head.store(head + aSize + bSize, std::memory_order_release);
+        return true;
+    }
+
+    /// Append everything published so far to out; returns the bytes popped.
+    std::size_t Pop(std::string& out)
+    {
+        uint64_t tail = m_tail.load(std::memory_order_relaxed);
+        uint64_t head = m_head.load(std::memory_order_acquire);
+        std::size_t size = head - tail;
+        std::size_t begin = tail & m_mask;
+        std::size_t first = std::min(size, m_data.size() - begin);
+        out.append(m_data.data() + begin, first);
+        out.append(m_data.data(), size - first);
+        m_tail.store(head, std::memory_order_release);
+        return size;
+    }
+
+    std::size_t GetCapacity() const
+    {
+        return m_data.size();
+    }
+
+  private:
+    void Copy(uint64_t at, const void* from, std::size_t size)
+    {
+        std::size_t begin = at & m_mask;
+        std::size_t first = std::min(size, m_data.size() - begin);
+        std::memcpy(m_data.data() + begin, from, first);
+        std::memcpy(m_data.data(), static_cast<const char*>(from) + first, size - first);
+    }
+
+    std::vector<char> m_data;
+    std::size_t m_mask{0};
+    alignas(64) std::atomic<uint64_t> m_head{0}; //!< bytes published by the producer
+    alignas(64) std::atomic<uint64_t> m_tail{0}; //!< bytes consumed by the writer
+};
+
+/**
+ * Trace sink shared by the workers of a sweep: one run-tagged binary stream
+ * instead of a set of text files per run.
+ *
+ * Each producing thread (the simulation, or a REM or replication worker)
+ * gets its own SPSC ring from AddProducer, so producers never contend with
+ * each other, and one writer thread drains all rings into chunks. The
+ * writer compresses each chunk (KpmLz) and appends it to the stream with a
+ * single write(2) on a file opened with O_APPEND, so the processes of a sweep
+ * can share one stream; every chunk carries the run tag and the parameters
+ * of the process that wrote it. A producer whose ring is full waits for the writer rather than
+ * dropping records.
+ *
+ * Stream layout (native endianness): chunks of magic "KPT2", run tag and
+ * parameters (each uint16 length and bytes), first and last simulated time of its records (int64
+ * time steps), record count, raw size and stored size (uint32) and the
+ * stored payload, compressed unless the stored size equals the raw size.
+ * The chunk headers are the time index: KpmTraceReader hops from header to
+ * header and only decompresses the chunks of the interval asked for. The raw
+ * payload is a sequence of records: length of the rest of the record
+ * (uint32), type (uint16), producer (uint16), simulated time in time steps
+ * (int64) and the type's fields.
+ */
+class KpmTraceSink
+{
+  public:
+    /// Record types written by the scenarios.
+    enum Type : uint16_t
+    {
+        RX_PACKET_UE = 1,  //!< KpmRxPacketRecord of a UE PHY
+        RX_PACKET_GNB = 2, //!< KpmRxPacketRecord of a gNB PHY
+        FLOW_REPORT = 3,   //!< per-flow results text of the run, in pieces
+    };
+
+    /// Handle of one producing thread; only that thread may call Write.
+    class Producer
+    {
+      public:
+        Producer(uint16_t id, std::size_t capacity)
+            : m_ring(capacity),
+              m_id(id)
+        {
+        }
+
+        void Write(uint16_t type, Time time, const void* data, std::size_t size)
+        {
+            NS_ABORT_MSG_IF(HEADER_SIZE + size > m_ring.GetCapacity(),
+                            "Trace record of " << size << " bytes exceeds the ring");
+            char header[HEADER_SIZE];
+            uint32_t length = static_cast<uint32_t>(HEADER_SIZE - sizeof(uint32_t) + size);
+            int64_t timeStep = time.GetTimeStep();
+            std::memcpy(header, &length, sizeof(length));
+            std::memcpy(header + 4, &type, sizeof(type));
+            std::memcpy(header + 6, &m_id, sizeof(m_id));
+            std::memcpy(header + 8, &timeStep, sizeof(timeStep));
+            while (!m_ring.TryPush(header, HEADER_SIZE, data, size))
+            {
+                m_stalls++;
+                std::this_thread::yield();
+            }
+        }
+
+        /// Times Write had to wait for the writer thread.
+        uint64_t GetStalls() const
+        {
+            return m_stalls;
+        }
+
+      private:
+        friend class KpmTraceSink;
+
+        KpmTraceRing m_ring;
+        uint16_t m_id;
+        uint64_t m_stalls{0};
+    };
+
+    static constexpr std::size_t HEADER_SIZE = 16;
+    static constexpr std::size_t MAX_PRODUCERS = 256;
+    static constexpr char MAGIC[4] = {'K', 'P', 'T', '2'};
+
+    ~KpmTraceSink()
+    {
+        Close();
+    }
+
+    /**
+     * Open filename for appending and start the writer thread. runTag names
+     * the run in the stream, parameters describes it. ringSize is the
+     * capacity of each producer's ring, blockSize the payload at which the
+     * writer appends a block.
+     */
+    bool Open(const std::string& filename,
+              const std::string& runTag,
+              const std::string& parameters,
+              std::size_t ringSize = 1 << 20,
+              std::size_t blockSize = 1 << 16)
+    {
+        NS_ABORT_MSG_IF(m_fd >= 0, "Trace sink already open");
+        m_fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (m_fd < 0)
+        {
+            return false;
+        }
+        NS_ABORT_MSG_IF(runTag.size() > 0xffff || parameters.size() > 0xffff,
+                        "Trace sink run tag or parameters too long");
+        m_runTag = runTag;
+        m_parameters = parameters;
+        m_ringSize = ringSize;
+        m_blockSize = blockSize;
+        m_ok = true;
+        m_stop = false;
+        m_writer = std::thread(&KpmTraceSink::Drain, this);
+        return true;
+    }
+
+    /// A new ring for the calling thread; safe to call from any thread.
+    Producer* AddProducer()
+    {
+        std::size_t id = m_numProducers.fetch_add(1);
+        NS_ABORT_MSG_IF(id >= MAX_PRODUCERS, "Too many trace producers");
+        m_producers[id].store(new Producer(id, m_ringSize), std::memory_order_release);
+        return m_producers[id].load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Drain every ring, stop the writer and close the stream. Producers must
+     * have stopped writing. Returns false if a block could not be written.
+     */
+    bool Close()
+    {
+        if (m_fd < 0)
+        {
+            return m_ok;
+        }
+        m_stop.store(true, std::memory_order_release);
+        m_writer.join();
+        ::close(m_fd);
+        m_fd = -1;
+        for (auto& producer : m_producers)
+        {
+            delete producer.exchange(nullptr);
+        }
+        m_numProducers = 0;
+        return m_ok;
+    }
+
+    /// Record bytes drained and chunk bytes written, final after Close.
+    uint64_t GetRawBytes() const
+    {
+        return m_rawBytes;
+    }
+
+    uint64_t GetStoredBytes() const
+    {
+        return m_storedBytes;
+    }
+
+  private:
+    /// Writer thread: round-robin over the rings until Close.
+    void Drain()
+    {
+        std::string block;
+        block.reserve(m_blockSize + m_ringSize);
+        while (true)
+        {
+            // Read the flag before draining, so records published before
+            // Close are all in this last pass.
+            bool stop = m_stop.load(std::memory_order_acquire);
+            std::size_t drained = 0;
+            std::size_t numProducers = std::min(m_numProducers.load(), MAX_PRODUCERS);
+            for (std::size_t i = 0; i < numProducers; ++i)
+            {
+                if (Producer* producer = m_producers[i].load(std::memory_order_acquire))
+                {
+                    drained += producer->m_ring.Pop(block);
+                    if (block.size() >= m_blockSize)
+                    {
+                        Append(block);
+                    }
+                }
+            }
+            if (stop)
+            {
+                break;
+            }
+            if (drained == 0)
+            {
+                // Idle: hand out what there is and back off.
+                Append(block);
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+        Append(block);
+    }
+
+    /// Write payload as chunks of about m_blockSize raw bytes, cut between records.
+    void Append(std::string& payload)
+    {
+        std::size_t begin = 0;
+        int64_t first = INT64_MAX;
+        int64_t last = INT64_MIN;
+        uint32_t records = 0;
+        for (std::size_t pos = 0; pos < payload.size();)
+        {
+            uint32_t length;
+            int64_t time;
+            std::memcpy(&length, payload.data() + pos, sizeof(length));
+            std::memcpy(&time, payload.data() + pos + 8, sizeof(time));
+            first = std::min(first, time);
+            last = std::max(last, time);
+            records++;
+            pos += sizeof(length) + length;
+            if (pos - begin >= m_blockSize || pos == payload.size())
+            {
+                WriteChunk(payload.data() + begin, pos - begin, first, last, records);
+                begin = pos;
+                first = INT64_MAX;
+                last = INT64_MIN;
+                records = 0;
+            }
+        }
+        payload.clear();
+    }
+
+    void WriteChunk(const char* raw,
+                    std::size_t rawSize,
+                    int64_t first,
+                    int64_t last,
+                    uint32_t records)
+    {
+        m_compressed.clear();
+        m_lz.Compress(raw, rawSize, m_compressed);
+        bool compressed = m_compressed.size() < rawSize;
+        std::size_t storedSize = compressed ? m_compressed.size() : rawSize;
+
+        m_chunk.assign(MAGIC, sizeof(MAGIC));
+        Put<uint16_t>(m_chunk, m_runTag.size());
+        m_chunk += m_runTag;
+        Put<uint16_t>(m_chunk, m_parameters.size());
+        m_chunk += m_parameters;
+        Put<int64_t>(m_chunk, first);
+        Put<int64_t>(m_chunk, last);
+        Put<uint32_t>(m_chunk, records);
+        Put<uint32_t>(m_chunk, rawSize);
+        Put<uint32_t>(m_chunk, storedSize);
+        m_chunk.append(compressed ? m_compressed.data() : raw, storedSize);
+        ssize_t size = static_cast<ssize_t>(m_chunk.size());
+        m_ok = ::write(m_fd, m_chunk.data(), m_chunk.size()) == size && m_ok;
+        m_rawBytes += rawSize;
+        m_storedBytes += m_chunk.size();
+    }
+
+    template <typename T>
+    static void Put(std::string& out, T value)
+    {
+        out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    KpmLz m_lz;
+    std::string m_compressed;
+    std::string m_chunk;
+    uint64_t m_rawBytes{0};
+    uint64_t m_storedBytes{0};
+
+    int m_fd{-1};
+    std::string m_runTag;
+    std::string m_parameters;
+    std::size_t m_ringSize{0};
+    std::size_t m_blockSize{0};
+    bool m_ok{true};
+    std::atomic<bool> m_stop{false};
+    std::thread m_writer;
+    std::atomic<std::size_t> m_numProducers{0};
+    std::array<std::atomic<Producer*>, MAX_PRODUCERS> m_producers{};
+};
+
+/// Index entry of one chunk of a trace stream.
+struct KpmTraceChunk
+{
+    uint64_t offset{0}; //!< file offset of the stored payload
+    std::string runTag;
+    std::string parameters; //!< of the run that wrote the chunk
+    int64_t first{0}; //!< earliest record time, in time steps
+    int64_t last{0};  //!< latest record time, in time steps
+    uint32_t records{0};
+    uint32_t rawSize{0};
+    uint32_t storedSize{0};
+};
+
+/// One record of a trace stream, valid during the KpmTraceReader callback.
+struct KpmTraceRecord
+{
+    const std::string* runTag;
+    uint16_t type;
+    uint16_t producer;
+    Time time;
+    const char* data; //!< the type's fields
+    uint32_t size;
+};
+
+/**
+ * Reader of a KpmTraceSink stream with random access by time.
+ *
+ * Open builds the index from the chunk headers alone, seeking over the
+ * payloads; ForEach then reads and decompresses only the chunks whose time
+ * range overlaps the interval. A torn chunk at the end of the stream (a run
+ * that was killed while writing) ends the index.
+ */
+class KpmTraceReader
+{
+  public:
+    bool Open(const std::string& filename)
+    {
+        m_chunks.clear();
+        m_chunksRead = 0;
+        m_is.close();
+        m_is.clear();
+        m_is.open(filename.c_str(), std::ios::binary);
+        if (!m_is.is_open())
+        {
+            return false;
+        }
+        m_is.seekg(0, std::ios::end);
+        uint64_t fileSize = m_is.tellg();
+        uint64_t pos = 0;
+        while (true)
+        {
+            m_is.seekg(pos);
+            char magic[sizeof(KpmTraceSink::MAGIC)];
+            uint16_t tagSize = 0;
+            if (!m_is.read(magic, sizeof(magic)) ||
+                std::memcmp(magic, KpmTraceSink::MAGIC, sizeof(magic)) != 0 || !Get(tagSize))
+            {
+                break;
+            }
+            KpmTraceChunk chunk;
+            chunk.runTag.resize(tagSize);
+            uint16_t parametersSize = 0;
+            if (!m_is.read(&chunk.runTag[0], tagSize) || !Get(parametersSize))
+            {
+                break;
+            }
+            chunk.parameters.resize(parametersSize);
+            if (!m_is.read(&chunk.parameters[0], parametersSize) || !Get(chunk.first) ||
+                !Get(chunk.last) || !Get(chunk.records) || !Get(chunk.rawSize) ||
+                !Get(chunk.storedSize))
+            {
+                break;
+            }
+            chunk.offset = m_is.tellg();
+            if (chunk.offset + chunk.storedSize > fileSize)
+            {
+                break;
+            }
+            pos = chunk.offset + chunk.storedSize;
+            m_chunks.push_back(std::move(chunk));
+        }
+        m_is.clear();
+        return true;
+    }
+
+    const std::vector<KpmTraceChunk>& GetChunks() const
+    {
+        return m_chunks;
+    }
+
+    /**
+     * Call f(const KpmTraceRecord&) for every record with time in [from, to]
+     * of the run runTag (of every run if empty). Returns false if a chunk
+     * could not be read or decompressed.
+     */
+    template <typename F>
+    bool ForEach(Time from, Time to, const std::string& runTag, F f)
+    {
+        for (const KpmTraceChunk& chunk : m_chunks)
+        {
+            if (chunk.last < from.GetTimeStep() || chunk.first > to.GetTimeStep() ||
+                (!runTag.empty() && chunk.runTag != runTag))
+            {
+                continue;
+            }
+            if (!Load(chunk))
+            {
+                return false;
+            }
+            m_chunksRead++;
+            for (std::size_t pos = 0; pos + KpmTraceSink::HEADER_SIZE <= m_raw.size();)
+            {
+                const char* p = m_raw.data() + pos;
+                uint32_t length;
+                int64_t time;
+                KpmTraceRecord record;
+                std::memcpy(&length, p, sizeof(length));
+                std::memcpy(&record.type, p + 4, sizeof(record.type));
+                std::memcpy(&record.producer, p + 6, sizeof(record.producer));
+                std::memcpy(&time, p + 8, sizeof(time));
+                if (length < KpmTraceSink::HEADER_SIZE - 4 || length > m_raw.size() - pos - 4)
+                {
+                    return false;
+                }
+                pos += 4 + length;
+                if (time < from.GetTimeStep() || time > to.GetTimeStep())
+                {
+                    continue;
+                }
+                record.runTag = &chunk.runTag;
+                record.time = TimeStep(time);
+                record.data = p + KpmTraceSink::HEADER_SIZE;
+                record.size = length + 4 - KpmTraceSink::HEADER_SIZE;
+                f(record);
+            }
+        }
+        return true;
+    }
+
+    /// Chunks decompressed by ForEach since Open.
+    uint64_t GetChunksRead() const
+    {
+        return m_chunksRead;
+    }
+
+  private:
+    template <typename T>
+    bool Get(T& value)
+    {
+        return static_cast<bool>(m_is.read(reinterpret_cast<char*>(&value), sizeof(value)));
+    }
+
+    bool Load(const KpmTraceChunk& chunk)
+    {
+        m_stored.resize(chunk.storedSize);
+        m_is.seekg(chunk.offset);
+        if (!m_is.read(&m_stored[0], chunk.storedSize))
+        {
+            m_is.clear();
+            return false;
+        }
+        m_raw.clear();
+        if (chunk.storedSize == chunk.rawSize)
+        {
+            m_raw.swap(m_stored);
+            return true;
+        }
+        return KpmLz::Decompress(m_stored.data(), m_stored.size(), chunk.rawSize, m_raw);
+    }
+
+    std::ifstream m_is;
+    std::vector<KpmTraceChunk> m_chunks;
+    std::string m_stored;
+    std::string m_raw;
+    uint64_t m_chunksRead{0};
+};
+
+/// Fields of an RX_PACKET_UE or RX_PACKET_GNB record.
+struct KpmRxPacketRecord
+{
+    double sinr;
+    double tbler;
+    uint32_t tbSize;
+    uint16_t cellId;
+    uint16_t rnti;
+    uint16_t bwpId;
+    uint16_t symStart;
+    uint16_t numSym;
+    uint8_t mcs;
+    uint8_t corrupt;
+};
+
+/**
+ * Write the PHY RX packet traces of the gNBs and UEs, which the NR helper
+ * otherwise writes as RxPacketTrace.txt, to a trace sink producer.
+ */
+class KpmRxPacketTrace
+{
+  public:
+    void Install(KpmTraceSink::Producer* producer,
+                 const NetDeviceContainer& gnbs,
+                 const NetDeviceContainer& ues)
+    {
+        m_producer = producer;
+        for (uint32_t i = 0; i < gnbs.GetN(); ++i)
+        {
+            Ptr<NrGnbNetDevice> gnb = DynamicCast<NrGnbNetDevice>(gnbs.Get(i));
+            for (uint32_t bwpId = 0; bwpId < gnb->GetCcMapSize(); ++bwpId)
+            {
+                gnb->GetPhy(bwpId)->GetSpectrumPhy()->TraceConnectWithoutContext(
+                    "RxPacketTraceGnb",
+                    MakeCallback(&KpmRxPacketTrace::RxPacketGnb, this));
+            }
+        }
+        for (uint32_t i = 0; i < ues.GetN(); ++i)
+        {
+            Ptr<NrUeNetDevice> ue = DynamicCast<NrUeNetDevice>(ues.Get(i));
+            for (uint32_t bwpId = 0; bwpId < ue->GetCcMapSize(); ++bwpId)
+            {
+                ue->GetPhy(bwpId)->GetSpectrumPhy()->TraceConnectWithoutContext(
+                    "RxPacketTraceUe",
+                    MakeCallback(&KpmRxPacketTrace::RxPacketUe, this));
+            }
+        }
+    }
+
+  private:
+    void RxPacketGnb(RxPacketTraceParams params)
+    {
+        Write(KpmTraceSink::RX_PACKET_GNB, params);
+    }
+
+    void RxPacketUe(RxPacketTraceParams params)
+    {
+        Write(KpmTraceSink::RX_PACKET_UE, params);
+    }
+
+    void Write(uint16_t type, const RxPacketTraceParams& params)
+    {
+        KpmRxPacketRecord record{params.m_sinr,
+                                 params.m_tbler,
+                                 params.m_tbSize,
+                                 params.m_cellId,
+                                 params.m_rnti,
+                                 params.m_bwpId,
+                                 params.m_symStart,
+                                 params.m_numSym,
+                                 params.m_mcs,
+                                 params.m_corrupt};
+        m_producer->Write(type, Simulator::Now(), &record, sizeof(record));
+    }
+
+    KpmTraceSink::Producer* m_producer{nullptr};
+};
+
+} // namespace ns3
+
+#endif // KPM_TRACE_SINK_H
@@ -0,0 +1,121 @@
+#!/bin/bash
+# Regression benchmark suite: runs a fixed set of scenarios, checks their
+# KPMs against kpm-benchmarks.golden and fails if a run got slower, processes
+# fewer events per second or needs more memory than its budget. The
+# self-checking programs in checks run first. A scenario without golden
+# values fails; the golden file is only written by --update.
+#
+# Run from the ns-3 root, on an optimized build:
+#   ./scratch/run_benchmarks.sh           check against the golden values
+#   ./scratch/run_benchmarks.sh --update  record the current runs as golden
+
+golden="$(dirname "$0")/kpm-benchmarks.golden"
+outDir=./kpm-out/benchmarks
+kpmTolerance=0.0001 # relative, the runs are deterministic
+perfTolerance=0.25  # relative headroom of wall time, event rate and peak RSS
+
+# name program arguments
+scenarios=(
+  "default-rem haca-kpm"
+  "default-no-rem haca-kpm-no-rem"
+  "small-rem haca-kpm --numGnb=2 --direction=DL --mode=BEAM_SHAPE"
+  "medium-rem haca-kpm --numGnb=4 --direction=DL --mode=BEAM_SHAPE"
+  "large-rem haca-kpm --numGnb=8 --direction=DL --mode=BEAM_SHAPE --leanTracing=1"
+  "small-no-rem haca-kpm-no-rem --numGnb=2"
+  "medium-no-rem haca-kpm-no-rem --numGnb=4"
+  "large-no-rem haca-kpm-no-rem --numGnb=8"
+)
+
+header="# scenario metric value tolerance, written by run_benchmarks.sh"
+
+# The golden lines of scenario $1 from its benchmark report $2.
+golden_values() {
+  awk -v name="$1" -v kpm=$kpmTolerance -v perf=$perfTolerance '
+    $1 == "wallTime" || $1 == "eventsPerSecond" || $1 == "peakRss" { print name, $1, $2, perf }
+    $1 == "events" || $1 ~ /^meanFlow/ { print name, $1, $2, kpm }' "$2"
+}
+
+update=0
+if [ "$1" == "--update" ]
+then
+  update=1
+elif [ ! -f "$golden" ]
+then
+  echo "missing $golden"
+  exit 1
+fi
+
+mkdir -p "$outDir"
+failed=0
+
+# Self-checking programs, which exit non-zero on a failed check.
+checks=(kpm-check-bwp-load)
+for check in "${checks[@]}"
+do
+  echo "checking $check"
+  if ./ns3 run "scratch/$check.cc"
+  then
+    echo "ok $check"
+  else
+    echo "FAIL $check"
+    failed=1
+  fi
+done
+
+for scenario in "${scenarios[@]}"
+do
+  read -r name program args <<< "$scenario"
+  report="$outDir/$name"
+  echo "running $name"
+  rm -f "$report"
+  if ! ./ns3 run "scratch/$program.cc $args --benchmarkReport=$report --resultsDb= --resultsOutput=file"
+  then
+    echo "FAIL $name: run failed"
+    failed=1
+    continue
+  fi
+  if [ $update == 1 ]
+  then
+    continue
+  fi
+  # KPMs and the event count must match, the wall time and peak RSS stay
+  # within budget and the event rate above it.
+  if ! awk -v name="$name" '
+    FNR == NR { if ($1 == name) { golden[$2] = $3; tolerance[$2] = $4 } next }
+    ($1 in golden) {
+      g = golden[$1]; t = tolerance[$1]; v = $2; checked++
+      if ($1 == "wallTime" || $1 == "peakRss") bad = v > g * (1 + t)
+      else if ($1 == "eventsPerSecond") bad = v < g * (1 - t)
+      else bad = (v > g ? v - g : g - v) > t * (g < 0 ? -g : g)
+      if (bad) { printf "FAIL %s: %s %s, golden %s (tolerance %s)\n", name, $1, v, g, t; failed = 1 }
+    }
+    END {
+      if (!checked) { printf "FAIL %s: no golden values\n", name; failed = 1 }
+      exit failed
+    }' "$golden" "$report"
+  then
+    failed=1
+  else
+    echo "ok $name"
+  fi
+done
+
+if [ $update == 1 ] && [ $failed == 0 ]
+then
+  {
+    echo "$header"
+    for scenario in "${scenarios[@]}"
+    do
+      read -r name program args <<< "$scenario"
+      golden_values "$name" "$outDir/$name"
+    done
+  } > "$golden"
+  echo "golden values written to $golden"
+fi
+
+if [ $failed == 1 ]
+then
+  echo "benchmarks failed"
+  exit 1
+fi
+echo "benchmarks passed"
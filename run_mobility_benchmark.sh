@@ -0,0 +1,36 @@
+#!/bin/bash
+# Events per second of the mobile scenario against UE speed: one run per
+# speed and mobility model, with the beams of a UE recomputed only when it
+# moved beyond beamUpdateDistance. Prints a table of the runs.
+#
+# Run from the ns-3 root, on an optimized build:
+#   ./scratch/run_mobility_benchmark.sh [extra haca-kpm arguments]
+
+outDir=./kpm-out/benchmarks/mobility
+speeds=(0 1 3 10 30)
+models=(linear waypoint)
+
+mkdir -p "$outDir"
+printf "model\tspeed\tevents\teventsPerSecond\twallTime\tbeamUpdates\tmeanFlowThroughput\n"
+for model in "${models[@]}"
+do
+  for speed in "${speeds[@]}"
+  do
+    report="$outDir/$model-$speed"
+    rm -f "$report"
+    if ! ./ns3 run "scratch/haca-kpm.cc --direction=DL --mode=BEAM_SHAPE --mobility=$model \
+        --ueSpeed=$speed --benchmarkReport=$report --resultsDb= --resultsOutput=file $*" \
+        > "$report.log" 2>&1
+    then
+      echo "run $model at $speed m/s failed, see $report.log"
+      exit 1
+    fi
+    awk -v model="$model" -v speed="$speed" '
+      { value[$1] = $2 }
+      END {
+        printf "%s\t%s\t%s\t%s\t%s\t%d\t%s\n", model, speed, value["events"],
+               value["eventsPerSecond"], value["wallTime"], value["beamUpdates"],
+               value["meanFlowThroughput"]
+      }' "$report"
+  done
+done
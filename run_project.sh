@@ -1,9 +1,10 @@
 #!/bin/bash
 
 echo "running simulation..."
-for direction in UL # DL
+# ALL computes every direction or mode from one scenario build.
+for direction in ALL # DL UL
 do
-  for mode in UE_COVERAGE # BEAM_SHAPE COVERAGE_AREA 
+  for mode in ALL # BEAM_SHAPE COVERAGE_AREA UE_COVERAGE
   do
     for power in 35 # 20 50
     do